@@ -509,15 +509,19 @@ void boot(int biosdev)
 
 		if (strlen(bootFile))
 		{
-			retStatus = LoadThinFatFile(bootFile, &fileLoadBuffer);
-
-			if (retStatus <= 0 && gArchCPUType == CPU_TYPE_X86_64)
+			// LZSS compressed kernelcaches are decompressed while being read.
+			if ((retStatus = loadCompressedKernel(bootFile, &fileLoadBuffer)) <= 0)
 			{
-				_BOOT_DEBUG_DUMP("Load failed for arch=x86_64, trying arch=i386 now.\n");
+				retStatus = LoadThinFatFile(bootFile, &fileLoadBuffer);
 
-				gArchCPUType = CPU_TYPE_I386;
+				if (retStatus <= 0 && gArchCPUType == CPU_TYPE_X86_64)
+				{
+					_BOOT_DEBUG_DUMP("Load failed for arch=x86_64, trying arch=i386 now.\n");
 
-				retStatus = LoadThinFatFile(bootFile, &fileLoadBuffer);
+					gArchCPUType = CPU_TYPE_I386;
+
+					retStatus = LoadThinFatFile(bootFile, &fileLoadBuffer);
+				}
 			}
 
 			_BOOT_DEBUG_DUMP("LoadStatus(%d): %s\n", retStatus, bootFile);
@@ -564,6 +568,17 @@ void boot(int biosdev)
 			}
 			
 			_BOOT_DEBUG_DUMP("execKernel-4\n");
+
+#if DEBUG_DISK
+			diskPrintStats();
+			sleep(5);
+#endif
+
+#if CACHE_STATS
+			CachePrintStats();
+			HFSPrintStats();
+			sleep(5);
+#endif
 			
 			finalizeEFITree(); // rootUUID);
 			
@@ -149,6 +149,7 @@ extern  bool inGraphicsMode(void);
  */
 
 extern long HFSGetUUID(CICell ih, char *uuidStr);
+extern void HFSPrintStats(void);
 
 /*
  * drivers.c
@@ -159,6 +160,7 @@ extern long HFSGetUUID(CICell ih, char *uuidStr);
 #endif
 
 extern long loadDrivers(char * dirSpec);
+extern long loadCompressedKernel(const char * fileSpec, void ** binary);
 extern long decodeKernel(void *binary, entry_t *rentry, char **raddr, int *rsize);
 
 typedef long (*FileLoadDrivers_t)(char *dirSpec, long plugin);
@@ -174,7 +176,7 @@ extern long (*LoadExtraDrivers_p)(FileLoadDrivers_t FileLoadDrivers_p);
  * lzss.c
  */
 
-extern int decompressLZSS(u_int8_t *dst, u_int8_t *src, u_int32_t srclen);
+#include "lzss.h"
 
 /*
  * options.c
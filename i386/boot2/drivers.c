@@ -42,8 +42,24 @@
 	#include "ramdisk.h"
 #endif
 
+#if DEBUG_DRIVERS
+	#include "cpu/proc_reg.h"
+#endif
+
+#if KEXT_INDEX_SUPPORT || KEXT_PCI_PRUNING
+	#include "kextindex.h"
+#endif
+
+#if KEXT_PCI_PRUNING
+	#include "pci.h"
+#endif
+
 #define MAX_KEXT_PATH_LENGTH	256
 
+#define kModuleHashSize			256				// Buckets of the CFBundleIdentifier index (gModuleHash).
+
+#define LZSS_CHUNK_SIZE			(256 * 1024)	// Read size of loadCompressedKernel().
+
 int gKextLoadStatus = 0; // Used to keep track of MKext loads.
 
 typedef struct Module
@@ -56,6 +72,12 @@ typedef struct Module
 	char		* executablePath;
 	char		* bundlePath;
 	long		bundlePathLength;
+	char		* bundleID;				// CFBundleIdentifier (or 0).
+	char		* executable;			// CFBundleExecutable (or 0).
+	char		* libraries;			// OSBundleLibraries identifiers, followed by an empty string (or 0).
+	struct Module *hashNext;			// Next module in the same gModuleHash bucket.
+	struct Module *workNext;			// Next module on the matchLibraries() worklist.
+	char		* pciMatches;			// PCI match strings, like in the kext index (or 0).
 } Module, *ModulePtr;
 
 typedef struct DriverInfo
@@ -101,19 +123,37 @@ static unsigned long localAdler32(unsigned char * buffer, long length);
 
 static int loadKexts(char *dirSpec, bool plugin);
 static int loadPlist(char * dirSpec, bool isBundleType2Flag);
+static void addModule(ModulePtr module);
+
+#if KEXT_INDEX_SUPPORT
+	static int loadKextIndex(void);
+#endif
 static long loadMatchedModules(void);
+static long getExecutableSize(char * fileSpec, uint64_t * offset, long * headerLength);
+static long readExecutable(char * fileSpec, void * buffer, uint64_t offset, long length, long headerLength);
 static long matchLibraries(void);
+static ModulePtr findModule(char * bundleID);
 
 #ifdef NOTDEF
-	static ModulePtr	findModule(char *name);
 	static void			ThinFatFile(void **loadAddrP, unsigned long *lengthP);
 #endif
 
 static long parseXML(char *buffer, ModulePtr *module, TagPtr *personalities);
+
+#if KEXT_PCI_PRUNING
+	static char * getPCIMatches(TagPtr moduleDict);
+	static void prunePCIModules(void);
+	static bool matchPCIValue(char * list, uint32_t value);
+#endif
 static long initDriverSupport(void);
 
 static ModulePtr gModuleHead, gModuleTail;
 static TagPtr    gPersonalityHead, gPersonalityTail;
+static ModulePtr gModuleHash[kModuleHashSize];
+
+#if DEBUG_DRIVERS
+	static long gModuleCompares;	// strcmp() calls made by findModule().
+#endif
 
 
 //==============================================================================
@@ -199,17 +239,32 @@ long loadDrivers(char * dirSpec)
 
 		if ((gKextLoadStatus & 1) == 0)
 		{
-			_DRIVERS_DEBUG_DUMP("\nCalling loadKexts(\"/System/Library/Extensions\");\n");
-
-			if (loadKexts("/System/Library/Extensions", 0) == STATE_SUCCESS)
+#if KEXT_INDEX_SUPPORT
+			// Skips the walk (and the Info.plist parsing) when the index is up to date.
+			if (loadKextIndex() == STATE_SUCCESS)
 			{
-				_DRIVERS_DEBUG_DUMP("loadKexts(1) OK.\n");
+				_DRIVERS_DEBUG_DUMP("loadKextIndex() OK.\n");
 			}
+			else
+#endif
+			{
+				_DRIVERS_DEBUG_DUMP("\nCalling loadKexts(\"/System/Library/Extensions\");\n");
+
+				if (loadKexts("/System/Library/Extensions", 0) == STATE_SUCCESS)
+				{
+					_DRIVERS_DEBUG_DUMP("loadKexts(1) OK.\n");
+				}
 
-			_DRIVERS_DEBUG_DUMP("\n");
+				_DRIVERS_DEBUG_DUMP("\n");
+			}
 		}
 	}
 
+#if KEXT_PCI_PRUNING
+	// Skips drivers for PCI devices that aren't there (before their libraries are added).
+	prunePCIModules();
+#endif
+
 	matchLibraries();
 	loadMatchedModules();
 
@@ -321,15 +376,29 @@ static int loadKexts(char * targetFolder, bool isPluginRun)
 	bool isBundleType2 = false;
 	
     long result = -1;
-    long dirEntryFlags, dirEntryTime, dirEntryIndex = 0;
-	
-    const char * dirEntryName;
+    long dirEntryFlags, dirEntryTime;
 	
+	DirEntry dirEntry;
+
+	// Read the catalog nodes of the folder (and of its kexts) in one go.
+	if (!isPluginRun)
+	{
+		PrefetchDir(targetFolder);
+	}
+
+	// The iterator keeps the current catalog leaf node, so the walk costs one node lookup per leaf.
+	struct dirstuff * dirp = opendir(targetFolder);
+
+	if (dirp == NULL)
+	{
+		return result;
+	}
+
 	while (1)
 	{
 		_DRIVERS_DEBUG_DUMP("O");
 		
-		result = GetDirEntry(targetFolder, &dirEntryIndex, &dirEntryName, &dirEntryFlags, &dirEntryTime);
+		result = readdir_entry(dirp, &dirEntry);
 		
 		if (result == -1)
 		{
@@ -340,12 +409,12 @@ static int loadKexts(char * targetFolder, bool isPluginRun)
 		}
 		
 		// Kexts are just folders so we need to have one.
-		if ((dirEntryFlags & kFileTypeMask) == kFileTypeDirectory)
+		if ((dirEntry.flags & kFileTypeMask) == kFileTypeDirectory)
 		{
 			// Checking the file extension.
-			if (strcmp(dirEntryName + (strlen(dirEntryName) - 5), ".kext") == 0)
+			if ((strlen(dirEntry.name) > 5) && (strcmp(dirEntry.name + (strlen(dirEntry.name) - 5), ".kext") == 0))
 			{
-				sprintf(gPlatform.KextFileName, "%s/%s", targetFolder, dirEntryName);
+				sprintf(gPlatform.KextFileName, "%s/%s", targetFolder, dirEntry.name);
 
 #if DEBUG_DRIVERS
 				if (strlen(gPlatform.KextFileName) >= MAX_KEXT_PATH_LENGTH)
@@ -379,6 +448,8 @@ static int loadKexts(char * targetFolder, bool isPluginRun)
 		}
 	}
 
+	closedir(dirp);
+
 	return result;
 }
 
@@ -449,63 +520,49 @@ static int loadPlist(char * targetFolder, bool isBundleType2)
 
 				if (plistBuffer)
 				{
-					strlcpy(plistBuffer, (char *)kLoadAddr, plistLength);
+					// Keep a copy of the plist for the kernel, and parse the one in the
+					// load buffer (the parser writes into its input).
+					memcpy(plistBuffer, (char *)kLoadAddr, plistLength - 1);
+					((char *)kLoadAddr)[plistLength - 1] = '\0';
 
 					// parseXML returns 0 on success so we check that here.
-					if (parseXML(plistBuffer, &module, &personalities) == 0)
+					if (parseXML((char *)kLoadAddr, &module, &personalities) == 0)
 					{
-						// Allocate memory for the driver path and the plist.
 						module->executablePath = tmpExecutablePath;
 						module->bundlePath = tmpBundlePath;
 						module->bundlePathLength = bundlePathLength;
-						module->plistAddr = (void *)malloc(plistLength);
+						module->plistAddr = plistBuffer;
+						module->plistLength = plistLength;
 
-						if (module->plistAddr)
-						{
-							// Tell free() to take no action for these two (by passing 0 as argument).
-							tmpBundlePath = tmpExecutablePath = 0;
+						// Tell free() to take no action for these three (by passing 0 as argument).
+						plistBuffer = tmpBundlePath = tmpExecutablePath = 0;
+
+						addModule(module);
 
-							// Add the plist to the module.
-							strlcpy(module->plistAddr, (char *)kLoadAddr, plistLength);
-							module->plistLength = plistLength;
+						// Add the personalities to the personalities list.
+						if (personalities)
+						{
+							personalities = personalities->tag;
+						}
 
-							// Add the module to the end of the module list.
-							if (gModuleHead == 0)
+						while (personalities != 0)
+						{
+							if (gPersonalityHead == 0)
 							{
-								gModuleHead = module;
+								gPersonalityHead = personalities->tag;
 							}
 							else
 							{
-								gModuleTail->nextModule = module;			
-							}
-
-							gModuleTail = module;
-	
-							// Add the personalities to the personalities list.
-							if (personalities)
-							{
-								personalities = personalities->tag;
+								gPersonalityTail->tagNext = personalities->tag;
 							}
 
-							while (personalities != 0)
-							{
-								if (gPersonalityHead == 0)
-								{
-									gPersonalityHead = personalities->tag;
-								}
-								else
-								{
-									gPersonalityTail->tagNext = personalities->tag;
-								}
-
-								gPersonalityTail = personalities->tag;
-								personalities = personalities->tagNext;
-							}
+							gPersonalityTail = personalities->tag;
+							personalities = personalities->tagNext;
+						}
 
-							result = 0;
+						result = 0;
 
-							_DRIVERS_DEBUG_DUMP(".");
-						}
+						_DRIVERS_DEBUG_DUMP(".");
 					}
 
 					free(plistBuffer);
@@ -524,98 +581,357 @@ static int loadPlist(char * targetFolder, bool isBundleType2)
 
 
 //==============================================================================
+// Returns the gModuleHash bucket for a bundle identifier (FNV-1a).
 
-static long loadMatchedModules(void)
+static unsigned long hashBundleID(const char * bundleID)
 {
-    TagPtr        prop;
-    ModulePtr     module;
-    char          *fileName, segName[32];
-    DriverInfoPtr driver;
-    long          length, driverAddr, driverLength;
-    void          *executableAddr = 0;
+	unsigned long hash = 2166136261U;
 
-    module = gModuleHead;
+	while (*bundleID)
+	{
+		hash = (hash ^ (unsigned char)*bundleID++) * 16777619U;
+	}
 
-    while (module != 0)
-    {
-        if (module->willLoad)
-        {
-            prop = XMLGetProperty(module->dict, kPropCFBundleExecutable);
+	return hash % kModuleHashSize;
+}
 
-            if (prop != 0)
-            {
-                fileName = prop->string;
 
-                sprintf(gPlatform.KextFileSpec, "%s%s", module->executablePath, fileName);
-#if DEBUG_DRIVERS
-				if (strlen(gPlatform.KextFileSpec) >= MAX_KEXT_PATH_LENGTH)
-				{
-					stop("Error: gPlatform.KextFileSpec >= %d chars. Change MAX_KEXT_PATH_LENGTH!", MAX_KEXT_PATH_LENGTH);
-				}
+//==============================================================================
+// Adds a module to the end of the module list, and to the bundle identifier
+// index (where the first module with a given identifier wins, like it did for
+// the linear search of the list).
+
+static void addModule(ModulePtr module)
+{
+	unsigned long bucket;
+
+	if (gModuleHead == 0)
+	{
+		gModuleHead = module;
+	}
+	else
+	{
+		gModuleTail->nextModule = module;
+	}
+
+	gModuleTail = module;
+
+	if ((module->bundleID != 0) && (findModule(module->bundleID) == 0))
+	{
+		bucket = hashBundleID(module->bundleID);
+
+		module->hashNext = gModuleHash[bucket];
+		gModuleHash[bucket] = module;
+	}
+}
+
+
+#if KEXT_INDEX_SUPPORT
+//==============================================================================
+// Checks that a string list (see kextindex.h) ends with its empty string before
+// the end of the index. Each string is terminated (the index ends with a NUL).
+
+static bool checkKextIndexList(const char * index, uint32_t length, uint32_t offset)
+{
+	if (offset == 0)
+	{
+		return true;	// No list.
+	}
+
+	while (offset < length)
+	{
+		if (index[offset] == '\0')
+		{
+			return true;
+		}
+
+		offset += strlen(index + offset) + 1;
+	}
+
+	return false;
+}
+
+
+//==============================================================================
+// Sets up the module list from the kext index (see kextindex.h), which must be
+// newer than the last change of /System/Library/Extensions. Returns 0 on success
+// or -1 when there is no usable index (the caller then walks the folder).
+
+static int loadKextIndex(void)
+{
+	char indexSpec[MAX_KEXT_PATH_LENGTH];
+	char * index;
+	long flags, time;
+	uint32_t i, length, count = 0;
+
+	KextIndexHeader header;
+	KextIndexEntry * entry;
+	ModulePtr module;
+
+	if (GetFileInfo("/System/Library/", "Extensions", &flags, &time) != 0)
+	{
+		return -1;
+	}
+
+	sprintf(indexSpec, "%s/%s", gPlatform.KernelCachePath, KEXT_INDEX_FILE);
+
+	if ((ReadFileAtOffset(indexSpec, &header, 0, sizeof(header)) != sizeof(header)) ||
+		(header.signature != KEXT_INDEX_SIGNATURE) || (header.version != KEXT_INDEX_VERSION))
+	{
+		return -1;
+	}
+
+	length = header.length;
+
+	if (header.extensionsTime != (uint32_t)time)
+	{
+		_DRIVERS_DEBUG_DUMP("loadKextIndex: stale index (Extensions changed).\n");
+		return -1;
+	}
+
+	if ((length <= sizeof(header)) || (header.kextCount > ((length - sizeof(header)) / sizeof(KextIndexEntry))))
+	{
+		return -1;
+	}
+
+	// The strings and plists of the modules stay in this buffer.
+	if ((index = malloc(length)) == 0)
+	{
+		return -1;
+	}
+
+	if ((ReadFileAtOffset(indexSpec, index, 0, length) != length) || (index[length - 1] != '\0') ||
+		(header.adler32 != localAdler32((unsigned char *)index + sizeof(header), length - sizeof(header))))
+	{
+		free(index);
+		return -1;
+	}
+
+	// Validate the offsets first (so that a damaged index leaves nothing behind).
+	for (i = 0, entry = (KextIndexEntry *)(index + sizeof(header)); i < header.kextCount; i++, entry++)
+	{
+		if ((entry->bundlePath >= length) || (entry->executablePath >= length) || (entry->executable >= length) ||
+			(entry->identifier >= length) || (entry->libraries >= length) || (entry->required >= length) || (entry->pciMatches >= length) ||
+			(entry->plistOffset >= length) || (entry->plistLength > (length - entry->plistOffset)) ||
+			(entry->bundlePath == 0) || (entry->executablePath == 0) || (entry->identifier == 0) || (entry->required == 0) ||
+			(entry->plistLength == 0) || (index[entry->plistOffset + entry->plistLength - 1] != '\0') ||
+			!checkKextIndexList(index, length, entry->libraries) || !checkKextIndexList(index, length, entry->pciMatches))
+		{
+			free(index);
+			return -1;
+		}
+	}
+
+	for (i = 0, entry = (KextIndexEntry *)(index + sizeof(header)); i < header.kextCount; i++, entry++)
+	{
+		// Same rule as parseXML().
+		if (strcmp(index + entry->required, "Safe Boot") == 0)
+		{
+			continue;
+		}
+
+		if ((module = (ModulePtr)malloc(sizeof(Module))) == 0)
+		{
+			break;
+		}
+
+		module->willLoad			= 1;
+		module->plistAddr			= index + entry->plistOffset;
+		module->plistLength			= entry->plistLength;
+		module->executablePath		= index + entry->executablePath;
+		module->bundlePath			= index + entry->bundlePath;
+		module->bundlePathLength	= strlen(module->bundlePath) + 1;
+		module->bundleID			= index + entry->identifier;
+		module->executable			= entry->executable ? (index + entry->executable) : 0;
+		module->libraries			= entry->libraries ? (index + entry->libraries) : 0;
+		module->pciMatches			= entry->pciMatches ? (index + entry->pciMatches) : 0;
+
+		addModule(module);
+		count++;
+	}
+
+	_DRIVERS_DEBUG_DUMP("loadKextIndex: %d of %d kexts.\n", count, header.kextCount);
+
+	return 0;
+}
+#endif /* KEXT_INDEX_SUPPORT */
+
+
+//==============================================================================
+
+static long loadMatchedModules(void)
+{
+	ModulePtr		module;
+	char			*fileName, segName[32];
+	DriverInfoPtr	driver;
+	long			length, headerLength, driverAddr, driverLength;
+	uint64_t		offset;
+
+#if KEXT_PCI_PRUNING
+	long			skippedKexts = 0;
+	uint64_t		skippedBytes = 0, fileSize;
 #endif
-                length = LoadThinFatFile(gPlatform.KextFileSpec, &executableAddr);
 
-				if (length == 0)
+	for (module = gModuleHead; module != 0; module = module->nextModule)
+	{
+		if (module->willLoad == 0)
+		{
+#if KEXT_PCI_PRUNING
+			// What the kernel memory for it would have been (roughly). Sizing the
+			// executable costs a catalog lookup, so that is only done for -v.
+			skippedKexts++;
+			skippedBytes += sizeof(DriverInfo) + module->plistLength + module->bundlePathLength;
+
+			if (gVerboseMode && (module->executable != 0))
+			{
+				sprintf(gPlatform.KextFileSpec, "%s%s", module->executablePath, module->executable);
+
+				if (GetFileSize(gPlatform.KextFileSpec, &fileSize) == 0)
 				{
-					length = LoadFile(gPlatform.KextFileSpec);
-					executableAddr = (void *)kLoadAddr;
+					skippedBytes += fileSize;
 				}
-            }
-            else
+			}
+#endif
+			continue;
+		}
+
+		fileName = module->executable;
+		length = headerLength = 0;
+		offset = 0;
+
+		if (fileName != 0)
+		{
+			sprintf(gPlatform.KextFileSpec, "%s%s", module->executablePath, fileName);
+#if DEBUG_DRIVERS
+			if (strlen(gPlatform.KextFileSpec) >= MAX_KEXT_PATH_LENGTH)
 			{
-                length = 0;
+				stop("Error: gPlatform.KextFileSpec >= %d chars. Change MAX_KEXT_PATH_LENGTH!", MAX_KEXT_PATH_LENGTH);
 			}
+#endif
+			length = getExecutableSize(gPlatform.KextFileSpec, &offset, &headerLength);
 
-            if (length != -1)
-            {
-                //driverModuleAddr = (void *)kLoadAddr;
-                //if (length != 0)
-                //{
-                //    ThinFatFile(&driverModuleAddr, &length);
-                //}
-
-                // Make room in the image area.
-                driverLength = sizeof(DriverInfo) + module->plistLength + length + module->bundlePathLength;
-                driverAddr = AllocateKernelMemory(driverLength);
-
-                // Set up the DriverInfo.
-                driver = (DriverInfoPtr)driverAddr;
-                driver->plistAddr = (char *)(driverAddr + sizeof(DriverInfo));
-                driver->plistLength = module->plistLength;
-
-                if (length != 0)
-                {
-                    driver->executableAddr = (void *)(driverAddr + sizeof(DriverInfo) + module->plistLength);
-                    driver->executableLength = length;
-                }
-                else
-                {
-                    driver->executableAddr   = 0;
-                    driver->executableLength = 0;
-                }
-
-                driver->bundlePathAddr = (void *)(driverAddr + sizeof(DriverInfo) + module->plistLength + driver->executableLength);
-                driver->bundlePathLength = module->bundlePathLength;
-
-                // Save the plist, module and bundle.
-                strcpy(driver->plistAddr, module->plistAddr);
-
-				if (length != 0)
-				{
-					memcpy(driver->executableAddr, executableAddr, length);
-				}
+			if (length == -1)
+			{
+				continue;
+			}
+		}
 
-                strcpy(driver->bundlePathAddr, module->bundlePath);
+		// Make room in the image area (sized up front, so that nothing has to be
+		// loaded elsewhere first).
+		driverLength = sizeof(DriverInfo) + module->plistLength + length + module->bundlePathLength;
+		driverAddr = AllocateKernelMemory(driverLength);
 
-                // Add an entry to the memory map.
-                sprintf(segName, "Driver-%lx", (unsigned long)driver);
-                AllocateMemoryRange(segName, driverAddr, driverLength, kBootDriverTypeKEXT);
-            }
-        }
-        module = module->nextModule;
-    }
+		// Set up the DriverInfo.
+		driver = (DriverInfoPtr)driverAddr;
+		driver->plistAddr = (char *)(driverAddr + sizeof(DriverInfo));
+		driver->plistLength = module->plistLength;
+
+		if (length != 0)
+		{
+			driver->executableAddr = (void *)(driverAddr + sizeof(DriverInfo) + module->plistLength);
+			driver->executableLength = length;
+
+			// Read the executable (slice) straight into place.
+			if (readExecutable(gPlatform.KextFileSpec, driver->executableAddr, offset, length, headerLength) != 0)
+			{
+				ReleaseKernelMemory(driverAddr);	// Skip it (like a missing executable).
+				continue;
+			}
+		}
+		else
+		{
+			driver->executableAddr   = 0;
+			driver->executableLength = 0;
+		}
+
+		driver->bundlePathAddr = (void *)(driverAddr + sizeof(DriverInfo) + module->plistLength + driver->executableLength);
+		driver->bundlePathLength = module->bundlePathLength;
+
+		// Save the plist and bundle path.
+		memcpy(driver->plistAddr, module->plistAddr, module->plistLength);
+		strcpy(driver->bundlePathAddr, module->bundlePath);
+
+		// Add an entry to the memory map.
+		sprintf(segName, "Driver-%lx", (unsigned long)driver);
+		AllocateMemoryRange(segName, driverAddr, driverLength, kBootDriverTypeKEXT);
+	}
+
+#if KEXT_PCI_PRUNING
+	verbose("Skipped %d kexts (%d KB) without a matching PCI device.\n", skippedKexts, (uint32_t)(skippedBytes >> 10));
+#endif
 
-    return 0;
+	return 0;
+}
+
+
+//==============================================================================
+// Returns the size of the executable (the slice for our architecture in a fat
+// file) with its offset in the file, or -1 on failure. Only the first 4 KB are
+// read (into the load buffer, with headerLength set for thin files, so that
+// readExecutable doesn't read them again).
+
+static long getExecutableSize(char * fileSpec, uint64_t * offset, long * headerLength)
+{
+	void			*binary = (void *)kLoadAddr;
+	unsigned long	length;
+	uint64_t		fileSize;
+	long			readLength;
+
+	if (GetFileSize(fileSpec, &fileSize) != 0)
+	{
+		// Without the size we load it the old way (and copy it into place).
+		if ((length = LoadThinFatFile(fileSpec, &binary)) == 0)
+		{
+			length = LoadFile(fileSpec);
+			binary = (void *)kLoadAddr;
+		}
+
+		*offset = (unsigned long)binary - kLoadAddr;
+		*headerLength = length;
+
+		return length;
+	}
+
+	if ((readLength = ReadFileAtOffset(fileSpec, binary, 0, 0x1000)) == -1)
+	{
+		return -1;
+	}
+
+	if ((readLength >= (long)sizeof(struct fat_header)) && (ThinFatFile(&binary, &length) == 0) && (length != 0))
+	{
+		*offset = (unsigned long)binary - kLoadAddr;
+		*headerLength = 0;
+
+		return length;
+	}
+
+	// Thin (or no slice for us, in which case the whole file is used like before).
+	*offset = 0;
+	*headerLength = readLength;
+
+	return (long)fileSize;
+}
+
+
+//==============================================================================
+// Reads length bytes of an executable, from offset, into buffer. The first
+// headerLength bytes are already in the load buffer. Returns 0 on success.
+
+static long readExecutable(char * fileSpec, void * buffer, uint64_t offset, long length, long headerLength)
+{
+	if (headerLength > length)
+	{
+		headerLength = length;
+	}
+
+	memcpy(buffer, (void *)(kLoadAddr + (unsigned long)offset), headerLength);
+
+	if ((length > headerLength) && (ReadFileAtOffset(fileSpec, (char *)buffer + headerLength, offset + headerLength, length - headerLength) != (length - headerLength)))
+	{
+		return -1;
+	}
+
+	return 0;
 }
 
 
@@ -623,83 +939,90 @@ static long loadMatchedModules(void)
 
 static long matchLibraries(void)
 {
-	// printf("in MatchLibraries()\n");
+	ModulePtr	module, library, worklist = 0;
+	char		* bundleID;
 
-    TagPtr     prop, prop2;
-    ModulePtr  module, module2;
-    long       done;
+#if DEBUG_DRIVERS
+	ModulePtr	module2;
+	long		lookups = 0, linearCompares = 0;
 
-    do
+	gModuleCompares = 0;
+#endif
+
+	// Start with the modules that will be loaded.
+	for (module = gModuleHead; module != 0; module = module->nextModule)
 	{
-        done = 1;
-        module = gModuleHead;
-        
-        while (module != 0)
-        {
-            if (module->willLoad == 1)
-            {
-                prop = XMLGetProperty(module->dict, kPropOSBundleLibraries);
-
-                if (prop != 0)
-                {
-                    prop = prop->tag;
-
-                    while (prop != 0)
-                    {
-                        module2 = gModuleHead;
-
-                        while (module2 != 0)
-                        {
-                            prop2 = XMLGetProperty(module2->dict, kPropCFBundleIdentifier);
-
-                            if ((prop2 != 0) && (!strcmp(prop->string, prop2->string)))
-                            {
-                                if (module2->willLoad == 0)
-								{
-                                    module2->willLoad = 1;
-								}
-                                break;
-                            }
-                            module2 = module2->nextModule;
-                        }
-                        prop = prop->tagNext;
-                    }
-                }
-                module->willLoad = 2;
-                done = 0;
-            }
-            module = module->nextModule;
-        }
-    }
-    while (!done);
+		if (module->willLoad == 1)
+		{
+			module->workNext = worklist;
+			worklist = module;
+		}
+	}
+
+	// Each module is taken off the worklist once. Libraries that aren't marked
+	// yet are marked and added to it (so the dependencies of libraries are too).
+	while (worklist != 0)
+	{
+		module = worklist;
+		worklist = module->workNext;
+		module->willLoad = 2;
+
+		for (bundleID = module->libraries; (bundleID != 0) && (*bundleID != '\0'); bundleID += strlen(bundleID) + 1)
+		{
+			library = findModule(bundleID);
+
+#if DEBUG_DRIVERS
+			// The compares that a search of the module list would have made.
+			for (lookups++, module2 = gModuleHead; module2 != 0; module2 = module2->nextModule)
+			{
+				if (module2->bundleID != 0)
+				{
+					linearCompares++;
+
+					if (strcmp(bundleID, module2->bundleID) == 0)
+					{
+						break;
+					}
+				}
+			}
+#endif
+			if ((library != 0) && (library->willLoad == 0))
+			{
+				library->willLoad = 1;
+				library->workNext = worklist;
+				worklist = library;
+			}
+		}
+	}
+
+	_DRIVERS_DEBUG_DUMP("matchLibraries: %d lookups, %d compares (%d saved).\n", lookups, gModuleCompares, linearCompares - gModuleCompares);
 
-    return 0;
+	return 0;
 }
 
 
 //==============================================================================
+// Returns the (first) module with the given CFBundleIdentifier, or 0.
 
-#if NOTDEF
-static ModulePtr FindModule(char * name)
+static ModulePtr findModule(char * bundleID)
 {
-	TagPtr    prop;
-	ModulePtr module = gModuleHead;
+	ModulePtr module = gModuleHash[hashBundleID(bundleID)];
 
 	while (module != 0)
 	{
-		prop = GetProperty(module->dict, kPropCFBundleIdentifier);
-
-		if ((prop != 0) && !strcmp(name, prop->string))
+#if DEBUG_DRIVERS
+		gModuleCompares++;
+#endif
+		if (strcmp(bundleID, module->bundleID) == 0)
 		{
 			break;
 		}
 
-		module = module->nextModule;
+		module = module->hashNext;
 	}
-    
+
 	return module;
 }
-#endif /* NOTDEF */
 
 
 //==============================================================================
@@ -761,7 +1084,7 @@ static bool isLoadableInSafeBoot(char * OSBundleRequired)
 static long parseXML(char * buffer, ModulePtr * module, TagPtr * personalities)
 {
 	long       length, pos = 0;
-	TagPtr     moduleDict, required;
+	TagPtr     moduleDict, required, prop, library;
 	ModulePtr  tmpModule;
   
 	while (1)
@@ -812,6 +1135,40 @@ static long parseXML(char * buffer, ModulePtr * module, TagPtr * personalities)
 
 	tmpModule->dict = moduleDict;
 
+	// The properties used for matching (kept as strings, like in the kext index).
+	if (((prop = XMLGetProperty(moduleDict, kPropCFBundleIdentifier)) != 0) && (prop->type == kTagTypeString))
+	{
+		tmpModule->bundleID = prop->string;
+	}
+
+	if (((prop = XMLGetProperty(moduleDict, kPropCFBundleExecutable)) != 0) && (prop->type == kTagTypeString))
+	{
+		tmpModule->executable = prop->string;
+	}
+
+	if (((prop = XMLGetProperty(moduleDict, kPropOSBundleLibraries)) != 0) && (prop->type == kTagTypeDict))
+	{
+		for (length = 1, library = prop->tag; library != 0; library = library->tagNext)
+		{
+			length += strlen(library->string) + 1;
+		}
+
+		if ((tmpModule->libraries = malloc(length)) != 0)
+		{
+			for (pos = 0, library = prop->tag; library != 0; library = library->tagNext)
+			{
+				strcpy(tmpModule->libraries + pos, library->string);
+				pos += strlen(library->string) + 1;
+			}
+
+			tmpModule->libraries[pos] = '\0';
+		}
+	}
+
+#if KEXT_PCI_PRUNING
+	tmpModule->pciMatches = getPCIMatches(moduleDict);
+#endif
+
 	// For now, load any module that has OSBundleRequired != "Safe Boot".
 
 	tmpModule->willLoad = 1;
@@ -826,6 +1183,320 @@ static long parseXML(char * buffer, ModulePtr * module, TagPtr * personalities)
 }
 
 
+#if KEXT_PCI_PRUNING
+//==============================================================================
+// Returns the PCI match strings of a kext (in the kext index format) when all its
+// personalities match on IOPCIDevice properties, or 0 when it can't be skipped.
+
+static char * getPCIMatches(TagPtr moduleDict)
+{
+	static const struct { char kind; const char * name; } matchProperties[] =
+	{
+		{ KEXT_PCI_MATCH,			"IOPCIMatch"			},
+		{ KEXT_PCI_PRIMARY_MATCH,	"IOPCIPrimaryMatch"		},
+		{ KEXT_PCI_SECONDARY_MATCH,	"IOPCISecondaryMatch"	},
+		{ KEXT_PCI_CLASS_MATCH,		"IOPCIClassMatch"		}
+	};
+
+	TagPtr	personalities, key, prop;
+	char	* pciMatches = 0;
+	long	i, length = 1, pos = 0, count;
+
+	personalities = XMLGetProperty(moduleDict, kPropIOKitPersonalities);
+
+	if ((personalities == 0) || (personalities->type != kTagTypeDict) || (personalities->tag == 0))
+	{
+		return 0;
+	}
+
+	// First pass checks the personalities and sizes the list, second pass fills it.
+	do
+	{
+		for (key = personalities->tag; key != 0; key = key->tagNext)
+		{
+			if ((key->tag == 0) || (key->tag->type != kTagTypeDict))
+			{
+				return 0;
+			}
+
+			prop = XMLGetProperty(key->tag, "IOProviderClass");
+
+			if ((prop == 0) || (prop->type != kTagTypeString) || strcmp(prop->string, "IOPCIDevice"))
+			{
+				return 0;
+			}
+
+			for (i = 0, count = 0; i < (long)(sizeof(matchProperties) / sizeof(matchProperties[0])); i++)
+			{
+				prop = XMLGetProperty(key->tag, matchProperties[i].name);
+
+				if ((prop != 0) && (prop->type == kTagTypeString))
+				{
+					if (pciMatches)
+					{
+						pciMatches[pos] = matchProperties[i].kind;
+						strcpy(pciMatches + pos + 1, prop->string);
+						pos += strlen(prop->string) + 2;
+					}
+					else
+					{
+						length += strlen(prop->string) + 2;
+					}
+
+					count++;
+				}
+			}
+
+			// Matches on something else (like IONameMatch).
+			if (count == 0)
+			{
+				return 0;
+			}
+		}
+	} while ((pciMatches == 0) && ((pciMatches = malloc(length)) != 0));
+
+	// The list ends with an empty string (malloc zeroes it).
+	return pciMatches;
+}
+
+
+//==============================================================================
+// Returns true when value matches one of the values in a match list like
+// "0x10de0000&0xffff0000 0x00001234". Anything we don't understand matches (so
+// that the kext is loaded).
+
+static bool matchPCIValue(char * list, uint32_t value)
+{
+	char		* end;
+	uint32_t	number, mask;
+
+	while (*list != '\0')
+	{
+		if ((*list == ' ') || (*list == '\t'))
+		{
+			list++;
+			continue;
+		}
+
+		number = strtoul(list, &end, 16);
+		mask = 0xFFFFFFFF;
+
+		if (end == list)
+		{
+			return true;
+		}
+
+		if (*end == '&')
+		{
+			list = end + 1;
+			mask = strtoul(list, &end, 16);
+
+			if (end == list)
+			{
+				return true;
+			}
+		}
+
+		if ((((number ^ value) & mask) == 0) || ((*end != '\0') && (*end != ' ') && (*end != '\t')))
+		{
+			return true;
+		}
+
+		list = end;
+	}
+
+	return false;
+}
+
+
+//==============================================================================
+// Clears willLoad of the kexts that only match PCI devices when none of their
+// match strings matches a device in this box. matchLibraries() sets it again for
+// the ones that another kext links against.
+
+static void prunePCIModules(void)
+{
+	ModulePtr	module;
+	PCIDevice_t	* devices;
+	char		* match;
+	bool		found, truncated;
+	int			i, deviceCount = pciGetDevices(&devices, &truncated);
+	uint32_t	primaryID, secondaryID;
+
+	if ((deviceCount == 0) || truncated)
+	{
+		return;	// Nothing (or not everything) to go by (keep them all).
+	}
+
+	for (module = gModuleHead; module != 0; module = module->nextModule)
+	{
+		if ((module->willLoad != 1) || (module->pciMatches == 0))
+		{
+			continue;
+		}
+
+		for (found = false, match = module->pciMatches; !found && (*match != '\0'); match += strlen(match) + 1)
+		{
+			for (i = 0; !found && (i < deviceCount); i++)
+			{
+				primaryID	= (devices[i].deviceID << 16) | devices[i].vendorID;
+				secondaryID	= (devices[i].subDeviceID << 16) | devices[i].subVendorID;
+
+				switch (*match)
+				{
+					case KEXT_PCI_MATCH:
+						found = matchPCIValue(match + 1, primaryID) || matchPCIValue(match + 1, secondaryID);
+						break;
+
+					case KEXT_PCI_PRIMARY_MATCH:
+						found = matchPCIValue(match + 1, primaryID);
+						break;
+
+					case KEXT_PCI_SECONDARY_MATCH:
+						found = matchPCIValue(match + 1, secondaryID);
+						break;
+
+					case KEXT_PCI_CLASS_MATCH:
+						found = matchPCIValue(match + 1, devices[i].classCode << 8);
+						break;
+
+					default:
+						found = true;
+				}
+			}
+		}
+
+		if (!found)
+		{
+			_DRIVERS_DEBUG_DUMP("prunePCIModules: skipping %s\n", module->bundleID ? module->bundleID : module->bundlePath);
+
+			module->willLoad = 0;
+		}
+	}
+}
+#endif /* KEXT_PCI_PRUNING */
+
+
+//==============================================================================
+// Reads and decompresses an LZSS compressed kernel(cache) one chunk at a time, so
+// that the compressed image doesn't have to be loaded (next to the output) first.
+// Each chunk is decoded as soon as it is read; with an asynchronous read backend
+// the next read can be started before that. Fat files (with compressed slices)
+// are streamed from the slice for our architecture. Returns the size of the kernel
+// (at *binary), 0 when the file (slice) isn't LZSS compressed (LZVN compressed
+// kernelcaches are loaded as is and decompressed by decodeKernel), or -1 on failure.
+
+long loadCompressedKernel(const char * fileSpec, void ** binary)
+{
+	u_int8_t *chunk, *buffer;
+	u_int32_t uncompressedSize, compressedSize, offset, length, sliceOffset = 0;
+	unsigned long sliceLength = 0;
+	long size = 0;
+	void *fatHeader = (void *)kLoadAddr;
+	LZSSStream stream;
+	compressed_kernel_header kernel_header;
+
+	// Thin a fat file (like LoadThinFatFile does) by picking the offset of our slice.
+	if ((ReadFileAtOffset(fileSpec, fatHeader, 0, 0x1000) >= (long)sizeof(struct fat_header)) &&
+		(ThinFatFile(&fatHeader, &sliceLength) == 0))
+	{
+		if (sliceLength == 0)
+		{
+			return 0;	// No slice for us (LoadThinFatFile has the same problem).
+		}
+
+		sliceOffset = (unsigned long)fatHeader - kLoadAddr;
+	}
+
+	if ((ReadFileAtOffset(fileSpec, &kernel_header, sliceOffset, sizeof(kernel_header)) != sizeof(kernel_header)) ||
+		(kernel_header.signature != OSSwapBigToHostConstInt32('comp')) ||
+		(kernel_header.compressType != OSSwapBigToHostConstInt32('lzss')))
+	{
+		return 0;
+	}
+
+	uncompressedSize = OSSwapBigToHostInt32(kernel_header.uncompressedSize);
+	compressedSize = OSSwapBigToHostInt32(kernel_header.compressedSize);
+
+	if (sliceLength && ((sliceLength < sizeof(kernel_header)) || (compressedSize > (sliceLength - sizeof(kernel_header)))))
+	{
+		return -1;
+	}
+
+	if ((chunk = malloc(LZSS_CHUNK_SIZE)) == NULL)
+	{
+		return -1;
+	}
+
+	if ((buffer = malloc(uncompressedSize)) == NULL)
+	{
+		free(chunk);
+		return -1;
+	}
+
+	initLZSSStream(&stream, buffer, uncompressedSize);
+
+	for (offset = 0; (offset < compressedSize) && (size >= 0); offset += length)
+	{
+		length = ((compressedSize - offset) < LZSS_CHUNK_SIZE) ? (compressedSize - offset) : LZSS_CHUNK_SIZE;
+
+		if (ReadFileAtOffset(fileSpec, chunk, sliceOffset + sizeof(kernel_header) + offset, length) != length)
+		{
+			size = -1;
+			break;
+		}
+
+		size = decompressLZSSChunk(&stream, chunk, length);
+	}
+
+	free(chunk);
+
+	_DRIVERS_DEBUG_DUMP("loadCompressedKernel: %d bytes from %d bytes.\n", size, compressedSize);
+
+#if DEBUG_DRIVERS
+	// Compare the (streamed) output with that of (and time) the ring buffer decoder.
+	u_int8_t * compressed = malloc(compressedSize);
+	u_int8_t * reference = malloc(uncompressedSize + 4096);
+
+	if (compressed && reference && (size == uncompressedSize) &&
+		(ReadFileAtOffset(fileSpec, compressed, sliceOffset + sizeof(kernel_header), compressedSize) == compressedSize))
+	{
+		uint64_t decodeStart = rdtsc64();
+		u_int32_t referenceSize = decompressLZSSRing(reference, compressed, compressedSize);
+		uint64_t decodeTime = rdtsc64() - decodeStart;
+
+		if (gPlatform.CPU.TSCFrequency)
+		{
+			printf("decompressLZSSRing: %d KB in %d ms.\n", referenceSize >> 10, (uint32_t)((decodeTime * 1000) / gPlatform.CPU.TSCFrequency));
+		}
+
+		printf("decompressLZSSChunk output %s.\n", ((referenceSize == size) && (memcmp(reference, buffer, size) == 0)) ? "matches" : "DIFFERS");
+	}
+
+	free(compressed);
+	free(reference);
+#endif
+
+	if (size != uncompressedSize)
+	{
+		error("Size mismatch from lzss: 0x08%x\n", size);
+		free(buffer);
+		return -1;
+	}
+
+	if (OSSwapBigToHostInt32(kernel_header.adler32) != localAdler32(buffer, uncompressedSize))
+	{
+		printf("Adler mismatch\n");
+		free(buffer);
+		return -1;
+	}
+
+	*binary = buffer;
+
+	return size;
+}
+
+
 //==============================================================================
 
 long decodeKernel(void *binary, entry_t *rentry, char **raddr, int *rsize)
@@ -836,7 +1507,7 @@ long decodeKernel(void *binary, entry_t *rentry, char **raddr, int *rsize)
 	long ret;
 	unsigned long len;
 
-	u_int32_t uncompressedSize, size;
+	u_int32_t uncompressedSize, compressedSize, compressType, size;
 	compressed_kernel_header * kernel_header = (compressed_kernel_header *) binary;
 
 #if DEBUG_DRIVERS
@@ -855,7 +1526,9 @@ long decodeKernel(void *binary, entry_t *rentry, char **raddr, int *rsize)
 
 	if (kernel_header->signature == OSSwapBigToHostConstInt32('comp'))
 	{
-		if (kernel_header->compressType != OSSwapBigToHostConstInt32('lzss'))
+		compressType = kernel_header->compressType;
+
+		if ((compressType != OSSwapBigToHostConstInt32('lzss')) && (compressType != OSSwapBigToHostConstInt32('lzvn')))
 		{
 			error("kernel compression is bad\n");
 			return -1;
@@ -874,13 +1547,34 @@ long decodeKernel(void *binary, entry_t *rentry, char **raddr, int *rsize)
 #endif
 
 		uncompressedSize = OSSwapBigToHostInt32(kernel_header->uncompressedSize);
+		compressedSize = OSSwapBigToHostInt32(kernel_header->compressedSize);
 		binary = buffer = malloc(uncompressedSize);
 
-		size = decompressLZSS((u_int8_t *) binary, &kernel_header->data[0], OSSwapBigToHostInt32(kernel_header->compressedSize));
+#if DEBUG_DRIVERS
+		uint64_t decodeStart = rdtsc64();
+#endif
+		if (compressType == OSSwapBigToHostConstInt32('lzvn'))
+		{
+			size = decompressLZVN((u_int8_t *) binary, uncompressedSize, &kernel_header->data[0], compressedSize);
+		}
+		else
+		{
+			size = decompressLZSS((u_int8_t *) binary, uncompressedSize, &kernel_header->data[0], compressedSize);
+		}
+
+#if DEBUG_DRIVERS
+		uint64_t decodeTime = rdtsc64() - decodeStart;
+
+		if (gPlatform.CPU.TSCFrequency)
+		{
+			printf("decompress%s: %d KB (from %d KB) in %d ms.\n", (compressType == OSSwapBigToHostConstInt32('lzvn')) ? "LZVN" : "LZSS",
+				   uncompressedSize >> 10, compressedSize >> 10, (uint32_t)((decodeTime * 1000) / gPlatform.CPU.TSCFrequency));
+		}
+#endif
 
 		if (uncompressedSize != size)
         {
-			error("Size mismatch from lzss: 0x08%x\n", size);
+			error("Size mismatch from %s: 0x08%x\n", (compressType == OSSwapBigToHostConstInt32('lzvn')) ? "lzvn" : "lzss", size);
 			return -1;
 		}
 
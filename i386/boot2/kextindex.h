@@ -0,0 +1,56 @@
+/*
+ * Kext index, written by boot2/tools/kextindex.c into the kernel cache directory
+ * and read by loadKextIndex() in drivers.c (when KEXT_INDEX_SUPPORT is set). It
+ * replaces the walk of /System/Library/Extensions and the parsing of every
+ * Info.plist – keep it free of booter types.
+ *
+ * Layout: header, kextCount entries, then the strings and Info.plist copies (all
+ * NUL terminated). Offsets are from the start of the file, values little endian.
+ */
+
+#ifndef __BOOT2_KEXTINDEX_H
+#define __BOOT2_KEXTINDEX_H
+
+#include <stdint.h>
+
+
+#define KEXT_INDEX_SIGNATURE	0x5844494B		// 'KIDX'
+#define KEXT_INDEX_VERSION		2
+#define KEXT_INDEX_FILE			"kextindex"		// In gPlatform.KernelCachePath.
+
+
+typedef struct KextIndexHeader
+{
+	uint32_t	signature;
+	uint32_t	version;
+	uint32_t	length;						// Of the file.
+	uint32_t	adler32;					// Of everything after the header.
+	uint32_t	extensionsTime;				// Modification time of /System/Library/Extensions (seconds since 1970).
+	uint32_t	kextCount;
+} KextIndexHeader;
+
+
+typedef struct KextIndexEntry
+{
+	uint32_t	bundlePath;					// "/System/Library/Extensions/Foo.kext/"
+	uint32_t	executablePath;				// Folder of the executable ("/System/Library/Extensions/Foo.kext/Contents/MacOS/").
+	uint32_t	executable;					// CFBundleExecutable (0 when there is none).
+	uint32_t	identifier;					// CFBundleIdentifier.
+	uint32_t	libraries;					// OSBundleLibraries identifiers, followed by an empty string (0 when there are none).
+	uint32_t	required;					// OSBundleRequired (kexts without one are left out).
+	uint32_t	plistOffset;				// Copy of the Info.plist.
+	uint32_t	plistLength;				// Including the NUL terminator.
+	uint32_t	pciMatches;					// PCI match strings (see below), followed by an empty string (0 when there are none).
+} KextIndexEntry;
+
+
+// A kext whose personalities all have IOProviderClass IOPCIDevice and match on one
+// of these properties gets its match strings, each one prefixed by its kind. Other
+// kexts have none (and are never skipped by KEXT_PCI_PRUNING).
+
+#define KEXT_PCI_MATCH				'M'	// IOPCIMatch (primary or secondary IDs).
+#define KEXT_PCI_PRIMARY_MATCH		'P'	// IOPCIPrimaryMatch (device and vendor ID).
+#define KEXT_PCI_SECONDARY_MATCH	'S'	// IOPCISecondaryMatch (subsystem IDs).
+#define KEXT_PCI_CLASS_MATCH		'C'	// IOPCIClassMatch (class code, without revision).
+
+#endif /* !__BOOT2_KEXTINDEX_H */
@@ -41,6 +41,7 @@
  */
 
 #include <sl.h>
+#include "boot.h"
 
 #define N			4096	// Size of ring buffer - must be power of 2.
 #define N_MIN_1		4095
@@ -52,9 +53,202 @@
 
 
 //==============================================================================
+// Decodes straight from and to memory. The whole output is in memory, so a back-
+// reference (to ring slot i) is copied from 'dst - distance' instead of from a
+// 4 KB ring that every output byte would have to be stored in as well. Only the
+// matches in the first 4 KB can reach back before the output, into the initial
+// ring contents (spaces).
+//
+// Literals are copied a run (of set flag bits) at a time, and both literals and
+// matches with eight or more bytes distance are copied eight bytes at a time when
+// there is room for it (the excess bytes are overwritten later).
+//
+// The input can be fed in chunks of any size (see loadCompressedKernel). The ring
+// position is the output position, so all that is carried over from one chunk to
+// the next are the remaining flags and the first byte of a split back-reference.
+
+void initLZSSStream(LZSSStream * stream, u_int8_t * dst, u_int32_t dstlen)
+{
+	stream->dststart	= dst;
+	stream->dst			= dst;
+	stream->dstend		= (dst + dstlen);
+	stream->flags		= 1;	// Only the stop bit (next byte has flags).
+	stream->pending		= -1;
+}
+
+
+//==============================================================================
+// Returns the number of bytes decoded so far, or -1 when the output doesn't fit.
+
+int decompressLZSSChunk(LZSSStream * stream, u_int8_t * src, u_int32_t srclen)
+{
+	u_int8_t * dststart = stream->dststart;
+	u_int8_t * dstend = stream->dstend;
+	u_int8_t * dst = stream->dst;
+	u_int8_t * from;
+	u_int8_t * matchend;
+	const u_int8_t * srcend = (src + srclen);
+
+	unsigned int i, distance, length, run;
+	unsigned int flags = stream->flags;
+
+	while (1)
+	{
+		if (flags == 1)
+		{
+			if (src >= srcend)
+			{
+				break;
+			}
+
+			flags = *src++ | 0x100;  // Stop bit after the eight flags.
+		}
+
+		if (flags & 1)
+		{
+			if (src >= srcend)
+			{
+				break;
+			}
+
+			// Run of literals (the stop bit doesn't count).
+			run = __builtin_ctz(~flags);
+
+			if ((flags >> run) == 0)
+			{
+				run--;
+			}
+
+			if (((dstend - dst) >= 8) && ((srcend - src) >= 8))
+			{
+				*(u_int32_t *)dst = *(u_int32_t *)src;
+				*(u_int32_t *)(dst + 4) = *(u_int32_t *)(src + 4);
+				dst += run;
+				src += run;
+				flags >>= run;
+				continue;
+			}
+
+			if (run > (unsigned int)(srcend - src))
+			{
+				run = srcend - src;
+			}
+
+			if (run > (unsigned int)(dstend - dst))
+			{
+				return -1;
+			}
+
+			flags >>= run;
+
+			while (run--)
+			{
+				*dst++ = *src++;
+			}
+
+			continue;
+		}
+
+		// Back-reference (split over two chunks?)
+		if (stream->pending >= 0)
+		{
+			if (src >= srcend)
+			{
+				break;
+			}
+
+			i = stream->pending;
+			stream->pending = -1;
+		}
+		else
+		{
+			if ((src + 2) > srcend)
+			{
+				if (src < srcend)
+				{
+					stream->pending = *src++;
+				}
+
+				break;
+			}
+
+			i = *src++;
+		}
+
+		i |= ((*src & 0xF0) << 4);
+		length = (*src++ & 0x0F) + THRESHOLD + 1;
+		flags >>= 1;
+
+		if (length > (unsigned int)(dstend - dst))
+		{
+			return -1;
+		}
+
+		// Ring slot to distance (1-4096). The ring version stores output byte n in
+		// slot (R + n) & N_MIN_1.
+		distance = ((((dst - dststart) + R) - i - 1) & N_MIN_1) + 1;
+		from = dst - distance;
+
+		if (from < dststart)
+		{
+			while (length--)
+			{
+				*dst++ = (from >= dststart) ? *from : ' ';
+				from++;
+			}
+		}
+		else if ((distance >= 8) && ((dstend - dst) >= (F + 6)))
+		{
+			// Up to three eight byte copies (F + 6 bytes).
+			matchend = dst + length;
+
+			do
+			{
+				*(u_int32_t *)dst = *(u_int32_t *)from;
+				*(u_int32_t *)(dst + 4) = *(u_int32_t *)(from + 4);
+				dst += 8;
+				from += 8;
+			} while (dst < matchend);
+
+			dst = matchend;
+		}
+		else
+		{
+			// Overlapping (repeats the last distance bytes).
+			while (length--)
+			{
+				*dst++ = *from++;
+			}
+		}
+	}
+
+	stream->dst		= dst;
+	stream->flags	= flags;
+
+	return dst - dststart;
+}
+
+
+//==============================================================================
+// Decodes a complete stream. Returns the number of bytes stored at dst, or -1
+// when the output doesn't fit in dstlen.
+
+int decompressLZSS(u_int8_t * dst, u_int32_t dstlen, u_int8_t * src, u_int32_t srclen)
+{
+	LZSSStream stream;
+
+	initLZSSStream(&stream, dst, dstlen);
+
+	return decompressLZSSChunk(&stream, src, srclen);
+}
+
+
+#if DEBUG_DRIVERS
+//==============================================================================
+// The ring buffer decoder (reference for decompressLZSS, see decodeKernel).
 // Refactoring and bug fix Copyright (c) 2010 by DHP.
 
-int decompressLZSS(u_int8_t * dst, u_int8_t * src, u_int32_t srclen)
+int decompressLZSSRing(u_int8_t * dst, u_int8_t * src, u_int32_t srclen)
 {
 	// Four KB ring buffer with 17 extra bytes added to aid string comparisons.
 	u_int8_t text_buf[N_MIN_1 + F];
@@ -105,3 +299,4 @@ int decompressLZSS(u_int8_t * dst, u_int8_t * src, u_int32_t srclen)
     
 	return dst - dststart;
 }
+#endif
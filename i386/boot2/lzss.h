@@ -0,0 +1,29 @@
+/*
+ * LZSS decoder (lzss.c), used by decodeKernel and loadCompressedKernel in drivers.c
+ * and built on the host by boot2/tools/lzsstest.c – keep it free of booter types.
+ */
+
+#ifndef __BOOT2_LZSS_H
+#define __BOOT2_LZSS_H
+
+#include <sys/types.h>
+
+
+typedef struct LZSSStream
+{
+	u_int8_t	*dststart;
+	u_int8_t	*dst;				// Output position (also the ring position).
+	u_int8_t	*dstend;
+	u_int32_t	flags;				// Remaining flags, above them a stop bit.
+	int			pending;			// First byte of a back-reference split over two chunks (or -1).
+} LZSSStream;
+
+extern void initLZSSStream(LZSSStream *stream, u_int8_t *dst, u_int32_t dstlen);
+extern int decompressLZSSChunk(LZSSStream *stream, u_int8_t *src, u_int32_t srclen);
+extern int decompressLZSS(u_int8_t *dst, u_int32_t dstlen, u_int8_t *src, u_int32_t srclen);
+
+#if DEBUG_DRIVERS
+extern int decompressLZSSRing(u_int8_t *dst, u_int8_t *src, u_int32_t srclen);
+#endif
+
+#endif /* !__BOOT2_LZSS_H */
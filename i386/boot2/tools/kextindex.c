@@ -0,0 +1,487 @@
+/***
+  *
+  * Name        : kextindex
+  * Version     : 1.1.0
+  * Type        : Command line tool
+  * Description : Writes the kext index (see boot2/kextindex.h) that RevoBoot reads, when
+  *               KEXT_INDEX_SUPPORT is set, instead of walking /System/Library/Extensions
+  *               and parsing every Info.plist (only used when there is no kernelcache).
+  *
+  *               Run it again after installing or removing kexts. The index is ignored
+  *               once /System/Library/Extensions has changed (its modification time).
+  *
+  * Usage       : sudo kextindex            (indexes the boot volume)
+  *               sudo kextindex <volume>   (indexes <volume>, like /Volumes/Macintosh HD)
+  *
+  * Compile with: cc -I .. kextindex.c -o kextindex -Wall -framework CoreFoundation
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "kextindex.h"
+
+#define EXTENSIONS_PATH		"/System/Library/Extensions"
+#define KERNEL_CACHE_PATH	"/System/Library/Caches/com.apple.kext.caches/Startup"
+
+static KextIndexEntry * entries;
+static uint32_t entryCount, entryCapacity;
+
+static char * strings;					// Strings and plists (offset 0 is a dummy, 0 means 'none').
+static uint32_t stringsLength, stringsCapacity;
+
+
+//==============================================================================
+
+static uint32_t addData(const void * data, size_t length)
+{
+	uint32_t offset = stringsLength;
+
+	while ((stringsLength + length) > stringsCapacity)
+	{
+		stringsCapacity = stringsCapacity ? (stringsCapacity * 2) : 0x100000;
+
+		if ((strings = realloc(strings, stringsCapacity)) == NULL)
+		{
+			fprintf(stderr, "Error: out of memory\n");
+			exit(1);
+		}
+	}
+
+	memcpy(strings + stringsLength, data, length);
+	stringsLength += length;
+
+	return offset;
+}
+
+
+//==============================================================================
+
+static uint32_t addString(const char * string)
+{
+	return addData(string, strlen(string) + 1);
+}
+
+
+//==============================================================================
+// Returns a copy of a string property (or NULL).
+
+static char * copyStringProperty(CFDictionaryRef dict, CFStringRef key)
+{
+	char buffer[1024];
+	CFStringRef value = CFDictionaryGetValue(dict, key);
+
+	if (value && (CFGetTypeID(value) == CFStringGetTypeID()) && CFStringGetCString(value, buffer, sizeof(buffer), kCFStringEncodingUTF8))
+	{
+		return strdup(buffer);
+	}
+
+	return NULL;
+}
+
+
+//==============================================================================
+// Mirrors getPCIMatches() in drivers.c: adds the PCI match strings of a kext whose
+// personalities all match on IOPCIDevice properties. Returns their offset, or 0.
+
+static uint32_t addPCIMatches(CFDictionaryRef plist)
+{
+	static const struct { char kind; CFStringRef name; } matchProperties[] =
+	{
+		{ KEXT_PCI_MATCH,			CFSTR("IOPCIMatch")				},
+		{ KEXT_PCI_PRIMARY_MATCH,	CFSTR("IOPCIPrimaryMatch")		},
+		{ KEXT_PCI_SECONDARY_MATCH,	CFSTR("IOPCISecondaryMatch")	},
+		{ KEXT_PCI_CLASS_MATCH,		CFSTR("IOPCIClassMatch")		}
+	};
+
+	char match[1024];
+	CFIndex i, j, count, found;
+	uint32_t offset = 0;
+	int pass;
+
+	CFDictionaryRef personalities = CFDictionaryGetValue(plist, CFSTR("IOKitPersonalities"));
+
+	if ((personalities == NULL) || (CFGetTypeID(personalities) != CFDictionaryGetTypeID()) || ((count = CFDictionaryGetCount(personalities)) == 0))
+	{
+		return 0;
+	}
+
+	const void ** values = malloc(count * sizeof(void *));
+
+	CFDictionaryGetKeysAndValues(personalities, NULL, values);
+
+	// First pass checks the personalities, second pass adds the strings.
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 0; i < count; i++)
+		{
+			CFDictionaryRef personality = values[i];
+
+			if (CFGetTypeID(personality) != CFDictionaryGetTypeID())
+			{
+				free(values);
+				return 0;
+			}
+
+			CFStringRef provider = CFDictionaryGetValue(personality, CFSTR("IOProviderClass"));
+
+			if ((provider == NULL) || (CFGetTypeID(provider) != CFStringGetTypeID()) || (CFStringCompare(provider, CFSTR("IOPCIDevice"), 0) != kCFCompareEqualTo))
+			{
+				free(values);
+				return 0;
+			}
+
+			for (j = 0, found = 0; j < (CFIndex)(sizeof(matchProperties) / sizeof(matchProperties[0])); j++)
+			{
+				CFStringRef value = CFDictionaryGetValue(personality, matchProperties[j].name);
+
+				if (value && (CFGetTypeID(value) == CFStringGetTypeID()) && CFStringGetCString(value, match + 1, sizeof(match) - 1, kCFStringEncodingUTF8))
+				{
+					if (pass)
+					{
+						match[0] = matchProperties[j].kind;
+
+						uint32_t matchOffset = addString(match);
+
+						if (offset == 0)
+						{
+							offset = matchOffset;
+						}
+					}
+
+					found++;
+				}
+			}
+
+			// Matches on something else (like IONameMatch).
+			if (found == 0)
+			{
+				free(values);
+				return 0;
+			}
+		}
+	}
+
+	addString("");
+	free(values);
+
+	return offset;
+}
+
+
+//==============================================================================
+// Mirrors loadPlist() in drivers.c: only kexts with an XML Info.plist and an
+// OSBundleRequired property are indexed.
+
+static void addKext(const char * hostPath, const char * bootPath, int isBundleType2)
+{
+	char path[PATH_MAX], bundleID[1024];
+	char * data, * required, * identifier, * executable;
+	struct stat st;
+	FILE * fp;
+
+	snprintf(path, sizeof(path), "%s/%sInfo.plist", hostPath, isBundleType2 ? "Contents/" : "");
+
+	if ((stat(path, &st) != 0) || ((fp = fopen(path, "rb")) == NULL))
+	{
+		return;
+	}
+
+	data = calloc(1, st.st_size + 1);
+
+	if ((data == NULL) || (fread(data, 1, st.st_size, fp) != (size_t)st.st_size))
+	{
+		fclose(fp);
+		free(data);
+		return;
+	}
+
+	fclose(fp);
+
+	// The booter only parses XML (and copies the plist up to the first NUL).
+	if (strncmp(data, "bplist", 6) == 0)
+	{
+		fprintf(stderr, "Warning: skipped %s (binary plist)\n", path);
+		free(data);
+		return;
+	}
+
+	CFDataRef xml = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, (const UInt8 *)data, strlen(data), kCFAllocatorNull);
+	CFPropertyListRef plist = xml ? CFPropertyListCreateWithData(kCFAllocatorDefault, xml, kCFPropertyListImmutable, NULL, NULL) : NULL;
+
+	if (xml)
+	{
+		CFRelease(xml);
+	}
+
+	if ((plist == NULL) || (CFGetTypeID(plist) != CFDictionaryGetTypeID()))
+	{
+		fprintf(stderr, "Warning: skipped %s (unreadable plist)\n", path);
+
+		if (plist)
+		{
+			CFRelease(plist);
+		}
+
+		free(data);
+		return;
+	}
+
+	required	= copyStringProperty(plist, CFSTR("OSBundleRequired"));
+	identifier	= copyStringProperty(plist, CFSTR("CFBundleIdentifier"));
+	executable	= copyStringProperty(plist, CFSTR("CFBundleExecutable"));
+
+	if (required && identifier)
+	{
+		if (entryCount == entryCapacity)
+		{
+			entryCapacity = entryCapacity ? (entryCapacity * 2) : 256;
+
+			if ((entries = realloc(entries, entryCapacity * sizeof(KextIndexEntry))) == NULL)
+			{
+				fprintf(stderr, "Error: out of memory\n");
+				exit(1);
+			}
+		}
+
+		KextIndexEntry * entry = &entries[entryCount++];
+
+		bzero(entry, sizeof(KextIndexEntry));
+
+		snprintf(path, sizeof(path), "%s/", bootPath);
+		entry->bundlePath = addString(path);
+
+		snprintf(path, sizeof(path), "%s/%s", bootPath, isBundleType2 ? "Contents/MacOS/" : "");
+		entry->executablePath = addString(path);
+
+		entry->identifier	= addString(identifier);
+		entry->required		= addString(required);
+		entry->executable	= executable ? addString(executable) : 0;
+
+		CFDictionaryRef libraries = CFDictionaryGetValue(plist, CFSTR("OSBundleLibraries"));
+
+		if (libraries && (CFGetTypeID(libraries) == CFDictionaryGetTypeID()) && CFDictionaryGetCount(libraries))
+		{
+			CFIndex i, count = CFDictionaryGetCount(libraries);
+			const void ** keys = malloc(count * sizeof(void *));
+
+			CFDictionaryGetKeysAndValues(libraries, keys, NULL);
+
+			for (i = 0; i < count; i++)
+			{
+				if (CFStringGetCString(keys[i], bundleID, sizeof(bundleID), kCFStringEncodingUTF8))
+				{
+					uint32_t offset = addString(bundleID);
+
+					if (entry->libraries == 0)
+					{
+						entry->libraries = offset;
+					}
+				}
+			}
+
+			if (entry->libraries)
+			{
+				addString("");
+			}
+
+			free(keys);
+		}
+
+		entry->pciMatches = addPCIMatches(plist);
+		entry->plistLength = strlen(data) + 1;
+		entry->plistOffset = addData(data, entry->plistLength);
+	}
+
+	free(required);
+	free(identifier);
+	free(executable);
+	CFRelease(plist);
+	free(data);
+}
+
+
+//==============================================================================
+
+static int compareNames(const void * a, const void * b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+//==============================================================================
+// Mirrors loadKexts() in drivers.c (the PlugIns folders are one level deep).
+
+static void addKexts(const char * hostFolder, const char * bootFolder, int isPluginRun)
+{
+	char hostPath[PATH_MAX], bootPath[PATH_MAX], path[PATH_MAX];
+	char ** names = NULL;
+	size_t count = 0, i, length;
+	struct dirent * dirEntry;
+	struct stat st;
+	DIR * dir = opendir(hostFolder);
+
+	if (dir == NULL)
+	{
+		return;
+	}
+
+	while ((dirEntry = readdir(dir)) != NULL)
+	{
+		length = strlen(dirEntry->d_name);
+
+		if ((length > 5) && (strcmp(dirEntry->d_name + length - 5, ".kext") == 0))
+		{
+			names = realloc(names, (count + 1) * sizeof(char *));
+			names[count++] = strdup(dirEntry->d_name);
+		}
+	}
+
+	closedir(dir);
+
+	if (count)
+	{
+		qsort(names, count, sizeof(char *), compareNames);
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		snprintf(hostPath, sizeof(hostPath), "%s/%s", hostFolder, names[i]);
+		snprintf(bootPath, sizeof(bootPath), "%s/%s", bootFolder, names[i]);
+
+		if ((stat(hostPath, &st) == 0) && S_ISDIR(st.st_mode))
+		{
+			snprintf(path, sizeof(path), "%s/Contents", hostPath);
+
+			int isBundleType2 = (stat(path, &st) == 0);
+
+			addKext(hostPath, bootPath, isBundleType2);
+
+			if (!isPluginRun)
+			{
+				snprintf(hostPath + strlen(hostPath), sizeof(hostPath) - strlen(hostPath), "/%sPlugIns", isBundleType2 ? "Contents/" : "");
+				snprintf(bootPath + strlen(bootPath), sizeof(bootPath) - strlen(bootPath), "/%sPlugIns", isBundleType2 ? "Contents/" : "");
+
+				addKexts(hostPath, bootPath, 1);
+			}
+		}
+
+		free(names[i]);
+	}
+
+	free(names);
+}
+
+
+//==============================================================================
+// Same as localAdler32() in drivers.c
+
+static uint32_t adler32(const unsigned char * buffer, size_t length)
+{
+	uint32_t lowHalf = 1, highHalf = 0;
+	size_t cnt;
+
+	for (cnt = 0; cnt < length; cnt++)
+	{
+		if ((cnt % 5000) == 0)
+		{
+			lowHalf  %= 65521L;
+			highHalf %= 65521L;
+		}
+
+		lowHalf  += buffer[cnt];
+		highHalf += lowHalf;
+	}
+
+	lowHalf  %= 65521L;
+	highHalf %= 65521L;
+
+	return (highHalf << 16) | lowHalf;
+}
+
+
+//==============================================================================
+
+int main(int argc, char * argv[])
+{
+	const char * volume = (argc > 1) ? argv[1] : "";
+	char extensionsPath[PATH_MAX], indexPath[PATH_MAX];
+	struct stat st;
+	uint32_t i, base;
+
+	snprintf(extensionsPath, sizeof(extensionsPath), "%s%s", volume, EXTENSIONS_PATH);
+	snprintf(indexPath, sizeof(indexPath), "%s%s/%s", volume, KERNEL_CACHE_PATH, KEXT_INDEX_FILE);
+
+	if (stat(extensionsPath, &st) != 0)
+	{
+		fprintf(stderr, "Error: %s not found\n", extensionsPath);
+		return 1;
+	}
+
+	addData("", 1);	// Offset 0 means 'none'.
+	addKexts(extensionsPath, EXTENSIONS_PATH, 0);
+
+	// Make the string offsets relative to the start of the file.
+	base = sizeof(KextIndexHeader) + (entryCount * sizeof(KextIndexEntry));
+
+	for (i = 0; i < entryCount; i++)
+	{
+		entries[i].bundlePath		+= base;
+		entries[i].executablePath	+= base;
+		entries[i].identifier		+= base;
+		entries[i].required			+= base;
+		entries[i].plistOffset		+= base;
+
+		if (entries[i].executable)
+		{
+			entries[i].executable	+= base;
+		}
+
+		if (entries[i].libraries)
+		{
+			entries[i].libraries	+= base;
+		}
+
+		if (entries[i].pciMatches)
+		{
+			entries[i].pciMatches	+= base;
+		}
+	}
+
+	KextIndexHeader header;
+
+	header.signature		= KEXT_INDEX_SIGNATURE;
+	header.version			= KEXT_INDEX_VERSION;
+	header.length			= base + stringsLength;
+	header.extensionsTime	= (uint32_t)st.st_mtime;
+	header.kextCount		= entryCount;
+
+	// Checksum of everything after the header (as read by the booter).
+	unsigned char * body = malloc(header.length - sizeof(header));
+
+	memcpy(body, entries, entryCount * sizeof(KextIndexEntry));
+	memcpy(body + (entryCount * sizeof(KextIndexEntry)), strings, stringsLength);
+	header.adler32 = adler32(body, header.length - sizeof(header));
+
+	FILE * fp = fopen(indexPath, "wb");
+
+	if ((fp == NULL) || (fwrite(&header, sizeof(header), 1, fp) != 1) || (fwrite(body, header.length - sizeof(header), 1, fp) != 1))
+	{
+		fprintf(stderr, "Error: cannot write %s\n", indexPath);
+		return 1;
+	}
+
+	fclose(fp);
+	free(body);
+
+	printf("%s: %u kexts, %u bytes\n", indexPath, entryCount, header.length);
+
+	return 0;
+}
@@ -0,0 +1,525 @@
+/***
+  *
+  * Name        : lzsstest
+  * Version     : 1.0.0
+  * Type        : Command line tool
+  * Description : Checks that decompressLZSS and decompressLZSSChunk (boot2/lzss.c, built
+  *               as is) produce the same output as the 4 KB ring buffer decoder they
+  *               replaced (decompressLZSSRing), and reports the decode speed of each.
+  *
+  *               The streams are made by a simple LZSS encoder in here: from built-in
+  *               payloads (text, code like data, runs, random bytes) or from a file.
+  *               A compressed kernelcache ('comp' 'lzss' header) is decoded as is.
+  *               Every stream is also fed in chunks of 1 to 17 bytes and other sizes
+  *               (so that back-references and flag bytes get split), decoded into an
+  *               output buffer of exactly the right size (guard bytes behind it must
+  *               stay untouched), and into one that is too small (must return -1).
+  *
+  * Usage       : lzsstest              (built-in payloads)
+  *               lzsstest <file>...    (payload or compressed kernelcache files)
+  *
+  * Compile with: cc -O2 -I .. -I ../../libsaio lzsstest.c -o lzsstest -Wall
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// lzss.c is included below with its booter headers left out (lzss.h has all it needs).
+#define __LIBSAIO_SL_H
+#define __BOOT2_BOOT_H
+#define DEBUG_DRIVERS	1
+
+#include "lzss.h"
+#include "lzss.c"
+
+#define GUARD_SIZE		64
+#define GUARD_BYTE		0xA5
+#define HASH_SIZE		(1 << 16)
+#define MAX_CHAIN		64
+#define BENCH_MIN_SIZE	(1 << 20)	// Smaller payloads are only checked.
+#define BENCH_SECONDS	1.0			// Per decoder and payload.
+
+static int failures;
+
+
+//==============================================================================
+// Greedy LZSS encoder (hash chains on three bytes). Writes ring slot numbers the
+// way the ring decoder expects them, including matches that reach back into the
+// spaces that the ring starts with. Returns the compressed size.
+
+static u_int32_t compressLZSS(u_int8_t * dst, const u_int8_t * src, u_int32_t srclen)
+{
+	static int32_t head[HASH_SIZE];
+	int32_t * prev = malloc(srclen * sizeof(int32_t));
+
+	u_int8_t * flags = NULL;
+	u_int8_t * out = dst;
+	u_int32_t pos = 0, bit = 8, hash;
+	int32_t candidate, chain;
+	unsigned int length, bestLength, bestDistance, distance, k;
+
+	if (prev == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+
+	memset(head, 0xFF, sizeof(head));
+
+	while (pos < srclen)
+	{
+		if (bit == 8)
+		{
+			flags = out++;
+			*flags = 0;
+			bit = 0;
+		}
+
+		bestLength = 0;
+		bestDistance = 0;
+
+		// Leading spaces can come from the initial ring contents (R spaces).
+		if (pos < N)
+		{
+			for (length = 0; (length < F) && ((pos + length) < srclen) && (src[pos + length] == ' '); length++);
+
+			if (length > THRESHOLD)
+			{
+				bestLength = length;
+				bestDistance = pos + 1 + (length & 7);	// Vary how far back it reaches.
+			}
+		}
+
+		if ((pos + 2) < srclen)
+		{
+			hash = ((src[pos] << 8) ^ (src[pos + 1] << 4) ^ src[pos + 2]) & (HASH_SIZE - 1);
+
+			for (candidate = head[hash], chain = 0; (candidate >= 0) && (chain < MAX_CHAIN); candidate = prev[candidate], chain++)
+			{
+				distance = pos - candidate;
+
+				if (distance > N)
+				{
+					break;
+				}
+
+				for (length = 0; (length < F) && ((pos + length) < srclen) && (src[candidate + length] == src[pos + length]); length++);
+
+				if (length > bestLength)
+				{
+					bestLength = length;
+					bestDistance = distance;
+
+					if (length == F)
+					{
+						break;
+					}
+				}
+			}
+		}
+
+		if (bestLength <= THRESHOLD)
+		{
+			bestLength = 1;
+			*flags |= (1 << bit);
+			*out++ = src[pos];
+		}
+		else
+		{
+			// Distance back to the ring slot of the first byte of the match.
+			k = (pos + R - bestDistance) & N_MIN_1;
+			*out++ = (k & 0xFF);
+			*out++ = (((k >> 4) & 0xF0) | (bestLength - THRESHOLD - 1));
+		}
+
+		bit++;
+
+		for (k = 0; k < bestLength; k++, pos++)
+		{
+			if ((pos + 2) < srclen)
+			{
+				hash = ((src[pos] << 8) ^ (src[pos + 1] << 4) ^ src[pos + 2]) & (HASH_SIZE - 1);
+				prev[pos] = head[hash];
+				head[hash] = pos;
+			}
+		}
+	}
+
+	free(prev);
+
+	return out - dst;
+}
+
+
+//==============================================================================
+
+static void check(int ok, const char * name, const char * what, u_int32_t value)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s: %s (%u)\n", name, what, value);
+		failures++;
+	}
+}
+
+
+//==============================================================================
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+//==============================================================================
+// Returns the number of bytes that the complete items of a (truncated) stream
+// decode to.
+
+static int completeItemsSize(const u_int8_t * src, u_int32_t srclen)
+{
+	const u_int8_t * srcend = src + srclen;
+	unsigned int flags = 1;
+	int size = 0;
+
+	while (1)
+	{
+		if (flags == 1)
+		{
+			if (src >= srcend)
+			{
+				break;
+			}
+
+			flags = *src++ | 0x100;
+		}
+
+		if (flags & 1)
+		{
+			if (src >= srcend)
+			{
+				break;
+			}
+
+			src++;
+			size++;
+		}
+		else
+		{
+			if ((src + 2) > srcend)
+			{
+				break;
+			}
+
+			size += (src[1] & 0x0F) + THRESHOLD + 1;
+			src += 2;
+		}
+
+		flags >>= 1;
+	}
+
+	return size;
+}
+
+
+//==============================================================================
+// Decodes src in chunks (of chunkSize bytes, or of random sizes below 64 KB when
+// chunkSize is 0) into a buffer of exactly size bytes.
+
+static int decodeInChunks(u_int8_t * dst, u_int32_t size, u_int8_t * src, u_int32_t srclen, u_int32_t chunkSize)
+{
+	LZSSStream stream;
+	u_int32_t offset, length;
+	int result = 0;
+
+	initLZSSStream(&stream, dst, size);
+
+	for (offset = 0; offset < srclen; offset += length)
+	{
+		length = chunkSize ? chunkSize : (1 + (rand() % 0x10000));
+
+		if (length > (srclen - offset))
+		{
+			length = srclen - offset;
+		}
+
+		if ((result = decompressLZSSChunk(&stream, src + offset, length)) < 0)
+		{
+			break;
+		}
+	}
+
+	return result;
+}
+
+
+//==============================================================================
+
+static void testStream(const char * name, u_int8_t * src, u_int32_t srclen)
+{
+	static const u_int32_t chunkSizes[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17,
+											31, 255, 4096, 4097, 65536, 256 * 1024, 0 };
+
+	// The ring decoder has no output limit, but writes at most F bytes per input bit.
+	u_int32_t maxSize = (srclen * 8 * F) + 16;
+	u_int8_t * reference = malloc(maxSize);
+	u_int8_t * output;
+	int size, result;
+	unsigned int i, pass;
+	double start, seconds[3] = { 0, 0, 0 };
+	u_int64_t decoded[3] = { 0, 0, 0 };
+
+	if (reference == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+
+	size = decompressLZSSRing(reference, src, srclen);
+	output = malloc(size + GUARD_SIZE);
+
+	// Whole stream, exact output size.
+	memset(output, GUARD_BYTE, size + GUARD_SIZE);
+	result = decompressLZSS(output, size, src, srclen);
+	check(result == size, name, "decompressLZSS size", result);
+	check(memcmp(output, reference, size) == 0, name, "decompressLZSS output differs", size);
+
+	for (i = 0; i < GUARD_SIZE; i++)
+	{
+		check(output[size + i] == GUARD_BYTE, name, "decompressLZSS wrote past dstlen", i);
+	}
+
+	// Output buffer too small.
+	if (size > 0)
+	{
+		check(decompressLZSS(output, size - 1, src, srclen) == -1, name, "decompressLZSS with dstlen - 1", size - 1);
+	}
+
+	// Chunked.
+	for (i = 0; i < (sizeof(chunkSizes) / sizeof(chunkSizes[0])); i++)
+	{
+		memset(output, GUARD_BYTE, size + GUARD_SIZE);
+		result = decodeInChunks(output, size, src, srclen, chunkSizes[i]);
+		check(result == size, name, "decompressLZSSChunk size", chunkSizes[i]);
+		check(memcmp(output, reference, size) == 0, name, "decompressLZSSChunk output differs, chunk size", chunkSizes[i]);
+		check(output[size] == GUARD_BYTE, name, "decompressLZSSChunk wrote past dstlen, chunk size", chunkSizes[i]);
+	}
+
+	// Truncated streams: the output of the complete items, and nothing else (the ring
+	// decoder isn't a reference here, it takes a lone back-reference byte for a literal).
+	for (i = 1; (i <= 64) && (i < srclen); i++)
+	{
+		u_int32_t length = (i <= 32) ? (srclen - i) : (rand() % srclen);
+		int expected = completeItemsSize(src, length);
+
+		memset(output, GUARD_BYTE, size + GUARD_SIZE);
+		result = decodeInChunks(output, size, src, length, 1 + (i % 7));
+		check((result == expected) && (memcmp(output, reference, expected) == 0), name, "truncated stream, length", length);
+	}
+
+	if (size < BENCH_MIN_SIZE)
+	{
+		free(output);
+		free(reference);
+		return;
+	}
+
+	// Speed (decompressLZSSRing, decompressLZSS, and in loadCompressedKernel chunks).
+	for (pass = 0; pass < 3; pass++)
+	{
+		do
+		{
+			start = now();
+
+			if (pass == 0)
+			{
+				decompressLZSSRing(reference, src, srclen);
+			}
+			else if (pass == 1)
+			{
+				decompressLZSS(output, size, src, srclen);
+			}
+			else
+			{
+				decodeInChunks(output, size, src, srclen, 256 * 1024);
+			}
+
+			seconds[pass] += now() - start;
+			decoded[pass] += size;
+		} while (seconds[pass] < BENCH_SECONDS);
+	}
+
+	printf("%-14s %9u -> %9u bytes  ring %7.1f MB/s  decompressLZSS %7.1f MB/s  chunked %7.1f MB/s\n", name, srclen, size,
+		   (decoded[0] / seconds[0]) / 1e6, (decoded[1] / seconds[1]) / 1e6, (decoded[2] / seconds[2]) / 1e6);
+
+	free(output);
+	free(reference);
+}
+
+
+//==============================================================================
+
+static void testPayload(const char * name, const u_int8_t * data, u_int32_t length)
+{
+	u_int8_t * compressed = malloc(length + (length / 8) + 16);
+
+	if (compressed == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+
+	testStream(name, compressed, compressLZSS(compressed, data, length));
+	free(compressed);
+}
+
+
+//==============================================================================
+// Built-in payloads: each one exercises a different decoder path.
+
+static void testBuiltInPayloads(void)
+{
+	static const char * words[] = { "kernel ", "extension ", "IOPCIDevice ", "com.apple.", "driver ", "\n", "    ",
+									"IOService", "OSBundleLibraries ", "<key>", "</key>", "<string>", "</string>" };
+	u_int32_t length = 2 << 20, i, j;
+	u_int8_t * data = malloc(length);
+
+	// Text (lots of short and long matches, leading spaces from the ring).
+	for (i = 0; i < length; )
+	{
+		const char * word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+
+		for (j = 0; (word[j] != '\0') && (i < length); j++)
+		{
+			data[i++] = word[j];
+		}
+	}
+
+	memset(data, ' ', 40);
+	testPayload("text", data, length);
+
+	// Code like data (x86 instruction soup: mostly short matches and literals).
+	for (i = 0; i < length; i++)
+	{
+		data[i] = ((rand() % 4) == 0) ? (rand() & 0xFF) : "\x55\x48\x89\xE5\x8B\x45\xFC\x0F\x1F\x00\xE8\xC3\x90\x00\x00\x00"[rand() % 16];
+	}
+
+	testPayload("code", data, length);
+
+	// Runs (overlapping matches with distances 1 to 7).
+	for (i = 0; i < length; )
+	{
+		u_int32_t period = 1 + (rand() % 7), run = 8 + (rand() % 200);
+
+		for (j = 0; (j < run) && (i < length); j++, i++)
+		{
+			data[i] = (j < period) ? (rand() & 0xFF) : data[i - period];
+		}
+	}
+
+	testPayload("runs", data, length);
+
+	// Random bytes (literals only).
+	for (i = 0; i < length; i++)
+	{
+		data[i] = rand() & 0xFF;
+	}
+
+	testPayload("random", data, length);
+
+	// Small payloads (matches into the initial spaces, output shorter than a copy).
+	for (i = 0; i < 64; i++)
+	{
+		for (j = 0; j < i; j++)
+		{
+			data[j] = (j < (i / 2)) ? ' ' : "ab"[rand() % 2];
+		}
+
+		testPayload("small", data, i);
+	}
+
+	free(data);
+}
+
+
+//==============================================================================
+
+static void testFile(const char * path)
+{
+	FILE * fp = fopen(path, "rb");
+	u_int8_t * data;
+	long length;
+
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error: can't open %s\n", path);
+		failures++;
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (((data = malloc(length + 1)) == NULL) || (fread(data, 1, length, fp) != (size_t)length))
+	{
+		fprintf(stderr, "Error: can't read %s\n", path);
+		failures++;
+		fclose(fp);
+		return;
+	}
+
+	fclose(fp);
+
+	// Compressed kernelcache (see compressed_kernel_header in boot.h): 'comp', 'lzss', adler32,
+	// sizes (big endian), reserved words, platform name and root path (384 bytes).
+	if ((length > 384) && (memcmp(data, "comp", 4) == 0) && (memcmp(data + 4, "lzss", 4) == 0))
+	{
+		u_int32_t compressedSize = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+
+		if (compressedSize > (u_int32_t)(length - 384))
+		{
+			compressedSize = length - 384;
+		}
+
+		testStream(path, data + 384, compressedSize);
+	}
+	else
+	{
+		testPayload(path, data, length);
+	}
+
+	free(data);
+}
+
+
+//==============================================================================
+
+int main(int argc, char * argv[])
+{
+	int i;
+
+	srand(1);
+
+	if (argc > 1)
+	{
+		for (i = 1; i < argc; i++)
+		{
+			testFile(argv[i]);
+		}
+	}
+	else
+	{
+		testBuiltInPayloads();
+	}
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed.");
+
+	return failures ? 1 : 0;
+}
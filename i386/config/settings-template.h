@@ -255,12 +255,33 @@
 
 #define APPLE_RAID_SUPPORT				0	// Set to 0 by default. Change this to 1 for Apple Software RAID support.
 
+#define AHCI_SUPPORT					0	// Set to 0 by default. Change this to 1 to read SATA drives (in AHCI mode) without
+											// using the BIOS. Drives that cannot be matched will still be read with INT13.
+
+#define NVME_SUPPORT					0	// Set to 0 by default. Change this to 1 to read NVMe drives without using the BIOS. Note: NVMe
+											// controllers are reset, making INT13 unusable for drives that cannot be matched.
+
+#define HFS_COMPRESSION_SUPPORT			1	// Set to 1 by default. Change this to 0 when you don't need to read HFS+ compressed
+											// (decmpfs) files. Note: zlib and LZVN only (LZFSE is not supported).
+
+#define IO_TRACE_SUPPORT				0	// Set to 0 by default. Change this to 1 to record all disk reads (with TSC timestamps)
+											// and publish them as 'boot-io-trace' under /efi/platform (see libsaio/tools/iotrace.c).
+
 #define DEBUG_DISK						0	// Set to 0 by default. Change it to 1 when things don't seem to work for you.
 
+#define CACHE_STATS						0	// Set to 0 by default. Change this to 1 to print (per volume) hit rates of the file system
+											// meta-data cache (cache.c) and the B-tree node cache (hfs.c) before the kernel is started.
+
 
 //------------------------------------------------------------- DRIVERS.C -------------------------------------------------------------------
 
 
+#define KEXT_INDEX_SUPPORT				0	// Set to 0 by default. Change this to 1 to load kexts (without a kernelcache) from the kext index
+											// generated by boot2/tools/kextindex.c, instead of walking /System/Library/Extensions.
+
+#define KEXT_PCI_PRUNING				0	// Set to 0 by default. Change this to 1 to skip (without a kernelcache) kexts that only match
+											// PCI devices (IOPCIMatch and friends) which aren't in this box. Use -v to see what was skipped.
+
 #define DEBUG_DRIVERS					0	// Set to 0 by default. Change it to 1 when things don't seem to work for you.
 
 
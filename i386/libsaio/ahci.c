@@ -0,0 +1,571 @@
+/*
+ * Native AHCI read support. Drives attached to an AHCI controller are read with
+ * polled READ DMA EXT commands that transfer straight into the target buffer,
+ * without the real mode switch and the bounce through BIOS_ADDR that INT13 needs.
+ *
+ * The BIOS (option ROM) keeps ownership of the controller. Ports are borrowed
+ * for the duration of each read request, and their command list and received
+ * FIS areas are restored afterwards, so that INT13 keeps working for drives not
+ * claimed by this driver.
+ *
+ * Drives are matched to BIOS device numbers by comparing the first two sectors
+ * (MBR and GPT header) read by INT13 with the ones read from each port.
+ */
+
+#include "libsaio.h"
+#include "platform.h"
+#include "pci.h"
+#include "cpu/proc_reg.h"
+
+
+#if AHCI_SUPPORT
+
+#define AHCI_CLASS_CODE			0x010601	// Mass storage, Serial ATA, AHCI 1.0
+
+#define AHCI_MAX_PORTS			32
+
+// HBA registers.
+#define AHCI_GHC				0x04
+#define AHCI_PI					0x0C
+
+#define AHCI_GHC_AE				0x80000000
+
+// Port registers (at ABAR + 0x100 + (port * 0x80)).
+#define AHCI_PxCLB				0x00
+#define AHCI_PxCLBU				0x04
+#define AHCI_PxFB				0x08
+#define AHCI_PxFBU				0x0C
+#define AHCI_PxIS				0x10
+#define AHCI_PxCMD				0x18
+#define AHCI_PxTFD				0x20
+#define AHCI_PxSIG				0x24
+#define AHCI_PxSSTS				0x28
+#define AHCI_PxSERR				0x30
+#define AHCI_PxCI				0x38
+
+#define AHCI_PxCMD_ST			0x00000001
+#define AHCI_PxCMD_FRE			0x00000010
+#define AHCI_PxCMD_FR			0x00004000
+#define AHCI_PxCMD_CR			0x00008000
+
+#define AHCI_PxIS_TFES			0x40000000
+
+#define AHCI_PxTFD_ERR			0x01
+#define AHCI_PxTFD_DRQ			0x08
+#define AHCI_PxTFD_BSY			0x80
+
+#define AHCI_SIG_ATA			0x00000101
+
+#define ATA_CMD_READ_DMA_EXT	0x25
+#define ATA_CMD_IDENTIFY		0xEC
+
+#define FIS_TYPE_REG_H2D		0x27
+
+#define AHCI_COMMAND_LIST_SIZE	0x400		// 32 command headers (1 KB aligned).
+#define AHCI_RECEIVED_FIS_SIZE	0x100		// 256 byte aligned.
+#define AHCI_COMMAND_TABLE_SIZE	0x90		// Command FIS, ATAPI command and one PRD (128 byte aligned).
+
+#define AHCI_MAX_SECTORS		8192		// 4 MB, the limit of a single PRD entry.
+#define AHCI_BOUNCE_SECTORS		64			// Used for buffers on odd addresses (PRDs need word alignment).
+
+#define AHCI_TIMEOUT_MS			5000
+
+
+typedef struct
+{
+	volatile uint8_t *	regs;
+	int					biosdev;			// -1 until claimed by ahciProbe().
+	bool				unusable;			// Set when reading the signature failed.
+
+	uint32_t *			commandList;
+	uint8_t *			receivedFIS;
+	uint8_t *			commandTable;
+	char *				bounce;
+	char *				signature;			// First two sectors, read on first probe.
+
+	uint32_t			savedCMD;			// BIOS state, restored by ahciReleasePort().
+	uint32_t			savedCLB, savedCLBU;
+	uint32_t			savedFB, savedFBU;
+} AHCIPort;
+
+
+static AHCIPort gAHCIPorts[AHCI_MAX_PORTS];
+static int gAHCIPortCount = 0;
+
+static bool ahciProbe(int biosdev, const void * signature);
+static int  ahciRead(int biosdev, unsigned long long secno, unsigned int count, void * buffer);
+
+static struct DiskBackend gAHCIBackend =
+{
+	.name			= "AHCI",
+	.probe			= ahciProbe,
+	.read			= ahciRead,
+	.next			= NULL
+};
+
+
+//==============================================================================
+
+static inline uint32_t ahciReadReg(AHCIPort * port, uint32_t reg)
+{
+	return *(volatile uint32_t *)(port->regs + reg);
+}
+
+
+//==============================================================================
+
+static inline void ahciWriteReg(AHCIPort * port, uint32_t reg, uint32_t value)
+{
+	*(volatile uint32_t *)(port->regs + reg) = value;
+}
+
+
+//==============================================================================
+// Waits (up to ms milliseconds) for (reg & mask) == value.
+
+static bool ahciWait(AHCIPort * port, uint32_t reg, uint32_t mask, uint32_t value, uint32_t ms)
+{
+	// Assume a fast CPU when the TSC frequency is unknown (longer timeout).
+	uint64_t tscPerMs = (gPlatform.CPU.TSCFrequency ? gPlatform.CPU.TSCFrequency : 4000000000ULL) / 1000;
+	uint64_t deadline = rdtsc64() + (ms * tscPerMs);
+
+	do
+	{
+		if ((ahciReadReg(port, reg) & mask) == value)
+		{
+			return true;
+		}
+	} while (rdtsc64() < deadline);
+
+	return false;
+}
+
+
+//==============================================================================
+
+static void * ahciAlloc(uint32_t size, uint32_t alignment)
+{
+	char * buffer = malloc(size + alignment);
+
+	if (buffer)
+	{
+		buffer = (char *)(((uint32_t)buffer + alignment - 1) & ~(alignment - 1));
+		bzero(buffer, size);
+	}
+
+	return buffer;
+}
+
+
+//==============================================================================
+
+static bool ahciStopPort(AHCIPort * port)
+{
+	uint32_t cmd = ahciReadReg(port, AHCI_PxCMD);
+
+	if (cmd & AHCI_PxCMD_ST)
+	{
+		ahciWriteReg(port, AHCI_PxCMD, (cmd & ~AHCI_PxCMD_ST));
+	}
+
+	if (!ahciWait(port, AHCI_PxCMD, AHCI_PxCMD_CR, 0, 500))
+	{
+		return false;
+	}
+
+	cmd = ahciReadReg(port, AHCI_PxCMD);
+
+	if (cmd & AHCI_PxCMD_FRE)
+	{
+		ahciWriteReg(port, AHCI_PxCMD, (cmd & ~AHCI_PxCMD_FRE));
+	}
+
+	return ahciWait(port, AHCI_PxCMD, AHCI_PxCMD_FR, 0, 500);
+}
+
+
+//==============================================================================
+// Takes over the port from the BIOS by pointing it to our own command list and
+// received FIS area.
+
+static bool ahciAcquirePort(AHCIPort * port)
+{
+	port->savedCMD	= ahciReadReg(port, AHCI_PxCMD);
+	port->savedCLB	= ahciReadReg(port, AHCI_PxCLB);
+	port->savedCLBU	= ahciReadReg(port, AHCI_PxCLBU);
+	port->savedFB	= ahciReadReg(port, AHCI_PxFB);
+	port->savedFBU	= ahciReadReg(port, AHCI_PxFBU);
+
+	if (!ahciStopPort(port))
+	{
+		return false;
+	}
+
+	ahciWriteReg(port, AHCI_PxCLB, (uint32_t)port->commandList);
+	ahciWriteReg(port, AHCI_PxCLBU, 0);
+	ahciWriteReg(port, AHCI_PxFB, (uint32_t)port->receivedFIS);
+	ahciWriteReg(port, AHCI_PxFBU, 0);
+
+	ahciWriteReg(port, AHCI_PxSERR, 0xFFFFFFFF);
+	ahciWriteReg(port, AHCI_PxIS, 0xFFFFFFFF);
+
+	ahciWriteReg(port, AHCI_PxCMD, (ahciReadReg(port, AHCI_PxCMD) | AHCI_PxCMD_FRE));
+
+	if (!ahciWait(port, AHCI_PxTFD, (AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ), 0, 1000))
+	{
+		return false;
+	}
+
+	ahciWriteReg(port, AHCI_PxCMD, (ahciReadReg(port, AHCI_PxCMD) | AHCI_PxCMD_ST));
+
+	return true;
+}
+
+
+//==============================================================================
+// Hands the port back to the BIOS.
+
+static void ahciReleasePort(AHCIPort * port)
+{
+	ahciStopPort(port);
+
+	ahciWriteReg(port, AHCI_PxCLB, port->savedCLB);
+	ahciWriteReg(port, AHCI_PxCLBU, port->savedCLBU);
+	ahciWriteReg(port, AHCI_PxFB, port->savedFB);
+	ahciWriteReg(port, AHCI_PxFBU, port->savedFBU);
+
+	ahciWriteReg(port, AHCI_PxIS, 0xFFFFFFFF);
+
+	if (port->savedCMD & AHCI_PxCMD_FRE)
+	{
+		ahciWriteReg(port, AHCI_PxCMD, (ahciReadReg(port, AHCI_PxCMD) | AHCI_PxCMD_FRE));
+	}
+
+	if (port->savedCMD & AHCI_PxCMD_ST)
+	{
+		ahciWriteReg(port, AHCI_PxCMD, (ahciReadReg(port, AHCI_PxCMD) | AHCI_PxCMD_ST));
+	}
+}
+
+
+//==============================================================================
+// Issues a single (polled) command in slot 0. The port must be acquired.
+
+static int ahciCommand(AHCIPort * port, uint8_t command, uint64_t lba, uint32_t count, void * buffer, uint32_t bytes)
+{
+	uint8_t * fis = port->commandTable;
+	uint32_t * prd = (uint32_t *)(port->commandTable + 0x80);
+
+	bzero(port->commandTable, AHCI_COMMAND_TABLE_SIZE);
+
+	fis[0]	= FIS_TYPE_REG_H2D;
+	fis[1]	= 0x80;							// Command (not control) update.
+	fis[2]	= command;
+	fis[4]	= (lba & 0xFF);
+	fis[5]	= ((lba >> 8) & 0xFF);
+	fis[6]	= ((lba >> 16) & 0xFF);
+	fis[7]	= (command == ATA_CMD_IDENTIFY) ? 0x00 : 0x40;	// LBA mode.
+	fis[8]	= ((lba >> 24) & 0xFF);
+	fis[9]	= ((lba >> 32) & 0xFF);
+	fis[10]	= ((lba >> 40) & 0xFF);
+	fis[12]	= (count & 0xFF);
+	fis[13]	= ((count >> 8) & 0xFF);
+
+	prd[0]	= (uint32_t)buffer;
+	prd[1]	= 0;
+	prd[3]	= (bytes - 1);					// Byte count (0 based).
+
+	port->commandList[0] = (5 | (1 << 16));	// Command FIS length (in DWORDs) and one PRD (device to host).
+	port->commandList[1] = 0;
+	port->commandList[2] = (uint32_t)port->commandTable;
+	port->commandList[3] = 0;
+
+	ahciWriteReg(port, AHCI_PxIS, 0xFFFFFFFF);
+	ahciWriteReg(port, AHCI_PxCI, 1);
+
+	uint64_t tscPerMs = (gPlatform.CPU.TSCFrequency ? gPlatform.CPU.TSCFrequency : 4000000000ULL) / 1000;
+	uint64_t deadline = rdtsc64() + (AHCI_TIMEOUT_MS * tscPerMs);
+
+	while (ahciReadReg(port, AHCI_PxCI) & 1)
+	{
+		if ((ahciReadReg(port, AHCI_PxIS) & AHCI_PxIS_TFES) || (rdtsc64() > deadline))
+		{
+			return -1;
+		}
+	}
+
+	return (ahciReadReg(port, AHCI_PxTFD) & AHCI_PxTFD_ERR) ? -1 : 0;
+}
+
+
+//==============================================================================
+
+static int ahciReadSectors(AHCIPort * port, unsigned long long secno, unsigned int count, char * buffer)
+{
+	int rc = 0;
+	unsigned int nsecs;
+
+	if (!ahciAcquirePort(port))
+	{
+		ahciReleasePort(port);
+
+		return -1;
+	}
+
+	while (count && (rc == 0))
+	{
+		nsecs = (count > AHCI_MAX_SECTORS) ? AHCI_MAX_SECTORS : count;
+
+		if ((uint32_t)buffer & 1)
+		{
+			nsecs = (nsecs > AHCI_BOUNCE_SECTORS) ? AHCI_BOUNCE_SECTORS : nsecs;
+
+			if ((rc = ahciCommand(port, ATA_CMD_READ_DMA_EXT, secno, nsecs, port->bounce, (nsecs * 512))) == 0)
+			{
+				bcopy(port->bounce, buffer, (nsecs * 512));
+			}
+		}
+		else
+		{
+			rc = ahciCommand(port, ATA_CMD_READ_DMA_EXT, secno, nsecs, buffer, (nsecs * 512));
+		}
+
+		secno	+= nsecs;
+		buffer	+= (nsecs * 512);
+		count	-= nsecs;
+	}
+
+	ahciReleasePort(port);
+
+	return rc;
+}
+
+
+//==============================================================================
+// Backend read function (see struct DiskBackend).
+
+static int ahciRead(int biosdev, unsigned long long secno, unsigned int count, void * buffer)
+{
+	int i;
+
+	for (i = 0; i < gAHCIPortCount; i++)
+	{
+		if (gAHCIPorts[i].biosdev == biosdev)
+		{
+			return ahciReadSectors(&gAHCIPorts[i], secno, count, buffer);
+		}
+	}
+
+	return -1;
+}
+
+
+//==============================================================================
+// Backend probe function. Claims biosdev when exactly one of our (unclaimed)
+// ports has the same first two sectors.
+
+static bool ahciProbe(int biosdev, const void * signature)
+{
+	int i;
+	AHCIPort * match = NULL;
+
+	for (i = 0; i < gAHCIPortCount; i++)
+	{
+		AHCIPort * port = &gAHCIPorts[i];
+
+		if ((port->biosdev >= 0) || port->unusable)
+		{
+			continue;
+		}
+
+		if (port->signature == NULL)
+		{
+			port->signature = malloc(DISK_SIGNATURE_SIZE);
+
+			if ((port->signature == NULL) || (ahciReadSectors(port, 0, (DISK_SIGNATURE_SIZE / 512), port->signature) != 0))
+			{
+				port->unusable = true;
+
+				continue;
+			}
+		}
+
+		if (memcmp(port->signature, signature, DISK_SIGNATURE_SIZE) == 0)
+		{
+			if (match)
+			{
+				return false; // Ambiguous (cloned disks). Leave it to INT13.
+			}
+
+			match = port;
+		}
+	}
+
+	if (match)
+	{
+		match->biosdev = biosdev;
+
+		return true;
+	}
+
+	return false;
+}
+
+
+//==============================================================================
+// Ports that fail to initialise leave their buffers in the (unclaimed) slot, so
+// that the next port can reuse them (ahciAlloc'ed memory cannot be freed).
+
+static void ahciInitPort(volatile uint8_t * abar, int portNumber)
+{
+	AHCIPort * port = &gAHCIPorts[gAHCIPortCount];
+	uint16_t * identify;
+
+	uint32_t * commandList	= port->commandList;
+	uint8_t * receivedFIS	= port->receivedFIS;
+	uint8_t * commandTable	= port->commandTable;
+	char * bounce			= port->bounce;
+
+	bzero(port, sizeof(AHCIPort));
+
+	port->regs			= abar + 0x100 + (portNumber * 0x80);
+	port->biosdev		= -1;
+
+	port->commandList	= commandList;
+	port->receivedFIS	= receivedFIS;
+	port->commandTable	= commandTable;
+	port->bounce		= bounce;
+
+	uint32_t ssts = ahciReadReg(port, AHCI_PxSSTS);
+
+	// Device present, PHY communication established and interface active?
+	if (((ssts & 0x0F) != 3) || (((ssts >> 8) & 0x0F) != 1) || (ahciReadReg(port, AHCI_PxSIG) != AHCI_SIG_ATA))
+	{
+		return;
+	}
+
+	if (port->commandList)
+	{
+		bzero(port->commandList, AHCI_COMMAND_LIST_SIZE);
+	}
+	else
+	{
+		port->commandList = ahciAlloc(AHCI_COMMAND_LIST_SIZE, 1024);
+	}
+
+	if (port->receivedFIS)
+	{
+		bzero(port->receivedFIS, AHCI_RECEIVED_FIS_SIZE);
+	}
+	else
+	{
+		port->receivedFIS = ahciAlloc(AHCI_RECEIVED_FIS_SIZE, 256);
+	}
+
+	if (port->commandTable == NULL)
+	{
+		port->commandTable = ahciAlloc(AHCI_COMMAND_TABLE_SIZE, 128);
+	}
+
+	if (port->bounce == NULL)
+	{
+		port->bounce = malloc(AHCI_BOUNCE_SECTORS * 512);	// Note: malloc() returns 16 byte aligned buffers.
+	}
+
+	if (!port->commandList || !port->receivedFIS || !port->commandTable || !port->bounce)
+	{
+		return;
+	}
+
+	int rc = -1;
+	identify = (uint16_t *)port->bounce;
+
+	if (ahciAcquirePort(port))
+	{
+		rc = ahciCommand(port, ATA_CMD_IDENTIFY, 0, 0, identify, 512);
+	}
+
+	ahciReleasePort(port);
+
+	if (rc != 0)
+	{
+		_DISK_DEBUG_DUMP("AHCI port %d: IDENTIFY failed\n", portNumber);
+
+		return;
+	}
+
+	// We only use READ DMA EXT, so 48-bit addressing is a must.
+	if ((identify[83] & 0x0400) == 0)
+	{
+		return;
+	}
+
+	// Logical sectors larger than 512 bytes?
+	if (((identify[106] & 0xC000) == 0x4000) && (identify[106] & 0x1000))
+	{
+		return;
+	}
+
+	_DISK_DEBUG_DUMP("AHCI port %d: %d MB\n", portNumber, (uint32_t)((*(uint64_t *)&identify[100]) >> 11));
+
+	gAHCIPortCount++;
+}
+
+
+//==============================================================================
+// Called from initPartitionChain() in sys.c
+
+void ahciInit(void)
+{
+	int i, portNumber;
+	PCIDevice_t * devices;
+	int deviceCount = pciGetDevices(&devices, NULL);
+
+	for (i = 0; i < deviceCount; i++)
+	{
+		if (devices[i].classCode != AHCI_CLASS_CODE)
+		{
+			continue;
+		}
+
+		uint32_t abar = (pciConfigRead(READ_LONG, devices[i].address, PCI_BAR5) & ~0x0F);
+
+		if (abar == 0)
+		{
+			continue;
+		}
+
+		uint16_t command = pciConfigRead(READ_WORD, devices[i].address, PCI_COMMAND);
+
+		if ((command & (PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER)) != (PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER))
+		{
+			pciConfigWrite16(devices[i].address, PCI_COMMAND, (command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER));
+		}
+
+		volatile uint32_t * ghc = (volatile uint32_t *)(abar + AHCI_GHC);
+
+		if ((*ghc & AHCI_GHC_AE) == 0)
+		{
+			*ghc |= AHCI_GHC_AE;
+		}
+
+		uint32_t portsImplemented = *(volatile uint32_t *)(abar + AHCI_PI);
+
+		_DISK_DEBUG_DUMP("AHCI controller %04x:%04x at 0x%x (ports: 0x%x)\n", devices[i].vendorID, devices[i].deviceID, abar, portsImplemented);
+
+		for (portNumber = 0; (portNumber < AHCI_MAX_PORTS) && (gAHCIPortCount < AHCI_MAX_PORTS); portNumber++)
+		{
+			if (portsImplemented & (1 << portNumber))
+			{
+				ahciInitPort((volatile uint8_t *)abar, portNumber);
+			}
+		}
+	}
+
+	if (gAHCIPortCount)
+	{
+		diskRegisterBackend(&gAHCIBackend);
+	}
+}
+
+#endif // AHCI_SUPPORT
@@ -94,3 +94,17 @@ long AllocateKernelMemory(long inSize)
 
 	return address;
 }
+
+
+//==============================================================================
+// Gives back the memory of the last AllocateKernelMemory() call (which returned
+// address), for callers that fail after allocating.
+
+void ReleaseKernelMemory(long address)
+{
+	if (address < gPlatform.LastKernelAddr)
+	{
+		gPlatform.LastKernelAddr = address;
+		bootArgs->ksize = gPlatform.LastKernelAddr - bootArgs->kaddr;
+	}
+}
@@ -374,8 +374,10 @@ int biosread(int dev, int cyl, int head, int sec, int num)
 
 
 //==============================================================================
+// Note: The buffer must be located in conventional memory (below 1 MB) and the
+// transfer must not exceed 127 sectors (Phoenix EDD limit).
 
-int ebiosread(int dev, unsigned long long sec, int count)
+int ebiosread(int dev, unsigned long long sec, int count, void * buffer)
 {
 	int i;
     
@@ -400,8 +402,8 @@ int ebiosread(int dev, unsigned long long sec, int count)
 		bb.ds      = NORMALIZED_SEGMENT((unsigned)&addrpacket);
 		addrpacket.reserved = addrpacket.reserved2 = 0;
 		addrpacket.numblocks     = count;
-		addrpacket.bufferOffset  = OFFSET(ptov(BIOS_ADDR));
-		addrpacket.bufferSegment = SEGMENT(ptov(BIOS_ADDR));
+		addrpacket.bufferOffset  = NORMALIZED_OFFSET((unsigned)buffer);
+		addrpacket.bufferSegment = NORMALIZED_SEGMENT((unsigned)buffer);
 		addrpacket.startblock    = sec;
 		bios(&bb);
 
@@ -31,171 +31,557 @@
 // #include <fs.h>
 
 typedef struct CacheEntry {
-  CICell    ih;
-  long      time;
+  CICell    ih;       // 0 when free.
   long long offset;
+  char     *buffer;   // Block size of the volume, or 0.
+  long      size;
+  short     prev;     // LRU list (shared by all volumes), most recently used entry first.
+  short     next;
 } CacheEntry;
 
+// Volumes share the memory budget (kCacheSize) through the common LRU list, so
+// each one gets a share according to how recently its blocks were used, and
+// switching between volumes doesn't invalidate anything.
+typedef struct CacheVolume {
+  CICell    ih;       // 0 when unused.
+  long      blockSize;
+  long      time;     // Last CacheInit() (for replacement).
+#if CACHE_STATS
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evicts;
+#endif
+} CacheVolume;
+
 #define kCacheSize            (0x100000)
 #define kCacheMinBlockSize    (0x200)
-#define kCacheMaxBlockSize    (0x4000)
+#define kCacheMaxBlockSize    (0x10000)
 #define kCacheMaxEntries      (kCacheSize / kCacheMinBlockSize)
+#define kCacheMaxVolumes      (8)
+
+// Open addressed (linear probing) hash of entry indexes, keyed on (ih, offset).
+// Twice the number of entries, so that the load factor never exceeds 0.5.
+#define kCacheHashBits        (12)
+#define kCacheHashSize        (1 << kCacheHashBits)
+#define kCacheHashMask        (kCacheHashSize - 1)
+#define kCacheHashEmpty       (-1)
 
-static CICell     gCacheIH;
-static long       gCacheBlockSize;
-static long       gCacheNumEntries;
-static long       gCacheTime;
+static CacheVolume  gCacheVolumes[kCacheMaxVolumes];
+static CacheVolume *gCacheVolume;	// Selected by CacheInit().
+static long         gCacheTime;
+static long         gCacheBytes;	// Allocated to entry buffers.
+static short        gCacheMRU = -1;
+static short        gCacheLRU = -1;
+static short        gCacheFree = -1;	// Entries without a buffer (linked through next).
 
 #ifdef __i386__
 	static CacheEntry *gCacheEntries;
-	static char       *gCacheBuffer;
+	static short      *gCacheHash;
 #else
 	static CacheEntry gCacheEntries[kCacheMaxEntries];
-	static char       gCacheBuffer[kCacheSize];
+	static short      gCacheHash[kCacheHashSize];
 #endif
 
 #if CACHE_STATS
 	unsigned long     gCacheHits;
 	unsigned long     gCacheMisses;
 	unsigned long     gCacheEvicts;
+	unsigned long     gCacheProbes;		// Hash buckets inspected by lookups (hits + misses).
 #endif
 
-void CacheReset()
+static inline long CacheHash(CICell ih, long long offset)
 {
-    gCacheIH = NULL;
+    // Fibonacci hashing (offsets are multiples of the block size, so use the high bits).
+    uint32_t key = (uint32_t)(offset >> 9) ^ ((uint32_t)(unsigned long)ih << 7);
+
+    return (long)((key * 2654435761U) >> (32 - kCacheHashBits));
 }
 
-void CacheInit( CICell ih, long blockSize )
+// Returns the index of the entry holding (ih, offset), or -1 when not cached.
+static long CacheLookup(CICell ih, long long offset)
 {
-#ifdef __i386__
-    if ((ih == gCacheIH) && (blockSize == gCacheBlockSize))
+    long bucket = CacheHash(ih, offset);
+    short index;
+
+    while ((index = gCacheHash[bucket]) != kCacheHashEmpty)
 	{
-        return;
-	}
+#if CACHE_STATS
+        gCacheProbes++;
 #endif
+        if ((gCacheEntries[index].ih == ih) && (gCacheEntries[index].offset == offset))
+		{
+            return index;
+		}
 
-    if ((blockSize  < kCacheMinBlockSize) || (blockSize >= kCacheMaxBlockSize))
+        bucket = (bucket + 1) & kCacheHashMask;
+	}
+
+    return -1;
+}
+
+static void CacheHashInsert(short index)
+{
+    long bucket = CacheHash(gCacheEntries[index].ih, gCacheEntries[index].offset);
+
+    while (gCacheHash[bucket] != kCacheHashEmpty)
 	{
-        return;
+        bucket = (bucket + 1) & kCacheHashMask;
 	}
 
-    gCacheBlockSize = blockSize;
-    gCacheNumEntries = kCacheSize / gCacheBlockSize;
-    gCacheTime = 0;
-    
-#if CACHE_STATS
-    gCacheHits		= 0;
-    gCacheMisses	= 0;
-    gCacheEvicts	= 0;
-#endif
+    gCacheHash[bucket] = index;
+}
 
-    gCacheIH = ih;
+// Removes an entry from the hash, shifting back the entries that follow it in
+// the probe sequence (so that no tombstones are needed).
+static void CacheHashRemove(short index)
+{
+    long bucket = CacheHash(gCacheEntries[index].ih, gCacheEntries[index].offset);
+    long next, home;
 
-#ifdef __i386__
-    if (!gCacheBuffer)
+    while (gCacheHash[bucket] != index)
+	{
+        bucket = (bucket + 1) & kCacheHashMask;
+	}
+
+    for (next = bucket; ; )
+	{
+        next = (next + 1) & kCacheHashMask;
+
+        if ((index = gCacheHash[next]) == kCacheHashEmpty)
+		{
+            break;
+		}
+
+        home = CacheHash(gCacheEntries[index].ih, gCacheEntries[index].offset);
+
+        // Move the entry into the hole unless its home bucket is in (bucket, next].
+        if ((next > bucket) ? ((home <= bucket) || (home > next)) : ((home <= bucket) && (home > next)))
+		{
+            gCacheHash[bucket] = index;
+            bucket = next;
+		}
+	}
+
+    gCacheHash[bucket] = kCacheHashEmpty;
+}
+
+static void CacheUnlink(short index)
+{
+    CacheEntry *entry = &gCacheEntries[index];
+
+    if (entry->prev >= 0)
+	{
+        gCacheEntries[entry->prev].next = entry->next;
+	}
+    else
 	{
-		gCacheBuffer = (char *) malloc(kCacheSize);
+        gCacheMRU = entry->next;
 	}
 
-    if (!gCacheEntries)
+    if (entry->next >= 0)
 	{
-		gCacheEntries = (CacheEntry *) malloc(kCacheMaxEntries * sizeof(CacheEntry));
+        gCacheEntries[entry->next].prev = entry->prev;
 	}
+    else
+	{
+        gCacheLRU = entry->prev;
+	}
+}
+
+// Adds an entry at the front (most recently used) or the back of the LRU list.
+static void CacheLink(short index, bool front)
+{
+    CacheEntry *entry = &gCacheEntries[index];
+
+    if (front)
+	{
+        entry->prev = -1;
+        entry->next = gCacheMRU;
+
+        if (gCacheMRU >= 0)
+		{
+            gCacheEntries[gCacheMRU].prev = index;
+		}
+        else
+		{
+            gCacheLRU = index;
+		}
 
-    if (!gCacheBuffer || !gCacheEntries)
-    {
-        gCacheIH = 0;  // invalidate cache
+        gCacheMRU = index;
+	}
+    else
+	{
+        entry->prev = gCacheLRU;
+        entry->next = -1;
+
+        if (gCacheLRU >= 0)
+		{
+            gCacheEntries[gCacheLRU].next = index;
+		}
+        else
+		{
+            gCacheMRU = index;
+		}
+
+        gCacheLRU = index;
+	}
+}
+
+// Moves an entry to the front or the back of the LRU list.
+static void CacheMove(short index, bool front)
+{
+    if (index == (front ? gCacheMRU : gCacheLRU))
+	{
         return;
+	}
+
+    CacheUnlink(index);
+    CacheLink(index, front);
+}
+
+static CacheVolume * CacheGetVolume(CICell ih)
+{
+    long cnt;
+
+    for (cnt = 0; cnt < kCacheMaxVolumes; cnt++)
+	{
+        if (gCacheVolumes[cnt].ih == ih)
+		{
+            return &gCacheVolumes[cnt];
+		}
+	}
+
+    return 0;
+}
+
+// Frees an entry and (optionally) its buffer.
+static void CacheRelease(short index, bool freeBuffer)
+{
+    CacheEntry *entry = &gCacheEntries[index];
+
+    if (entry->ih != 0)
+	{
+        CacheHashRemove(index);
+        entry->ih = 0;
     }
-#endif
 
-    bzero(gCacheEntries, kCacheMaxEntries * sizeof(CacheEntry));
+    if (freeBuffer && entry->buffer)
+	{
+        free(entry->buffer);
+        gCacheBytes -= entry->size;
+        entry->buffer = 0;
+        entry->size = 0;
+    }
 }
 
-long CacheRead(CICell ih, char * buffer, long long offset, long length, long cache)
+// Drops all blocks of a volume (all volumes when ih is 0).
+static void CacheInvalidate(CICell ih)
 {
-    long cnt, oldestEntry = 0, oldestTime, loadCache = 0;
-    CacheEntry *entry;
+    short cnt;
 
-    // See if the data can be cached.
-    if (cache && (gCacheIH == ih) && (length == gCacheBlockSize))
+    for (cnt = 0; cnt < kCacheMaxEntries; cnt++)
 	{
-        // Look for the data in the cache.
-        for (cnt = 0; cnt < gCacheNumEntries; cnt++)
+        if (gCacheEntries[cnt].ih && (!ih || (gCacheEntries[cnt].ih == ih)))
 		{
-            entry = &gCacheEntries[cnt];
+            CacheRelease(cnt, false);
+            CacheMove(cnt, false);	// Reuse first.
+		}
+	}
+}
+
+void CacheReset()
+{
+    long cnt;
+
+    if (gCacheMRU >= 0)
+	{
+        CacheInvalidate(0);
+	}
+
+    for (cnt = 0; cnt < kCacheMaxVolumes; cnt++)
+	{
+        gCacheVolumes[cnt].ih = 0;
+	}
+
+    gCacheVolume = 0;
+}
+
+void CacheInit( CICell ih, long blockSize )
+{
+    CacheVolume *volume;
+    long cnt;
+
+    if ((blockSize  < kCacheMinBlockSize) || (blockSize > kCacheMaxBlockSize))
+	{
+        return;
+	}
 
-            if ((entry->ih == ih) && (entry->offset == offset))
+    // First use, set up the (empty) hash and the free list. After that, every
+    // entry is either in the LRU list or in the free list.
+    if ((gCacheMRU < 0) && (gCacheFree < 0))
+	{
+#ifdef __i386__
+        gCacheEntries = (CacheEntry *) malloc(kCacheMaxEntries * sizeof(CacheEntry));
+        gCacheHash = (short *) malloc(kCacheHashSize * sizeof(short));
+
+        if (!gCacheEntries || !gCacheHash)
+        {
+            gCacheVolume = 0;  // invalidate cache
+            return;
+        }
+#endif
+        bzero(gCacheEntries, kCacheMaxEntries * sizeof(CacheEntry));
+        memset(gCacheHash, 0xFF, kCacheHashSize * sizeof(short));	// kCacheHashEmpty
+
+        for (cnt = 0; cnt < kCacheMaxEntries; cnt++)
+		{
+            gCacheEntries[cnt].next = (cnt + 1 < kCacheMaxEntries) ? cnt + 1 : -1;
+		}
+
+        gCacheFree = 0;
+	}
+
+    volume = CacheGetVolume(ih);
+
+    if (volume == 0)
+	{
+        // Use a free context, or take over the one used least recently.
+        volume = &gCacheVolumes[0];
+
+        for (cnt = 0; cnt < kCacheMaxVolumes; cnt++)
+		{
+            if (gCacheVolumes[cnt].ih == 0)
 			{
-                entry->time = ++gCacheTime;
+                volume = &gCacheVolumes[cnt];
                 break;
-            }
-        }
+			}
+
+            if (gCacheVolumes[cnt].time < volume->time)
+			{
+                volume = &gCacheVolumes[cnt];
+			}
+		}
 
-        // If the data was found copy it to the caller.
-        if (cnt != gCacheNumEntries)
+        if (volume->ih)
 		{
-            bcopy(gCacheBuffer + cnt * gCacheBlockSize, buffer, gCacheBlockSize);
+            CacheInvalidate(volume->ih);
+		}
+
+        bzero(volume, sizeof(CacheVolume));
+        volume->ih = ih;
+	}
+    else if (volume->blockSize != blockSize)
+	{
+        CacheInvalidate(ih);
+	}
+
+    volume->blockSize = blockSize;
+    volume->time = ++gCacheTime;
+    gCacheVolume = volume;
+}
+
 #if CACHE_STATS
-            gCacheHits++;
-#endif
-            return gCacheBlockSize;
-        }
+static void CacheCountEvict(CICell ih)
+{
+    CacheVolume *owner = CacheGetVolume(ih);
 
-        // Could not find the data in the cache.
-        loadCache = 1;
-    }
+    if (owner)
+	{
+        owner->evicts++;
+	}
+
+    gCacheEvicts++;
+}
+#endif
 
-    // Read the data from the disk.
-    Seek(ih, offset);
-    Read(ih, (long)buffer, length);
+// Stores one block (read from disk) in the least recently used entry, or in a
+// new one while the memory budget allows it. Only entries with a buffer are in
+// the LRU list, so making room never has to look past unused entries.
+static void CacheInsert(CacheVolume *volume, long long offset, char * buffer)
+{
+    long size = volume->blockSize;
+    short cnt = -1, victim;
+    CacheEntry *entry;
 
+    // Invalidated entries are at the end of the list, so they are used first.
+    while ((gCacheLRU >= 0) && ((gCacheEntries[gCacheLRU].ih == 0) || ((gCacheBytes + size) > kCacheSize)))
+	{
+        victim = gCacheLRU;
+        entry = &gCacheEntries[victim];
 #if CACHE_STATS
-    if (cache)
+        if (entry->ih != 0)
+		{
+            CacheCountEvict(entry->ih);
+		}
+#endif
+        CacheRelease(victim, (entry->size != size));
+
+        // Same size, so take over the buffer.
+        if (entry->buffer)
+		{
+            cnt = victim;
+            break;
+		}
+
+        CacheUnlink(victim);
+        entry->next = gCacheFree;
+        gCacheFree = victim;
+	}
+
+    // Or use a free entry with a new buffer.
+    if (cnt < 0)
 	{
-		gCacheMisses++;
+        if ((gCacheFree < 0) || ((gCacheBytes + size) > kCacheSize))
+		{
+            return;
+		}
+
+        entry = &gCacheEntries[gCacheFree];
+
+        if ((entry->buffer = (char *) malloc(size)) == 0)
+		{
+            return;
+		}
+
+        cnt = gCacheFree;
+        gCacheFree = entry->next;
+        entry->size = size;
+        gCacheBytes += size;
+        CacheLink(cnt, true);
 	}
+
+    entry->ih = volume->ih;
+    entry->offset = offset;
+    CacheHashInsert(cnt);
+    CacheMove(cnt, true);
+    bcopy(buffer, entry->buffer, size);
+}
+
+// Reads length bytes at offset. When cache is set, the blocks (aligned to the
+// cache block size) covered by the request are served from / stored in the cache,
+// and only runs of missing blocks are read from disk. Partial blocks at either
+// end of the request are read but not cached.
+long CacheRead(CICell ih, char * buffer, long long offset, long length, long cache)
+{
+    CacheVolume *volume = gCacheVolume;
+    long long first, last, blockOffset, missOffset = -1;
+    char *missBuffer = 0;
+    long cnt, blockSize = 0;
+
+    if (cache && volume && (volume->ih == ih))
+	{
+        blockSize = volume->blockSize;
+        first = ((offset + blockSize - 1) / blockSize) * blockSize;
+        last = ((offset + length) / blockSize) * blockSize;
+    }
+    else
+	{
+        first = last = 0;
+    }
+
+    // Nothing to cache?
+    if (first >= last)
+	{
+        Seek(ih, offset);
+        Read(ih, (long)buffer, length);
+#if CACHE_STATS
+        if (cache)
+		{
+			gCacheMisses++;
+		}
 #endif
+        return length;
+    }
 
-    // Put the data from the disk in the cache if needed.
-    if (loadCache)
+    // Leading partial block.
+    if (first > offset)
 	{
-        // Find a free entry.
-        oldestTime = gCacheTime;
+        Seek(ih, offset);
+        Read(ih, (long)buffer, (long)(first - offset));
+    }
+
+    // Whole blocks. Consecutive misses are read with a single request.
+    for (blockOffset = first; blockOffset <= last; blockOffset += blockSize)
+	{
+        char *blockBuffer = buffer + (blockOffset - offset);
+
+        cnt = (blockOffset < last) ? CacheLookup(ih, blockOffset) : -1;
 
-        for (cnt = 0; cnt < gCacheNumEntries; cnt++)
+        if (cnt >= 0)
 		{
-            entry = &gCacheEntries[cnt];
+            CacheMove(cnt, true);
+            bcopy(gCacheEntries[cnt].buffer, blockBuffer, blockSize);
+#if CACHE_STATS
+            volume->hits++;
+            gCacheHits++;
+#endif
+        }
 
-            // Found a free entry.
-            if (entry->ih == 0)
-			{
-				break;
-			}
-        
-            if (entry->time < oldestTime)
+        // Flush the pending run of misses (at a hit, or at the end).
+        if ((missOffset >= 0) && ((cnt >= 0) || (blockOffset == last)))
+		{
+            Seek(ih, missOffset);
+            Read(ih, (long)missBuffer, (long)(blockOffset - missOffset));
+
+            for (; missOffset < blockOffset; missOffset += blockSize, missBuffer += blockSize)
 			{
-                oldestTime = entry->time;
-                oldestEntry = cnt;
+                CacheInsert(volume, missOffset, missBuffer);
+#if CACHE_STATS
+                volume->misses++;
+                gCacheMisses++;
+#endif
             }
+
+            missOffset = -1;
         }
 
-        // If no free entry was found, use the oldest.
-        if (cnt == gCacheNumEntries)
+        if ((cnt < 0) && (blockOffset < last) && (missOffset < 0))
 		{
-            cnt = oldestEntry;
-#if CACHE_STATS
-            gCacheEvicts++;
-#endif
+            missOffset = blockOffset;
+            missBuffer = blockBuffer;
         }
+    }
 
-        // Copy the data from disk to the new entry.
-        entry = &gCacheEntries[cnt];
-        entry->ih = ih;
-        entry->time = ++gCacheTime;
-        entry->offset = offset;
-        bcopy(buffer, gCacheBuffer + cnt * gCacheBlockSize, gCacheBlockSize);
+    // Trailing partial block.
+    if ((offset + length) > last)
+	{
+        Seek(ih, last);
+        Read(ih, (long)(buffer + (last - offset)), (long)((offset + length) - last));
     }
 
     return length;
 }
+
+#if CACHE_STATS
+// Prints the hit rate and the current share of the cache of each volume.
+void CachePrintStats(void)
+{
+    long cnt, entry, bytes;
+
+    printf("Metadata cache: %d KB in use, %d hits, %d misses, %d evictions, %d probes\n",
+           gCacheBytes / 1024, gCacheHits, gCacheMisses, gCacheEvicts, gCacheProbes);
+
+    for (cnt = 0; cnt < kCacheMaxVolumes; cnt++)
+	{
+        CacheVolume *volume = &gCacheVolumes[cnt];
+
+        if (volume->ih == 0)
+		{
+            continue;
+		}
+
+        for (entry = 0, bytes = 0; (gCacheMRU >= 0) && (entry < kCacheMaxEntries); entry++)
+		{
+            if (gCacheEntries[entry].ih == volume->ih)
+			{
+                bytes += gCacheEntries[entry].size;
+			}
+		}
+
+        printf("  volume %x (block size %d): %d hits, %d misses (%d percent hits), %d evictions, %d KB\n",
+               (unsigned long)volume->ih, volume->blockSize, volume->hits, volume->misses,
+               (volume->hits + volume->misses) ? ((volume->hits * 100) / (volume->hits + volume->misses)) : 0,
+               volume->evicts, bytes / 1024);
+	}
+}
+#endif
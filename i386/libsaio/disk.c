@@ -69,22 +69,41 @@ typedef struct gpt_hdr gpt_hdr;
 typedef struct gpt_ent gpt_ent;
 
 #include "efi_tables.h"
+#include "iotrace.h"
+
+#if IO_TRACE_SUPPORT
+	#include "cpu/proc_reg.h"
+
+	#define IO_TRACE_BEGIN(dev, lba, count, flags)	IOTraceRecord * trace = ioTraceRecord(dev, lba, count, flags)
+	#define IO_TRACE_END(rc)						if (trace) { trace->tscEnd = rdtsc64(); if (rc) { trace->flags |= kIOTraceError; } }
+#else
+	#define IO_TRACE_BEGIN(dev, lba, count, flags)
+	#define IO_TRACE_END(rc)
+#endif
 
 
 #define BPS				512		// sector size of the device.
 #define PROBEFS_SIZE	BPS * 4	// buffer size for filesystem probe.
 // #define CD_BPS		2048	// CD-ROM block size.
 #define N_CACHE_SECS	(BIOS_LEN / BPS)	// Must be a multiple of 4 for CD-ROMs.
+#define EBIOS_MAX_SECS	127		// Largest INT13/F42 transfer supported by all EDD implementations.
+#define BULK_MIN_SECS	8		// Requests of this many sectors (or more) bypass the sector cache.
+
+#define N_DISK_STREAMS	4		// Number of concurrent sequential streams tracked per device.
+#define N_DISK_DEVICES	8		// Number of devices with read-ahead state.
+
+#define N_CACHE_SETS	8		// Sector cache geometry (each slot holds up to N_CACHE_SECS sectors).
+#define N_CACHE_WAYS	2
 
 // IORound and IOTrunc convenience functions, in the spirit of vm's round_page() and trunc_page().
 #define IORound(value, multiple) ((((value) + (multiple) - 1) / (multiple)) * (multiple))
 #define IOTrunc(value, multiple) (((value) / (multiple)) * (multiple));
 
-// trackbuf points to the start of the track cache. Biosread() 
-// will store the sectors read from disk to this memory area.
+// trackbuf points to the start of the BIOS disk I/O buffer. Sectors read by
+// Biosread() land here before they are copied into the sector cache.
 static char * const trackbuf = (char *) ptov(BIOS_ADDR);
 
-// biosbuf points to a sector within the track cache, and is updated by Biosread().
+// biosbuf points to a sector within the sector cache, and is updated by Biosread().
 static char * biosbuf;
 
 // Map a disk drive to bootable volumes contained within.
@@ -146,6 +165,263 @@ EFI_GUID const GPT_HFS_GUID					= { 0x48465300, 0x0000, 0x11AA, { 0xAA, 0x11, 0x
 #endif
 
 
+//==============================================================================
+// Maps (E)BIOS return codes to message strings.
+
+struct NamedValue
+{
+	unsigned char value;
+	const char *  name;
+};
+
+
+//==============================================================================
+
+static const char * getNameForValue(const struct NamedValue * nameTable, unsigned char value)
+{
+	const struct NamedValue * np;
+
+	for ( np = nameTable; np->value; np++)
+	{
+		if (np->value == value)
+		{
+			return np->name;
+		}
+	}
+
+	return NULL;
+}
+
+#define ECC_CORRECTED_ERR 0x11
+
+static const struct NamedValue bios_errors[] = 
+{
+	{ 0x10, "Media error"					},
+	{ 0x11, "Corrected ECC error"			},
+	{ 0x20, "Controller or device error"	},
+	{ 0x40, "Seek failed"					},
+	{ 0x80, "Device timeout"				},
+	{ 0xAA, "Drive not ready"				},
+	{ 0x00, 0								}
+};
+
+
+// Per device read-ahead state. Biosread() starts with a single block and
+// doubles the window (up to N_CACHE_SECS) for each read that continues one
+// of the last few streams, so that B-tree node hops don't waste bandwidth.
+struct DiskDevice
+{
+	int					biosdev;
+	bool				used;
+	struct DiskBackend *	backend;					// NULL for INT13.
+	unsigned int		replace;						// Next stream to recycle.
+
+	struct
+	{
+		unsigned long long	next;						// Sector following the last read.
+		unsigned int		window;						// Current read-ahead window (in sectors).
+	} stream[N_DISK_STREAMS];
+
+#if DEBUG_DISK
+	unsigned long		hits;							// Sectors served from the sector cache.
+	unsigned long		misses;							// INT13 reads issued by Biosread().
+	unsigned long		evictions;						// Cached windows of this device thrown out.
+	unsigned long		bulkReads;						// INT13 reads issued by bulkRead().
+	unsigned long long	sectors;						// Sectors transferred (both paths).
+	unsigned int		window;							// Last read-ahead window used.
+#endif
+};
+
+static struct DiskDevice gDiskDevices[N_DISK_DEVICES];
+
+// The sector cache. Each slot holds one read-ahead window, which never crosses
+// an N_CACHE_SECS aligned line, so that a sector can only be cached in the set
+// selected by its (biosdev, line) pair. Slots are replaced in LRU order.
+struct DiskCacheSlot
+{
+	int					biosdev;
+	unsigned long long	sec;							// First sector in buffer.
+	unsigned int		nsecs;							// Number of sectors (0 when unused).
+	unsigned long		time;							// Last access (for LRU replacement).
+	char *				buffer;							// N_CACHE_SECS * BPS bytes, allocated on first use.
+};
+
+static struct DiskCacheSlot gDiskCache[N_CACHE_SETS][N_CACHE_WAYS];
+static unsigned long gDiskCacheTime = 0;
+
+// Registered read backends (see diskRegisterBackend).
+static struct DiskBackend * gDiskBackends = NULL;
+
+#if IO_TRACE_SUPPORT
+// Set by callers of the disk layer to tag trace records (see iotrace.h).
+uint8_t gIOTraceSubsystem = kIOTraceOther;
+
+// Ring of trace records, allocated on first use.
+static IOTrace * gIOTrace = NULL;
+#endif
+
+//==============================================================================
+
+static const char * bios_error(int errnum)
+{
+	static char  errorstr[] = "Error 0x00";
+	const char * errname;
+
+	errname = getNameForValue(bios_errors, errnum);
+
+	if (errname)
+	{
+		return errname;
+	}
+
+	sprintf(errorstr, "Error 0x%02x", errnum);
+	return errorstr; // No string, print error code only
+}
+
+
+//==============================================================================
+// Registers a read backend for drives that can be accessed without INT13. Each
+// drive is offered to the registered backends (in order) on first access.
+
+void diskRegisterBackend(struct DiskBackend * backend)
+{
+	struct DiskBackend ** link = &gDiskBackends;
+
+	while (*link)
+	{
+		link = &(*link)->next;
+	}
+
+	backend->next = NULL;
+	*link = backend;
+}
+
+
+//==============================================================================
+// Copies the signature of biosdev, as read by INT13, to signature: the first 512
+// bytes of LBA 0 (MBR) and LBA 1 (GPT header, with the disk GUID) in the block
+// size of the drive, so that 4Kn drives include their GPT header too. The result
+// is kept for the first few hard drives, so that backends
+// which take a controller away from the BIOS can capture the signatures of its
+// drives before they do so (see nvme.c).
+
+bool diskReadSignature(int biosdev, void * signature)
+{
+	static struct
+	{
+		bool	probed;
+		char *	data;									// NULL when the drive could not be read.
+	} signatures[N_DISK_DEVICES];
+
+	struct driveInfo di;
+	char * data = NULL;
+	char buffer[DISK_SIGNATURE_SIZE];
+	int unit = (biosdev - kBIOSDevTypeHardDrive);
+	bool keep = ((unit >= 0) && (unit < N_DISK_DEVICES));
+
+	if (keep && signatures[unit].probed)
+	{
+		data = signatures[unit].data;
+	}
+	else
+	{
+		if ((get_drive_info(biosdev, &di) == 0) && (di.uses_ebios & EBIOS_FIXED_DISK_ACCESS) && !di.no_emulation &&
+			(di.di.params.phys_nbps >= BPS) && ((2 * di.di.params.phys_nbps) <= BIOS_LEN) &&
+			(ebiosread(biosdev, 0, 2, trackbuf) == 0))
+		{
+			bcopy(trackbuf, buffer, 512);
+			bcopy((trackbuf + di.di.params.phys_nbps), (buffer + 512), 512);
+
+			data = buffer;
+
+			if (keep && (data = malloc(DISK_SIGNATURE_SIZE)))
+			{
+				bcopy(buffer, data, DISK_SIGNATURE_SIZE);
+			}
+		}
+
+		if (keep)
+		{
+			signatures[unit].probed = true;
+			signatures[unit].data = data;
+		}
+	}
+
+	if (data)
+	{
+		bcopy(data, signature, DISK_SIGNATURE_SIZE);
+
+		return true;
+	}
+
+	return false;
+}
+
+
+//==============================================================================
+// Returns the backend that claims biosdev, or NULL when INT13 should be used.
+
+static struct DiskBackend * getDiskBackend(int biosdev)
+{
+	struct DiskBackend * backend;
+	char signature[DISK_SIGNATURE_SIZE];
+	bool haveSignature;
+
+	if ((gDiskBackends == NULL) || (biosdev < kBIOSDevTypeHardDrive) || (biosdev >= 0x100))
+	{
+		return NULL;
+	}
+
+	// Backends claim drives by matching the MBR and GPT header as read by INT13.
+	haveSignature = diskReadSignature(biosdev, signature);
+
+	for (backend = gDiskBackends; backend && haveSignature; backend = backend->next)
+	{
+		if (backend->probe && backend->probe(biosdev, signature))
+		{
+			_DISK_DEBUG_DUMP("Disk %02xh: using %s backend\n", biosdev, backend->name);
+
+			return backend;
+		}
+	}
+
+	return NULL;
+}
+
+
+//==============================================================================
+
+static struct DiskDevice * getDiskDevice(int biosdev)
+{
+	static unsigned int replace = 0;
+	int i;
+
+	for (i = 0; i < N_DISK_DEVICES; i++)
+	{
+		if (gDiskDevices[i].used && (gDiskDevices[i].biosdev == biosdev))
+		{
+			return &gDiskDevices[i];
+		}
+	}
+
+	// Not found. Use a free entry, or recycle one when all are taken.
+	for (i = 0; (i < N_DISK_DEVICES) && gDiskDevices[i].used; i++);
+
+	if (i == N_DISK_DEVICES)
+	{
+		i = (replace++ % N_DISK_DEVICES);
+	}
+
+	bzero(&gDiskDevices[i], sizeof(gDiskDevices[i]));
+
+	gDiskDevices[i].biosdev = biosdev;
+	gDiskDevices[i].used = true;
+	gDiskDevices[i].backend = getDiskBackend(biosdev);
+
+	return &gDiskDevices[i];
+}
+
+
 //==============================================================================
 
 static int getDriveInfo(int biosdev, struct driveInfo *dip)
@@ -199,84 +475,216 @@ static int getDriveInfo(int biosdev, struct driveInfo *dip)
 }
 
 
+#if IO_TRACE_SUPPORT
 //==============================================================================
-// Maps (E)BIOS return codes to message strings.
+// Adds a record to the I/O trace ring. Cache hits on consecutive sectors are
+// folded into the previous record to keep the ring from filling up with them.
 
-struct NamedValue
+static IOTraceRecord * ioTraceRecord(int biosdev, unsigned long long lba, unsigned int count, uint8_t flags)
 {
-	unsigned char value;
-	const char *  name;
-};
+	IOTraceRecord * record;
+	uint64_t now = rdtsc64();
+
+	if (gIOTrace == NULL)
+	{
+		gIOTrace = (IOTrace *) malloc(sizeof(IOTrace));
+
+		if (gIOTrace == NULL)
+		{
+			return NULL;
+		}
+
+		bzero(gIOTrace, sizeof(IOTrace));
+
+		gIOTrace->header.signature	= IO_TRACE_SIGNATURE;
+		gIOTrace->header.version	= IO_TRACE_VERSION;
+		gIOTrace->header.capacity	= IO_TRACE_RECORDS;
+	}
+
+	if ((flags & kIOTraceHit) && gIOTrace->header.total)
+	{
+		record = &gIOTrace->records[(gIOTrace->header.total - 1) % IO_TRACE_RECORDS];
+
+		if ((record->flags == flags) && (record->biosdev == biosdev) && (record->subsystem == gIOTraceSubsystem) &&
+			((record->lba + record->count) == lba))
+		{
+			record->count += count;
+			record->tscEnd = now;
+
+			return record;
+		}
+	}
+
+	record = &gIOTrace->records[gIOTrace->header.total++ % IO_TRACE_RECORDS];
+
+	record->tscStart	= now;
+	record->tscEnd		= now;
+	record->lba			= lba;
+	record->count		= count;
+	record->biosdev		= biosdev;
+	record->flags		= flags;
+	record->subsystem	= gIOTraceSubsystem;
+	record->reserved	= 0;
+
+	return record;
+}
 
 
 //==============================================================================
+// Called from finalizeEFITree() to publish the trace under /efi/platform.
 
-static const char * getNameForValue(const struct NamedValue * nameTable, unsigned char value)
+void * diskGetIOTrace(uint32_t * size)
 {
-	const struct NamedValue * np;
+	if (gIOTrace == NULL)
+	{
+		return NULL;
+	}
 
-	for ( np = nameTable; np->value; np++)
+	gIOTrace->header.tscFrequency = gPlatform.CPU.TSCFrequency;
+
+	uint32_t count = (gIOTrace->header.total > IO_TRACE_RECORDS) ? IO_TRACE_RECORDS : gIOTrace->header.total;
+
+	*size = sizeof(IOTraceHeader) + (count * sizeof(IOTraceRecord));
+
+	return gIOTrace;
+}
+#endif
+
+
+//==============================================================================
+// Returns the number of sectors to read for a (block aligned) cache miss, which
+// is limited to maxnsecs (the number of sectors up to the end of the line).
+
+static unsigned int getReadAheadWindow(struct DiskDevice * device, unsigned long long secno, int divisor, unsigned int maxnsecs)
+{
+	int i;
+	unsigned int nsecs;
+
+	for (i = 0; i < N_DISK_STREAMS; i++)
 	{
-		if (np->value == value)
+		if (device->stream[i].window && (device->stream[i].next == secno))
 		{
-			return np->name;
+			break;
 		}
 	}
 
-	return NULL;
+	if (i < N_DISK_STREAMS)
+	{
+		// Sequential. Double the window for this stream.
+		if (device->stream[i].window < N_CACHE_SECS)
+		{
+			device->stream[i].window <<= 1;
+		}
+	}
+	else
+	{
+		// Random access. Start a new stream with a single block.
+		i = (device->replace++ % N_DISK_STREAMS);
+		device->stream[i].window = divisor;
+	}
+
+	nsecs = (device->stream[i].window > maxnsecs) ? maxnsecs : device->stream[i].window;
+
+	device->stream[i].next = (secno + nsecs);
+
+#if DEBUG_DISK
+	device->window = device->stream[i].window;
+#endif
+
+	return nsecs;
 }
 
-#define ECC_CORRECTED_ERR 0x11
 
-static const struct NamedValue bios_errors[] = 
+//==============================================================================
+
+static inline struct DiskCacheSlot * getCacheSet(int biosdev, unsigned long long secno)
 {
-	{ 0x10, "Media error"					},
-	{ 0x11, "Corrected ECC error"			},
-	{ 0x20, "Controller or device error"	},
-	{ 0x40, "Seek failed"					},
-	{ 0x80, "Device timeout"				},
-	{ 0xAA, "Drive not ready"				},
-	{ 0x00, 0								}
-};
+	return gDiskCache[(unsigned int)((secno / N_CACHE_SECS) + (biosdev & kBIOSDevUnitMask)) % N_CACHE_SETS];
+}
+
+
+//==============================================================================
+
+static struct DiskCacheSlot * lookupCacheSlot(int biosdev, unsigned long long secno)
+{
+	int way;
+	struct DiskCacheSlot * slot = getCacheSet(biosdev, secno);
+
+	for (way = 0; way < N_CACHE_WAYS; way++, slot++)
+	{
+		if (slot->nsecs && (slot->biosdev == biosdev) && (secno >= slot->sec) && (secno < (slot->sec + slot->nsecs)))
+		{
+			slot->time = ++gDiskCacheTime;
 
+			return slot;
+		}
+	}
 
-static bool cache_valid = false;
+	return NULL;
+}
 
 
 //==============================================================================
+// Returns the least recently used slot of the set for (biosdev, secno), or NULL
+// when no buffer could be allocated for it.
 
-static const char * bios_error(int errnum)
+static struct DiskCacheSlot * allocCacheSlot(int biosdev, unsigned long long secno)
 {
-	static char  errorstr[] = "Error 0x00";
-	const char * errname;
+	int way;
+	struct DiskCacheSlot * set = getCacheSet(biosdev, secno);
+	struct DiskCacheSlot * slot = set;
 
-	errname = getNameForValue(bios_errors, errnum);
+	for (way = 1; (way < N_CACHE_WAYS) && slot->nsecs; way++)
+	{
+		if ((set[way].nsecs == 0) || (set[way].time < slot->time))
+		{
+			slot = &set[way];
+		}
+	}
 
-	if (errname)
+	if (slot->buffer == NULL)
 	{
-		return errname;
+		slot->buffer = malloc(N_CACHE_SECS * BPS);
+
+		if (slot->buffer == NULL)
+		{
+			return NULL;
+		}
+	}
+#if DEBUG_DISK
+	else if (slot->nsecs)
+	{
+		getDiskDevice(slot->biosdev)->evictions++;
 	}
+#endif
 
-	sprintf(errorstr, "Error 0x%02x", errnum);
-	return errorstr; // No string, print error code only
+	slot->biosdev	= biosdev;
+	slot->sec		= secno;
+	slot->nsecs		= 0;
+	slot->time		= ++gDiskCacheTime;
+
+	return slot;
 }
 
 
 //==============================================================================
 // Use BIOS INT13 calls to read the sector specified. This function will also
-// perform read-ahead to cache a few subsequent sector to the sector cache.
+// perform read-ahead to cache subsequent sectors, using a window that grows
+// for sequential reads (see getReadAheadWindow).
 // 
 // Returns 0 on success, or an error code from INT13/F2 or INT13/F42 BIOS call.
 
 static int Biosread(int biosdev, unsigned long long secno)
 {
-	static int xbiosdev;
-	static unsigned int xsec, xnsecs;
 	struct driveInfo di;
+	struct DiskDevice * device;
+	struct DiskCacheSlot * slot;
 
 	int  rc = -1;
 	int  tries = 0;
 	int bps, divisor;
+	unsigned long long xsec;
+	unsigned int xnsecs, maxnsecs;
 
 	if (getDriveInfo(biosdev, &di) < 0)
 	{
@@ -302,21 +710,63 @@ static int Biosread(int biosdev, unsigned long long secno)
 
 	// _DISK_DEBUG_DUMP("Biosread dev %x sec %d bps %d\n", biosdev, secno, bps);
 
-	// Use ebiosread() when supported, otherwise revert to biosread().
+	device = getDiskDevice(biosdev);
+	slot = lookupCacheSlot(biosdev, secno);
 
-	if ((biosdev >= kBIOSDevTypeHardDrive) && (di.uses_ebios & EBIOS_FIXED_DISK_ACCESS))
+	if (slot)
+	{
+#if DEBUG_DISK
+		device->hits++;
+#endif
+#if IO_TRACE_SUPPORT
+		ioTraceRecord(biosdev, secno, 1, kIOTraceHit);
+#endif
+		biosbuf = slot->buffer + (BPS * (secno - slot->sec));
+		return 0;
+	}
+
+	xsec = (secno / divisor) * divisor;
+	maxnsecs = N_CACHE_SECS - (xsec % N_CACHE_SECS);
+
+	// Native backends can read straight into the sector cache.
+	if (device->backend)
 	{
-		if (cache_valid && (biosdev == xbiosdev) && (secno >= xsec) && ((unsigned int)secno < (xsec + xnsecs)))
+		xnsecs = getReadAheadWindow(device, xsec, divisor, maxnsecs);
+		slot = allocCacheSlot(biosdev, xsec);
+
+		IO_TRACE_BEGIN(biosdev, xsec, xnsecs, 0);
+
+		rc = device->backend->read(biosdev, xsec, xnsecs, slot ? slot->buffer : trackbuf);
+
+		IO_TRACE_END(rc);
+
+#if DEBUG_DISK
+		device->misses++;
+		device->sectors += xnsecs;
+#endif
+
+		if (slot)
 		{
-			biosbuf = trackbuf + (BPS * (secno - xsec));
-			return 0;
+			slot->nsecs = (rc == 0) ? xnsecs : 0;
+			biosbuf = slot->buffer + ((secno - xsec) * BPS);
+		}
+		else
+		{
+			biosbuf = trackbuf + ((secno - xsec) * BPS);
 		}
 
-		xnsecs = N_CACHE_SECS;
-		xsec = (secno / divisor) * divisor;
-		cache_valid = false;
+		return rc;
+	}
+
+	// Use ebiosread() when supported, otherwise revert to biosread().
+
+	if ((biosdev >= kBIOSDevTypeHardDrive) && (di.uses_ebios & EBIOS_FIXED_DISK_ACCESS))
+	{
+		xnsecs = getReadAheadWindow(device, xsec, divisor, maxnsecs);
+
+		IO_TRACE_BEGIN(biosdev, xsec, xnsecs, 0);
 
-		while ((rc = ebiosread(biosdev, secno / divisor, xnsecs / divisor)) && (++tries < 5))
+		while ((rc = ebiosread(biosdev, xsec / divisor, xnsecs / divisor, trackbuf)) && (++tries < 5))
 		{
 			if (rc == ECC_CORRECTED_ERR)
 			{
@@ -328,33 +778,27 @@ static int Biosread(int biosdev, unsigned long long secno)
 			error("    Block 0x%x Sectors %d\n", secno, xnsecs);
 			_DISK_DEBUG_SLEEP(1);
 		}
+
+		IO_TRACE_END(rc);
 	}
 #if LEGACY_BIOS_READ_SUPPORT
 	else
 	{
-		static int xcyl, xhead;
 		/* spc = spt * heads */
 		int spc = (di.di.params.phys_spt * di.di.params.phys_heads);
-		int cyl  = secno / spc;
-		int head = (secno % spc) / di.di.params.phys_spt;
-		int sec  = secno % di.di.params.phys_spt;
+		int cyl  = xsec / spc;
+		int head = (xsec % spc) / di.di.params.phys_spt;
+		int sec  = xsec % di.di.params.phys_spt;
 
-		if (cache_valid && (biosdev == xbiosdev) && (cyl == xcyl) &&
-			(head == xhead) && ((unsigned int)sec >= xsec) &&
-			((unsigned int)sec < (xsec + xnsecs)))
+		// Cache up to a track worth of sectors, but do not cross a track boundary.
+		if ((sec + maxnsecs) > di.di.params.phys_spt)
 		{
-			// this sector is in trackbuf cache.
-			biosbuf = trackbuf + (BPS * (sec - xsec));
-			return 0;
+			maxnsecs = (di.di.params.phys_spt - sec);
 		}
 
-		// Cache up to a track worth of sectors, but do not cross a track boundary.
-		xcyl   = cyl;
-		xhead  = head;
-		xsec   = sec;
-		xnsecs = ((unsigned int)(sec + N_CACHE_SECS) > di.di.params.phys_spt) ? (di.di.params.phys_spt - sec) : N_CACHE_SECS;
+		xnsecs = getReadAheadWindow(device, xsec, divisor, maxnsecs);
 
-		cache_valid = false;
+		IO_TRACE_BEGIN(biosdev, xsec, xnsecs, 0);
 
 		while ((rc = biosread(biosdev, cyl, head, sec, xnsecs)) && (++tries < 5))
 		{
@@ -368,16 +812,35 @@ static int Biosread(int biosdev, unsigned long long secno)
 			error("  Block %d, Cyl %d Head %d Sector %d\n", secno, cyl, head, sec);
 			_DISK_DEBUG_SLEEP(1);
 		}
+
+		IO_TRACE_END(rc);
+	}
+#else
+	else
+	{
+		return -1;
 	}
 #endif // LEGACY_BIOS_READ_SUPPORT
 
-	if (rc == 0) // BIOS reported success, mark sector cache as valid.
+#if DEBUG_DISK
+	device->misses++;
+	device->sectors += xnsecs;
+#endif
+
+	biosbuf = trackbuf + ((secno - xsec) * BPS);
+
+	if (rc == 0) // BIOS reported success, add sectors to the sector cache.
 	{
-		cache_valid = true;
-	}
+		slot = allocCacheSlot(biosdev, xsec);
+
+		if (slot)
+		{
+			bcopy(trackbuf, slot->buffer, (xnsecs * BPS));
+			slot->nsecs = xnsecs;
 
-	biosbuf  = trackbuf + (secno % divisor) * BPS;
-	xbiosdev = biosdev;
+			biosbuf = slot->buffer + ((secno - xsec) * BPS);
+		}
+	}
 
 	return rc;
 }
@@ -391,6 +854,131 @@ int testBiosread(int biosdev, unsigned long long secno)
 }
 
 
+#if DEBUG_DISK
+//==============================================================================
+
+void diskPrintStats(void)
+{
+	int i;
+
+	for (i = 0; i < N_DISK_DEVICES; i++)
+	{
+		struct DiskDevice * device = &gDiskDevices[i];
+
+		if (device->used)
+		{
+			printf("Disk %02xh: %d hits, %d misses, %d evictions, %d bulk reads, %d KB read, window: %d sectors\n",
+				   device->biosdev, device->hits, device->misses, device->evictions, device->bulkReads,
+				   (unsigned long)(device->sectors / 2), device->window);
+		}
+	}
+}
+#endif
+
+
+//==============================================================================
+// Read a run of whole sectors with as few INT13 calls as possible. Sectors are
+// read straight into the target buffer when it is located in conventional 
+// memory, and in trackbuf sized chunks otherwise (copied out in one go). 
+//
+// Note: Kernels, kernelcaches and kexts are loaded at kLoadAddr (far above 1 MB)
+//       so they always take the trackbuf path: one INT13 call per 32 KB, the same
+//       as a fully grown Biosread window, but without the per sector calls/copies.
+//       The direct path (127 sectors per call) only serves small reads into low
+//       memory. There is no larger free buffer below 1 MB to bounce through.
+//
+// Returns the number of sectors read, 0 when the device isn't suitable for bulk
+// reads (the caller should use Biosread instead) or -1 on read errors.
+
+static int bulkRead(int biosdev, unsigned long long secno, unsigned int nsecs, char * buffer)
+{
+	struct driveInfo di;
+
+	int rc, tries;
+	unsigned int count, done = 0;
+	bool direct = (((unsigned long)vtop(buffer) + (nsecs * BPS)) <= CONVENTIONAL_LEN);
+
+	if (getDriveInfo(biosdev, &di) < 0)
+	{
+		return -1;
+	}
+
+	struct DiskDevice * device = getDiskDevice(biosdev);
+
+	// Native backends take the whole run in one go.
+	if (device->backend)
+	{
+#if DEBUG_DISK
+		device->bulkReads++;
+		device->sectors += nsecs;
+#endif
+		IO_TRACE_BEGIN(biosdev, secno, nsecs, kIOTraceBulk);
+
+		rc = device->backend->read(biosdev, secno, nsecs, buffer);
+
+		IO_TRACE_END(rc);
+
+		return (rc == 0) ? nsecs : -1;
+	}
+
+	// Bulk reads are limited to EBIOS hard drives with 512 byte sectors.
+	if ((biosdev < kBIOSDevTypeHardDrive) || !(di.uses_ebios & EBIOS_FIXED_DISK_ACCESS) || di.no_emulation || (di.di.params.phys_nbps != BPS))
+	{
+		return 0;
+	}
+
+	while (done < nsecs)
+	{
+		count = (nsecs - done);
+
+		if (count > (direct ? EBIOS_MAX_SECS : N_CACHE_SECS))
+		{
+			count = (direct ? EBIOS_MAX_SECS : N_CACHE_SECS);
+		}
+
+		tries = 0;
+
+		IO_TRACE_BEGIN(biosdev, secno, count, kIOTraceBulk);
+
+		while ((rc = ebiosread(biosdev, secno, count, direct ? buffer : trackbuf)) && (++tries < 5))
+		{
+			if (rc == ECC_CORRECTED_ERR)
+			{
+				rc = 0; // Ignore corrected ECC errors.
+				break;
+			}
+
+			error("  EBIOS read error: %s\n", bios_error(rc), rc);
+			error("    Block 0x%x Sectors %d\n", secno, count);
+			_DISK_DEBUG_SLEEP(1);
+		}
+
+		IO_TRACE_END(rc);
+
+		if (rc)
+		{
+			return -1;
+		}
+
+#if DEBUG_DISK
+		device->bulkReads++;
+		device->sectors += count;
+#endif
+
+		if (!direct)
+		{
+			bcopy(trackbuf, buffer, (count * BPS));
+		}
+
+		secno	+= count;
+		buffer	+= (count * BPS);
+		done	+= count;
+	}
+
+	return done;
+}
+
+
 //==============================================================================
 
 static int readBytes(int biosdev, unsigned long long blkno, unsigned int byteoff, unsigned int byteCount, void * buffer)
@@ -406,11 +994,34 @@ static int readBytes(int biosdev, unsigned long long blkno, unsigned int byteoff
 	char * cbuf = (char *) buffer;
 	int error;
 	int copy_len;
+	bool bulk = true;
 
 	// _DISK_DEBUG_DUMP("%s: dev %x block %x [%d] -> 0x%x...", __FUNCTION__, biosdev, blkno, byteCount, (unsigned)cbuf);
 
 	for (; byteCount; cbuf += copy_len, blkno++)
 	{
+		// Skip the sector cache for large (sector aligned) runs.
+		if (bulk && (byteoff == 0) && (byteCount >= (BULK_MIN_SECS * BPS)))
+		{
+			int count = bulkRead(biosdev, blkno, (byteCount / BPS), cbuf);
+
+			if (count < 0)
+			{
+				_DISK_DEBUG_DUMP(("error\n"));
+
+				return (-1);
+			}
+			else if (count > 0)
+			{
+				copy_len = (count * BPS);
+				byteCount -= copy_len;
+				blkno += (count - 1);
+				continue;
+			}
+
+			bulk = false; // Not supported for this device.
+		}
+
 		error = Biosread(biosdev, blkno);
 
 		if (error)
@@ -450,6 +1061,11 @@ static BVRef initNewBVRef(int biosdev, int partno, unsigned int blkoff)
 		bvr->fs_loadfile		= HFSLoadFile;
 		bvr->fs_readfile		= HFSReadFile;
 		bvr->fs_getdirentry		= HFSGetDirEntry;
+		bvr->fs_opendir			= HFSOpenDir;
+		bvr->fs_readdir			= HFSReadDir;
+		bvr->fs_closedir		= HFSCloseDir;
+		bvr->fs_prefetchdir		= HFSPrefetchDir;
+		bvr->fs_getfilesize		= HFSGetFileSize;
 		bvr->fs_getfileblock	= HFSGetFileBlock;
 		bvr->fs_getuuid			= HFSGetUUID;
 		bvr->description		= HFSGetDescription;
@@ -512,6 +1128,8 @@ BVRef diskScanGPTBootVolumes(int biosdev, int * countPtr)
 
 	void *buffer = malloc(BPS);
 
+	IO_TRACE_SUBSYSTEM(kIOTraceGPT);
+
 	if (readBytes(biosdev, 1, 0, BPS, buffer) == 0)
 	{
 		int gptID = 1;
@@ -549,6 +1167,8 @@ BVRef diskScanGPTBootVolumes(int biosdev, int * countPtr)
 
 							buffer = malloc(bufferSize); // Allocate a buffer.
 
+							IO_TRACE_SUBSYSTEM(kIOTraceGPT);
+
 							if (readBytes(biosdev, gptBlock, 0, bufferSize, buffer) == 0)
 							{
 								// Allocate a new map for this device and insert it into the chain.
@@ -590,6 +1210,8 @@ BVRef diskScanGPTBootVolumes(int biosdev, int * countPtr)
 											
 											bool probeOK = false;
 											
+											IO_TRACE_SUBSYSTEM(kIOTraceGPT);
+
 											// Read the first 4 sectors.
 											if (readBytes(biosdev, gptMap->ent_lba_start, 0, 2048, (void *)probeBuffer) == 0)
 											{
@@ -822,6 +1444,8 @@ int readBootSector(int biosdev, unsigned int secno, void * buffer)
 		bootSector = gBootSector;
 	}
 
+	IO_TRACE_SUBSYSTEM(kIOTraceGPT);
+
 	error = readBytes(biosdev, secno, 0, BPS, bootSector);
 
 	if (error || bootSector->signature != DISK_SIGNATURE)
@@ -419,6 +419,17 @@ bool initMultiProcessorTableAdress(void)
 
 void finalizeEFITree(void)
 {
+#if IO_TRACE_SUPPORT
+	uint32_t traceSize = 0;
+	void * trace = diskGetIOTrace(&traceSize);
+
+	if (trace)
+	{
+		// Decoded with: libsaio/tools/iotrace.c
+		DT__AddProperty(gPlatform.EFI.Nodes.Platform, "boot-io-trace", traceSize, trace);
+	}
+#endif
+
 	_EFI_DEBUG_DUMP("Calling setupEFITables(");
 
 	setupEFITables();
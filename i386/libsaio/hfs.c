@@ -31,6 +31,12 @@
 #include <hfs/hfs_format.h>
 
 #include "hfs.h"
+#include "iotrace.h"
+
+#if DEBUG_DISK
+	#include "platform.h"
+	#include "cpu/proc_reg.h"
+#endif
 
 #define kBlockSize (0x200)
 
@@ -38,6 +44,117 @@
 
 #define kBTreeCatalog (0)
 #define kBTreeExtents (1)
+#define kBTreeAttributes (2)
+
+#define kDataForkType (0)
+#define kResourceForkType (0xFF)
+
+// B-tree node cache (see GetBTreeNode). Index nodes have their own pool, so that
+// the nodes near the root stay resident no matter how many leaves are visited.
+#define kBTNodeCacheIndexNodes (64)
+#define kBTNodeCacheLeafNodes  (32)
+#define kBTNodeMaxNesting      (2)    // Catalog/attributes node read -> extents node read.
+
+// Path component (dentry) cache (see ReadCatalogEntry). Maps (ih, parent ID,
+// name) to a copy of the catalog record, or to 'not found'.
+#define kDentryCacheEntries    (512)
+#define kDentryHashSize        (256)
+#define kDentryMaxName         (64)        // Longer names are not cached.
+#define kDentryRecordSize      (sizeof(HFSPlusCatalogFile)) // Largest cached record (thread records are not cached).
+
+typedef struct Dentry
+{
+    CICell            ih;           // 0 when unused.
+    long              parentID;
+    long              stamp;        // Volume write count / modify date when cached.
+    long              result;       // -1 for a negative entry.
+    long              dirIndex;
+    short             next;         // Hash chain.
+    short             bucket;
+    bool              folded;       // ASCII case ignored (case-insensitive volumes).
+    char              name[kDentryMaxName];
+    char              record[kDentryRecordSize];
+} Dentry;
+
+// Resolved extent maps (see GetExtentMap), so that reading a fragmented file in
+// chunks doesn't walk its extent records (and the overflow file) over and over.
+#define kExtentMapCacheSize    (16)
+
+// Largest catalog prefetch read (see HFSPrefetchDir). Keeps it well within the
+// block cache budget.
+#define kPrefetchMaxSize       (0x40000)
+
+// Largest attribute record copied by ReadBTreeEntry (the record header and inline data).
+#define kAttrRecordMaxSize     (4096)
+
+#if HFS_COMPRESSION_SUPPORT
+// Transparent compression (see ReadCompressedFile). The data lives in the decmpfs
+// attribute (small files) or in the resource fork, as 64 KB chunks.
+#ifndef UF_COMPRESSED
+	#define UF_COMPRESSED      (0x20)
+#endif
+
+#define kDecmpfsAttrName       "com.apple.decmpfs"
+#define kDecmpfsMagic          (0x636D7066) // 'cmpf'
+#define kDecmpfsChunkSize      (0x10000)
+
+enum
+{
+    kDecmpfsTypeRaw            = 1,         // Uncompressed data in the attribute.
+    kDecmpfsTypeZlibAttr       = 3,
+    kDecmpfsTypeZlibRsrc       = 4,
+    kDecmpfsTypeLZVNAttr       = 7,
+    kDecmpfsTypeLZVNRsrc       = 8
+};
+
+typedef struct DecmpfsHeader                // Little endian.
+{
+    u_int32_t         magic;
+    u_int32_t         type;
+    u_int64_t         size;         // Uncompressed size.
+} DecmpfsHeader;
+#endif
+
+typedef struct ExtentMapping
+{
+    u_int32_t         logical;      // First file block.
+    u_int32_t         physical;     // First allocation block.
+    u_int32_t         count;
+} ExtentMapping;
+
+typedef struct ExtentMap
+{
+    CICell            ih;           // 0 when unused.
+    long              fileID;
+    long              stamp;        // Volume stamp (see gVolumeStamp).
+    u_int32_t         firstStart;   // First extent (tells forks apart).
+    u_int32_t         firstCount;
+    long              forkType;     // kDataForkType or kResourceForkType (overflow extents).
+    long              time;         // Last use (LRU).
+    long              count;
+    ExtentMapping     *extents;     // Sorted by logical block.
+} ExtentMap;
+
+typedef struct BTreeNode
+{
+    CICell            ih;           // 0 when unused.
+    long              btree;
+    long              number;
+    long              time;         // Last use (LRU within each pool).
+    long              nodeSize;
+    BTNodeDescriptor  *node;        // Node data, followed by the record offsets.
+    u_int16_t         *offsets;     // Record offsets (byte swapped).
+    long              numRecords;
+} BTreeNode;
+
+typedef struct HFSDirIterator
+{
+    BTreeNode         leaf;         // Private copy of the current leaf node.
+    long              nextNode;     // Leaf node to fetch on the next call (0 when 'leaf' is current).
+    long              index;        // Next record in the leaf node.
+    bool              done;
+    char              name[256];
+} HFSDirIterator;
 
 #ifdef __i386__
 
@@ -48,7 +165,7 @@ static long                    gCaseSensitive;
 static long                    gBlockSize;
 static long                    gCacheBlockSize;
 static char                    *gBTreeHeaderBuffer;
-static BTHeaderRec             *gBTHeaders[2];
+static BTHeaderRec             *gBTHeaders[3];
 static char                    *gHFSMdbVib;
 static HFSMasterDirectoryBlock *gHFSMDB;
 static char                    *gHFSPlusHeader;
@@ -65,8 +182,8 @@ static long                    gIsHFSPlus;
 static long                    gBlockSize;
 static long                    gCaseSensitive;
 static long                    gCacheBlockSize;
-static char                    gBTreeHeaderBuffer[512];
-static BTHeaderRec             *gBTHeaders[2];
+static char                    gBTreeHeaderBuffer[768];
+static BTHeaderRec             *gBTHeaders[3];
 static char                    gHFSMdbVib[kBlockSize];
 static HFSMasterDirectoryBlock *gHFSMDB =(HFSMasterDirectoryBlock*)gHFSMdbVib;
 static char                    gHFSPlusHeader[kBlockSize];
@@ -76,26 +193,64 @@ static long long               gVolID;
 
 #endif /* !__i386__ */
 
+static BTreeNode               gBTNodeCache[kBTNodeCacheIndexNodes + kBTNodeCacheLeafNodes];
+static BTreeNode               *gBTNodeScratch;   // Spare buffers, swapped with the victim on a miss.
+static long                    gBTNodeNesting;    // GetBTreeNode() calls reading a node (see there).
+static long                    gBTNodeCacheTime;
+
+static ExtentMap               gExtentMaps[kExtentMapCacheSize];
+static long                    gExtentMapTime;
+
+static Dentry                  *gDentries;
+static short                   *gDentryHash;
+static long                    gDentryNext;       // Next entry to recycle (round robin).
+static long                    gVolumeStamp;
+
+#if CACHE_STATS
+unsigned long                  gBTNodeHits;
+unsigned long                  gBTNodeMisses;
+unsigned long                  gDentryHits;
+unsigned long                  gDentryMisses;
+unsigned long                  gExtentMapHits;
+unsigned long                  gExtentMapMisses;
+unsigned long                  gKeyCompares;
+unsigned long                  gPrefetchedNodes;
+#endif
+
 static long ReadFile(void *file, uint64_t *length, void *base, uint64_t offset);
+static long GetFileLength(void *file, uint64_t *length);
 static long GetCatalogEntryInfo(void *entry, long *flags, long *time, FinderInfo *finderInfo, long *infoValid);
 static long ResolvePathToCatalogEntry(char *filePath, long *flags, void *entry, long dirID, long *dirIndex);
 
 static long GetCatalogEntry(long *dirIndex, char **name, long *flags, long *time, FinderInfo *finderInfo, long *infoValid);
+static long ResolveDirIndex(char *dirPath, long *dirIndex);
+static long PrefetchCatalogNodes(long firstNode, long count, char *buffer);
 static long ReadCatalogEntry(char *fileName, long dirID, void *entry, long *dirIndex);
-static long ReadExtentsEntry(long fileID, long startBlock, void *entry);
+static Dentry * LookupDentry(char *fileName, long dirID, long *bucket);
+static void InvalidateDentries(CICell ih);
+static long ReadExtentsEntry(long fileID, long forkType, long startBlock, void *entry);
+#if HFS_COMPRESSION_SUPPORT
+static long ReadAttribute(long fileID, char *attrName, char *buffer);
+static long ReadCompressedFile(void *file, uint64_t *length, void *base, uint64_t offset);
+static long DecompressChunk(long type, u_int8_t *src, u_int32_t srcSize, u_int8_t *dst, u_int32_t dstSize);
+#endif
 
 static long ReadBTreeEntry(long btree, void *key, char *entry, long *dirIndex);
-static void GetBTreeRecord(long index, char *nodeBuffer, long nodeSize, char **key, char **data);
+static BTreeNode * GetBTreeNode(long btree, long number, void *extent, uint64_t extentSize, long extentFile, long nodeSize);
+static void GetBTreeRecord(long index, BTreeNode *node, char **key, char **data);
 
 static long ReadExtent(char *extent, uint64_t extentSize, long extentFile, uint64_t offset, uint64_t size, void *buffer, long cache);
+static long ReadForkExtent(char *extent, uint64_t extentSize, long extentFile, long forkType, uint64_t offset, uint64_t size, void *buffer, long cache);
+static ExtentMap * GetExtentMap(char *extent, uint64_t extentSize, long extentFile, long forkType);
 
 static long GetExtentStart(void *extents, long index);
 static long GetExtentSize(void *extents, long index);
 
 static long CompareHFSCatalogKeys(void *key, void *testKey);
-static long CompareHFSPlusCatalogKeys(void *key, void *testKey);
+static long CompareHFSPlusCatalogKeys(void *key, void *testKey, u_int16_t *foldedName, u_int32_t foldedLength);
 static long CompareHFSExtentsKeys(void *key, void *testKey);
 static long CompareHFSPlusExtentsKeys(void *key, void *testKey);
+static long CompareHFSPlusAttrKeys(void *key, void *testKey);
 
 extern long FastRelString(u_int8_t *str1, u_int8_t *str2);
 extern long BinaryUnicodeCompare(u_int16_t *uniStr1, u_int32_t len1, u_int16_t *uniStr2, u_int32_t len2);
@@ -145,9 +300,6 @@ bool HFSProbe (const void *buf)
 
 long HFSInitPartition(CICell ih)
 {
-    long extentSize, extentFile, nodeSize;
-    void *extent;
-
     if (ih == gCurrentIH)
 	{
 #ifdef __i386__
@@ -164,7 +316,7 @@ long HFSInitPartition(CICell ih)
 		gLinkTemp = (char *)malloc(64);
 
     if (!gBTreeHeaderBuffer)
-		gBTreeHeaderBuffer = (char *)malloc(512);
+		gBTreeHeaderBuffer = (char *)malloc(768);
 
     if (!gHFSMdbVib)
 	{
@@ -186,6 +338,9 @@ long HFSInitPartition(CICell ih)
     gCaseSensitive = 0;
     gBTHeaders[0] = 0;
     gBTHeaders[1] = 0;
+    gBTHeaders[2] = 0;
+
+    IO_TRACE_SUBSYSTEM(kIOTraceHFSMetadata);
 
     // Look for the HFS MDB
     Seek(ih, kMDBBaseOffset);
@@ -199,6 +354,7 @@ long HFSInitPartition(CICell ih)
         if (SWAP_BE16(gHFSMDB->drEmbedSigWord) != kHFSPlusSigWord)
 		{
             // Normal HFS;
+            // The cache stores allocation blocks (B-tree nodes larger than that span several entries).
             gCacheBlockSize = gBlockSize = SWAP_BE32(gHFSMDB->drAlBlkSiz);
             CacheInit(ih, gCacheBlockSize);
             gCurrentIH = ih;
@@ -206,21 +362,8 @@ long HFSInitPartition(CICell ih)
             // grab the 64 bit volume ID
             bcopy(&gHFSMDB->drFndrInfo[6], &gVolID, 8);
 
-            // Get the Catalog BTree node size.
-            extent     = (HFSExtentDescriptor *)&gHFSMDB->drCTExtRec;
-            extentSize = SWAP_BE32(gHFSMDB->drCTFlSize);
-            extentFile = kHFSCatalogFileID;
-            ReadExtent(extent, extentSize, extentFile, 0, 256, gBTreeHeaderBuffer + kBTreeCatalog * 256, 0);
-
-            nodeSize = SWAP_BE16(((BTHeaderRec *)(gBTreeHeaderBuffer + kBTreeCatalog * 256 + 
-                                 sizeof(BTNodeDescriptor)))->nodeSize);
-
-            // If the BTree node size is larger than the block size, reset the cache.
-            if (nodeSize > gBlockSize)
-			{
-                gCacheBlockSize = nodeSize;
-                CacheInit(ih, gCacheBlockSize);
-            }
+            gVolumeStamp = SWAP_BE32(gHFSMDB->drWrCnt) ^ SWAP_BE32(gHFSMDB->drLsMod);
+            InvalidateDentries(ih);
 
             return 0;
         }
@@ -243,6 +386,8 @@ long HFSInitPartition(CICell ih)
     }
 
     gIsHFSPlus = 1;
+
+    // The cache stores allocation blocks (B-tree nodes larger than that span several entries).
     gCacheBlockSize = gBlockSize = SWAP_BE32(gHFSPlus->blockSize);
     CacheInit(ih, gCacheBlockSize);
     gCurrentIH = ih;
@@ -252,23 +397,8 @@ long HFSInitPartition(CICell ih)
     // grab the 64 bit volume ID
     bcopy(&gHFSPlus->finderInfo[24], &gVolID, 8);
 
-    // Get the Catalog BTree node size.
-    extent     = &gHFSPlus->catalogFile.extents;
-    extentSize = SWAP_BE64(gHFSPlus->catalogFile.logicalSize);
-    extentFile = kHFSCatalogFileID;
-
-    ReadExtent(extent, extentSize, extentFile, 0, 256,
-               gBTreeHeaderBuffer + kBTreeCatalog * 256, 0);
-
-    nodeSize = SWAP_BE16(((BTHeaderRec *)(gBTreeHeaderBuffer + kBTreeCatalog * 256 +
-                         sizeof(BTNodeDescriptor)))->nodeSize);
-
-    // If the BTree node size is larger than the block size, reset the cache.
-    if (nodeSize > gBlockSize)
-	{
-        gCacheBlockSize = nodeSize;
-        CacheInit(ih, gCacheBlockSize);
-    }
+    gVolumeStamp = SWAP_BE32(gHFSPlus->writeCount) ^ SWAP_BE32(gHFSPlus->modifyDate);
+    InvalidateDentries(ih);
 
     return 0;
 }
@@ -288,6 +418,9 @@ long HFSReadFile(CICell ih, char * filePath, void *base, uint64_t offset, uint64
 {
     char entry[512];
     long dirID, result, flags;
+#if DEBUG_DISK
+	uint64_t loadStart = rdtsc64();
+#endif
 	// bool thinFatReadRequest = (length == 4096 && offset == 0);
 
     if (HFSInitPartition(ih) == -1)
@@ -354,6 +487,17 @@ long HFSReadFile(CICell ih, char * filePath, void *base, uint64_t offset, uint64
 		return 0; // Zero prevents ThinFatFile() from calling us again.
 	} */
 
+#if DEBUG_DISK
+	// Load throughput of large files (mach_kernel, kernelcache).
+	if ((length >= 0x100000) && gPlatform.CPU.TSCFrequency)
+	{
+		uint32_t ms = (uint32_t)(((rdtsc64() - loadStart) * 1000) / gPlatform.CPU.TSCFrequency);
+
+		_DISK_DEBUG_DUMP("Loaded [%s] %d KB in %d ms (%d KB/s).\n", filePath, (uint32_t)(length >> 10), ms,
+						 ms ? (uint32_t)((length >> 10) * 1000 / ms) : 0);
+	}
+#endif
+
 #if CHAMELEON
     verbose("Loaded HFS%s file: [%s] %d bytes from %x.\n", (gIsHFSPlus ? "+" : ""), filePath, (uint32_t)length, ih);
 #elif DEBUG
@@ -364,6 +508,53 @@ long HFSReadFile(CICell ih, char * filePath, void *base, uint64_t offset, uint64
 }
 
 
+//==============================================================================
+
+long HFSGetFileSize(CICell ih, char * filePath, uint64_t * size)
+{
+	char entry[512];
+	long dirID, result, flags;
+
+	if (HFSInitPartition(ih) == -1)
+	{
+		return -1;
+	}
+
+	dirID = kHFSRootFolderID;
+	// Skip a lead '\'.  Start in the system folder if there are two.
+	if (filePath[0] == '/')
+	{
+		if (filePath[1] == '/')
+		{
+			if (gIsHFSPlus)
+			{
+				dirID = SWAP_BE32(((long *)gHFSPlus->finderInfo)[5]);
+			}
+			else
+			{
+				dirID = SWAP_BE32(gHFSMDB->drFndrInfo[5]);
+			}
+
+			if (dirID == 0)
+			{
+				return -1;
+			}
+			filePath++;
+		}
+		filePath++;
+	}
+
+	result = ResolvePathToCatalogEntry(filePath, &flags, entry, dirID, 0);
+
+	if ((result == -1) || ((flags & kFileTypeMask) != kFileTypeFlat))
+	{
+		return -1;
+	}
+
+	return GetFileLength(entry, size);
+}
+
+
 //==============================================================================
 
 long HFSGetDirEntry(CICell ih, char * dirPath, long * dirIndex, char ** name, long * flags, long * time, FinderInfo * finderInfo, long * infoValid)
@@ -440,6 +631,258 @@ long HFSGetDirEntry(CICell ih, char * dirPath, long * dirIndex, char ** name, lo
 }
 
 
+//==============================================================================
+// Directory iterator. Keeps a private copy of the current catalog leaf node, so
+// that walking a directory costs one node lookup per leaf (not per entry).
+
+void * HFSOpenDir(CICell ih, char * dirPath)
+{
+	long			dirIndex, nodeSize;
+	HFSDirIterator	*dir;
+
+	if ((HFSInitPartition(ih) == -1) || (ResolveDirIndex(dirPath, &dirIndex) == -1))
+	{
+		return 0;
+	}
+
+	nodeSize = SWAP_BE16(gBTHeaders[kBTreeCatalog]->nodeSize);
+
+	if ((dir = (HFSDirIterator *)malloc(sizeof(HFSDirIterator))) == 0)
+	{
+		return 0;
+	}
+
+	bzero(dir, sizeof(HFSDirIterator));
+
+	if ((dir->leaf.node = (BTNodeDescriptor *)malloc(nodeSize * 2)) == 0)
+	{
+		free(dir);
+		return 0;
+	}
+
+	dir->leaf.nodeSize	= nodeSize;
+	dir->leaf.offsets	= (u_int16_t *)((char *)dir->leaf.node + nodeSize);
+	dir->nextNode		= dirIndex / nodeSize;
+	dir->index			= dirIndex % nodeSize;
+	dir->done			= (dirIndex == 0);	// Thread record was the last one of the catalog.
+
+	return dir;
+}
+
+
+//==============================================================================
+
+long HFSReadDir(CICell ih, void * iterator, DirEntry * entry)
+{
+	long			extentSize;
+	void			*extent;
+	char			*key, *record;
+	BTreeNode		*node;
+	HFSDirIterator	*dir = iterator;
+
+	if (dir->done || (HFSInitPartition(ih) == -1))
+	{
+		return -1;
+	}
+
+	// Fetch the next leaf node (when the last one is used up).
+	if (dir->nextNode)
+	{
+		if (gIsHFSPlus)
+		{
+			extent     = &gHFSPlus->catalogFile.extents;
+			extentSize = SWAP_BE64(gHFSPlus->catalogFile.logicalSize);
+		}
+		else
+		{
+			extent     = (HFSExtentDescriptor *)&gHFSMDB->drCTExtRec;
+			extentSize = SWAP_BE32(gHFSMDB->drCTFlSize);
+		}
+
+		if ((node = GetBTreeNode(kBTreeCatalog, dir->nextNode, extent, extentSize, kHFSCatalogFileID, dir->leaf.nodeSize)) == 0)
+		{
+			dir->done = true;
+			return -1;
+		}
+
+		bcopy(node->node, dir->leaf.node, dir->leaf.nodeSize + (node->numRecords * sizeof(u_int16_t)));
+
+		dir->leaf.numRecords	= node->numRecords;
+		dir->leaf.number		= dir->nextNode;
+		dir->nextNode			= 0;
+	}
+
+	GetBTreeRecord(dir->index, &dir->leaf, &key, &record);
+	GetCatalogEntryInfo(record, &entry->flags, &entry->time, &entry->finderInfo, &entry->infoValid);
+
+	// The thread record of the next directory (or file) ends this one.
+	if ((entry->flags & kFileTypeMask) == kFileTypeUnknown)
+	{
+		dir->done = true;
+		return -1;
+	}
+
+	// Get the file name.
+	if (gIsHFSPlus)
+	{
+		utf_encodestr(((HFSPlusCatalogKey *)key)->nodeName.unicode,
+					  SWAP_BE16(((HFSPlusCatalogKey *)key)->nodeName.length),
+					  (u_int8_t *)dir->name, sizeof(dir->name), OSBigEndian);
+	}
+	else
+	{
+		strncpy(dir->name, (const char *)&((HFSCatalogKey *)key)->nodeName[1], ((HFSCatalogKey *)key)->nodeName[0]);
+
+		dir->name[((HFSCatalogKey *)key)->nodeName[0]] = '\0';
+	}
+
+	entry->name		= dir->name;
+	entry->record	= record;
+
+	// Advance (to the first record of the next leaf node at the end of this one).
+	if (++dir->index >= dir->leaf.numRecords)
+	{
+		dir->index		= 0;
+		dir->nextNode	= SWAP_BE32(dir->leaf.node->fLink);
+		dir->done		= (dir->nextNode == 0);
+	}
+
+	return 0;
+}
+
+
+//==============================================================================
+// Reads the catalog leaf nodes with the entries of a directory ahead of a walk, in
+// large sequential reads (through the block cache). Then, when they fit in one such
+// read, the leaf nodes with the thread records of its subfolders (for lookups in
+// them, like .kext/Contents).
+
+long HFSPrefetchDir(CICell ih, char * dirPath)
+{
+	char		*buffer, *key, *record, entry[512];
+	void		*extent;
+	uint64_t	extentSize;
+	long		dirIndex, nodeSize, totalNodes, maxNodes, curNode, index, visited = 0;
+	long		prefetchStart = 0, prefetchEnd = 0, firstNode, lastNode;
+	u_int32_t	folderID, minID = 0, maxID = 0;
+	BTreeNode	*node;
+
+	if ((HFSInitPartition(ih) == -1) || (ResolveDirIndex(dirPath, &dirIndex) == -1))
+	{
+		return -1;
+	}
+
+	if (gIsHFSPlus)
+	{
+		extent     = &gHFSPlus->catalogFile.extents;
+		extentSize = SWAP_BE64(gHFSPlus->catalogFile.logicalSize);
+	}
+	else
+	{
+		extent     = (HFSExtentDescriptor *)&gHFSMDB->drCTExtRec;
+		extentSize = SWAP_BE32(gHFSMDB->drCTFlSize);
+	}
+
+	nodeSize	= SWAP_BE16(gBTHeaders[kBTreeCatalog]->nodeSize);
+	totalNodes	= SWAP_BE32(gBTHeaders[kBTreeCatalog]->totalNodes);
+	maxNodes	= kPrefetchMaxSize / nodeSize;
+	curNode		= dirIndex / nodeSize;
+	index		= dirIndex % nodeSize;
+
+	if ((buffer = malloc(maxNodes * nodeSize)) == 0)
+	{
+		return -1;
+	}
+
+	// Follow the leaf nodes (fLink) up to the thread record that ends the directory.
+	while (curNode && (visited++ < totalNodes))
+	{
+		if ((curNode < prefetchStart) || (curNode >= prefetchEnd))
+		{
+			prefetchStart = curNode;
+			prefetchEnd = curNode + PrefetchCatalogNodes(curNode, maxNodes, buffer);
+		}
+
+		if ((node = GetBTreeNode(kBTreeCatalog, curNode, extent, extentSize, kHFSCatalogFileID, nodeSize)) == 0)
+		{
+			break;
+		}
+
+		for (; index < node->numRecords; index++)
+		{
+			GetBTreeRecord(index, node, &key, &record);
+
+			switch (SWAP_BE16(*(short *)record))
+			{
+				case kHFSPlusFolderRecord:
+				case kHFSFolderRecord:
+					folderID = (gIsHFSPlus) ? SWAP_BE32(((HFSPlusCatalogFolder *)record)->folderID) :
+											  SWAP_BE32(((HFSCatalogFolder *)record)->folderID);
+
+					if ((minID == 0) || (folderID < minID))
+					{
+						minID = folderID;
+					}
+
+					if (folderID > maxID)
+					{
+						maxID = folderID;
+					}
+					break;
+
+				case kHFSFileThreadRecord:
+				case kHFSPlusFileThreadRecord:
+				case kHFSFolderThreadRecord:
+				case kHFSPlusFolderThreadRecord:
+					curNode = 0;	// End of the directory.
+					break;
+			}
+
+			if (curNode == 0)
+			{
+				break;
+			}
+		}
+
+		if (curNode)
+		{
+			index = 0;
+			curNode = SWAP_BE32(node->node->fLink);
+		}
+	}
+
+	// The thread records of the subfolders are ordered by folder ID.
+	if (minID && (ReadCatalogEntry("", minID, entry, &firstNode) == 0) && (ReadCatalogEntry("", maxID, entry, &lastNode) == 0))
+	{
+		firstNode /= nodeSize;
+		lastNode /= nodeSize;
+
+		if (firstNode && (lastNode >= firstNode) && ((lastNode - firstNode) < maxNodes))
+		{
+			PrefetchCatalogNodes(firstNode, lastNode - firstNode + 1, buffer);
+		}
+	}
+
+	free(buffer);
+
+	return 0;
+}
+
+
+//==============================================================================
+
+void HFSCloseDir(CICell ih, void * iterator)
+{
+	HFSDirIterator *dir = iterator;
+
+	if (dir)
+	{
+		free(dir->leaf.node);
+		free(dir);
+	}
+}
+
+
 //==============================================================================
 
 void HFSGetDescription(CICell ih, char *str, long strMaxLen)
@@ -535,6 +978,19 @@ long HFSGetFileBlock(CICell ih, char *filePath, unsigned long long *firstBlock)
 }
 
 
+#if CACHE_STATS
+//==============================================================================
+
+void HFSPrintStats(void)
+{
+	printf("B-tree node cache: %d hits, %d misses\n", gBTNodeHits, gBTNodeMisses);
+	printf("Dentry cache: %d hits, %d misses\n", gDentryHits, gDentryMisses);
+	printf("Extent maps: %d hits, %d misses\n", gExtentMapHits, gExtentMapMisses);
+	printf("Catalog key compares: %d, nodes prefetched: %d\n", gKeyCompares, gPrefetchedNodes);
+}
+#endif
+
+
 //==============================================================================
 
 long HFSGetUUID(CICell ih, char *uuidStr)
@@ -562,6 +1018,13 @@ static long ReadFile(void * file, uint64_t * length, void * base, uint64_t offse
 
     if (gIsHFSPlus)
 	{
+#if HFS_COMPRESSION_SUPPORT
+        // Transparently compressed (decmpfs) file? Then the data fork is empty.
+        if (hfsPlusFile->bsdInfo.ownerFlags & UF_COMPRESSED)
+		{
+            return ReadCompressedFile(file, length, base, offset);
+		}
+#endif
         fileID  = SWAP_BE32(hfsPlusFile->fileID);
         fileLength = (uint64_t)SWAP_BE64(hfsPlusFile->dataFork.logicalSize);
         extents = &hfsPlusFile->dataFork.extents;
@@ -596,35 +1059,359 @@ static long ReadFile(void * file, uint64_t * length, void * base, uint64_t offse
 
 
 //==============================================================================
+// Returns the logical size of a file (for a compressed file the size from its
+// decmpfs header, which is what ReadFile returns).
 
-static long GetCatalogEntryInfo(void * entry, long * flags, long * time, FinderInfo * finderInfo, long * infoValid)
+static long GetFileLength(void * file, uint64_t * length)
 {
-    long tmpTime = 0;
-    long valid = 0;
+	HFSCatalogFile		*hfsFile = file;
+	HFSPlusCatalogFile	*hfsPlusFile = file;
 
-    // Get information about the file.
-    
-    switch (SWAP_BE16(*(short *)entry))
-    {
-        case kHFSFolderRecord           :
-            *flags = kFileTypeDirectory;
-            tmpTime = SWAP_BE32(((HFSCatalogFolder *)entry)->modifyDate);
-            break;
+	if (gIsHFSPlus)
+	{
+#if HFS_COMPRESSION_SUPPORT
+		if (hfsPlusFile->bsdInfo.ownerFlags & UF_COMPRESSED)
+		{
+			DecmpfsHeader	*header;
+			char			*record;
+			long			attrSize, result = -1;
 
-        case kHFSPlusFolderRecord       :
-            *flags = kFileTypeDirectory |
-                     (SWAP_BE16(((HFSPlusCatalogFolder *)entry)->bsdInfo.fileMode) & kPermMask);
-            if (SWAP_BE32(((HFSPlusCatalogFolder *)entry)->bsdInfo.ownerID) != 0)
-                *flags |= kOwnerNotRoot;
-            tmpTime = SWAP_BE32(((HFSPlusCatalogFolder *)entry)->contentModDate);
-            break;
+			if ((record = (char *)malloc(kAttrRecordMaxSize)) == 0)
+			{
+				return -1;
+			}
 
-        case kHFSFileRecord             :
-            *flags = kFileTypeFlat;
-            tmpTime = SWAP_BE32(((HFSCatalogFile *)entry)->modifyDate);
-            if (finderInfo) {
-                SwapFinderInfo((FndrFileInfo *)finderInfo, &((HFSCatalogFile *)entry)->userInfo);
-                valid = 1;
+			attrSize = ReadAttribute(SWAP_BE32(hfsPlusFile->fileID), kDecmpfsAttrName, record);
+			header = (DecmpfsHeader *)(record + 16);
+
+			if ((attrSize >= (long)sizeof(DecmpfsHeader)) && (SWAP_LE32(header->magic) == kDecmpfsMagic))
+			{
+				*length = SWAP_LE64(header->size);
+				result = 0;
+			}
+
+			free(record);
+
+			return result;
+		}
+#endif
+		*length = SWAP_BE64(hfsPlusFile->dataFork.logicalSize);
+	}
+	else
+	{
+		*length = SWAP_BE32(hfsFile->dataLogicalSize);
+	}
+
+	return 0;
+}
+
+
+#if HFS_COMPRESSION_SUPPORT
+//==============================================================================
+// Reads (a part of) a transparently compressed file. Chunks that lie entirely in
+// the requested range are decompressed straight into the caller's buffer, so only
+// the first and last chunk go through the scratch buffer.
+
+static long ReadCompressedFile(void * file, uint64_t * length, void * base, uint64_t offset)
+{
+	HFSPlusCatalogFile	*hfsPlusFile = file;
+	HFSPlusForkData		*fork = &hfsPlusFile->resourceFork;
+	DecmpfsHeader		*header;
+	char				*record;
+	u_int8_t			*data, *src, *dst, *chunk = 0, *scratch = 0;
+	u_int32_t			*table = 0, rsrcHeader[2];
+	u_int32_t			type, dataSize, numChunks, index, chunkSize, srcSize, maxSrcSize = 0;
+	uint64_t			fileLength, rsrcLength = 0, unitSize, chunkStart, start, end, srcOffset = 0, tableOffset = 0;
+	long				fileID = SWAP_BE32(hfsPlusFile->fileID);
+	long				attrSize, result = -1;
+
+	if ((record = (char *)malloc(kAttrRecordMaxSize)) == 0)
+	{
+		return -1;
+	}
+
+	attrSize = ReadAttribute(fileID, kDecmpfsAttrName, record);
+	header = (DecmpfsHeader *)(record + 16);
+
+	if ((attrSize < (long)sizeof(DecmpfsHeader)) || (SWAP_LE32(header->magic) != kDecmpfsMagic))
+	{
+		printf("Compressed file without a decmpfs header.\n");
+		goto out;
+	}
+
+	type		= SWAP_LE32(header->type);
+	fileLength	= SWAP_LE64(header->size);
+	data		= (u_int8_t *)(header + 1);
+	dataSize	= attrSize - sizeof(DecmpfsHeader);
+
+	if (offset > fileLength)
+	{
+		printf("Offset is too large.\n");
+		goto out;
+	}
+
+	if ((*length == 0) || ((offset + *length) > fileLength))
+	{
+		*length = fileLength - offset;
+	}
+
+	if (*length == 0)
+	{
+		result = 0;
+		goto out;
+	}
+
+	switch (type)
+	{
+		case kDecmpfsTypeRaw:
+			if (fileLength > dataSize)
+			{
+				goto out;
+			}
+
+			bcopy(data + offset, base, *length);
+			result = 0;
+			goto out;
+
+		case kDecmpfsTypeZlibAttr:
+		case kDecmpfsTypeLZVNAttr:
+			// A single chunk (of any size) in the attribute.
+			unitSize = fileLength;
+			break;
+
+		case kDecmpfsTypeZlibRsrc:
+		case kDecmpfsTypeLZVNRsrc:
+			unitSize	= kDecmpfsChunkSize;
+			rsrcLength	= SWAP_BE64(fork->logicalSize);
+			numChunks	= (fileLength + kDecmpfsChunkSize - 1) / kDecmpfsChunkSize;
+
+			// Chunk table. zlib: a resource (length, count, then offset/size pairs
+			// relative to the length field). LZVN: numChunks + 1 offsets at the start.
+			if ((table = (u_int32_t *)malloc((numChunks + 1) * 8)) == 0)
+			{
+				goto out;
+			}
+
+			if (type == kDecmpfsTypeZlibRsrc)
+			{
+				if (ReadForkExtent((char *)&fork->extents, rsrcLength, fileID, kResourceForkType, 0, 4, rsrcHeader, 0) != 4)
+				{
+					goto out;
+				}
+
+				tableOffset = SWAP_BE32(rsrcHeader[0]) + 4;
+
+				if ((ReadForkExtent((char *)&fork->extents, rsrcLength, fileID, kResourceForkType, tableOffset - 4, 8, rsrcHeader, 0) != 8) ||
+					(SWAP_LE32(rsrcHeader[1]) != numChunks) ||
+					(ReadForkExtent((char *)&fork->extents, rsrcLength, fileID, kResourceForkType, tableOffset + 4, numChunks * 8, table, 0) != (numChunks * 8)))
+				{
+					goto out;
+				}
+
+				for (index = 0; index < numChunks; index++)
+				{
+					table[index * 2]		= SWAP_LE32(table[index * 2]);
+					table[index * 2 + 1]	= SWAP_LE32(table[index * 2 + 1]);
+				}
+			}
+			else
+			{
+				if (ReadForkExtent((char *)&fork->extents, rsrcLength, fileID, kResourceForkType, 0, (numChunks + 1) * 4, table, 0) != ((numChunks + 1) * 4))
+				{
+					goto out;
+				}
+
+				// Convert to offset/size pairs (back to front, the pairs overlap the offsets).
+				for (index = numChunks; index-- > 0; )
+				{
+					srcOffset				= SWAP_LE32(table[index]);
+					srcSize					= SWAP_LE32(table[index + 1]) - srcOffset;
+					table[index * 2]		= srcOffset;
+					table[index * 2 + 1]	= srcSize;
+				}
+			}
+
+			// Validate the table (and find the largest chunk).
+			for (index = 0; index < numChunks; index++)
+			{
+				srcOffset	= tableOffset + table[index * 2];
+				srcSize		= table[index * 2 + 1];
+
+				if ((srcSize == 0) || (srcSize > (kDecmpfsChunkSize * 2)) || ((srcOffset + srcSize) > rsrcLength))
+				{
+					printf("Damaged chunk table in compressed file.\n");
+					goto out;
+				}
+
+				if (srcSize > maxSrcSize)
+				{
+					maxSrcSize = srcSize;
+				}
+			}
+
+			if ((chunk = (u_int8_t *)malloc(maxSrcSize)) == 0)
+			{
+				goto out;
+			}
+			break;
+
+		default:
+			printf("Unsupported compression type (%d).\n", type);
+			goto out;
+	}
+
+	for (index = offset / unitSize; ((uint64_t)index * unitSize) < (offset + *length); index++)
+	{
+		chunkStart	= (uint64_t)index * unitSize;
+		chunkSize	= ((fileLength - chunkStart) < unitSize) ? (fileLength - chunkStart) : unitSize;
+
+		if (table)
+		{
+			srcOffset	= tableOffset + table[index * 2];
+			srcSize		= table[index * 2 + 1];
+			src			= chunk;
+
+			if (ReadForkExtent((char *)&fork->extents, rsrcLength, fileID, kResourceForkType, srcOffset, srcSize, chunk, 0) != srcSize)
+			{
+				goto out;
+			}
+		}
+		else
+		{
+			src		= data;
+			srcSize	= dataSize;
+		}
+
+		start	= (offset > chunkStart) ? offset : chunkStart;
+		end		= ((offset + *length) < (chunkStart + chunkSize)) ? (offset + *length) : (chunkStart + chunkSize);
+
+		if ((start == chunkStart) && (end == (chunkStart + chunkSize)))
+		{
+			dst = (u_int8_t *)base + (chunkStart - offset);
+		}
+		else
+		{
+			if ((scratch == 0) && ((scratch = (u_int8_t *)malloc(unitSize)) == 0))
+			{
+				goto out;
+			}
+
+			dst = scratch;
+		}
+
+		if (DecompressChunk(type, src, srcSize, dst, chunkSize) != chunkSize)
+		{
+			printf("Damaged chunk in compressed file.\n");
+			goto out;
+		}
+
+		if (dst == scratch)
+		{
+			bcopy(scratch + (start - chunkStart), (u_int8_t *)base + (start - offset), end - start);
+		}
+	}
+
+	result = 0;
+
+out:
+	if (scratch)
+	{
+		free(scratch);
+	}
+
+	if (chunk)
+	{
+		free(chunk);
+	}
+
+	if (table)
+	{
+		free(table);
+	}
+
+	free(record);
+
+	return result;
+}
+
+
+//==============================================================================
+// Decompresses one chunk. Returns the number of bytes stored at dst (or -1).
+
+static long DecompressChunk(long type, u_int8_t * src, u_int32_t srcSize, u_int8_t * dst, u_int32_t dstSize)
+{
+	if (srcSize == 0)
+	{
+		return -1;
+	}
+
+	switch (type)
+	{
+		case kDecmpfsTypeZlibAttr:
+		case kDecmpfsTypeZlibRsrc:
+			// Chunks that didn't compress are stored as is, after a marker byte (0x?F
+			// cannot start a zlib stream).
+			if ((src[0] & 0x0F) != 0x0F)
+			{
+				return decompressZlib(dst, dstSize, src, srcSize);
+			}
+			break;
+
+		case kDecmpfsTypeLZVNAttr:
+		case kDecmpfsTypeLZVNRsrc:
+			// Same for LZVN, with an end of stream opcode as the marker.
+			if (src[0] != 0x06)
+			{
+				return decompressLZVN(dst, dstSize, src, srcSize);
+			}
+			break;
+
+		default:
+			return -1;
+	}
+
+	if ((srcSize - 1) < dstSize)
+	{
+		dstSize = srcSize - 1;
+	}
+
+	bcopy(src + 1, dst, dstSize);
+
+	return dstSize;
+}
+#endif /* HFS_COMPRESSION_SUPPORT */
+
+
+//==============================================================================
+
+static long GetCatalogEntryInfo(void * entry, long * flags, long * time, FinderInfo * finderInfo, long * infoValid)
+{
+    long tmpTime = 0;
+    long valid = 0;
+
+    // Get information about the file.
+    
+    switch (SWAP_BE16(*(short *)entry))
+    {
+        case kHFSFolderRecord           :
+            *flags = kFileTypeDirectory;
+            tmpTime = SWAP_BE32(((HFSCatalogFolder *)entry)->modifyDate);
+            break;
+
+        case kHFSPlusFolderRecord       :
+            *flags = kFileTypeDirectory |
+                     (SWAP_BE16(((HFSPlusCatalogFolder *)entry)->bsdInfo.fileMode) & kPermMask);
+            if (SWAP_BE32(((HFSPlusCatalogFolder *)entry)->bsdInfo.ownerID) != 0)
+                *flags |= kOwnerNotRoot;
+            tmpTime = SWAP_BE32(((HFSPlusCatalogFolder *)entry)->contentModDate);
+            break;
+
+        case kHFSFileRecord             :
+            *flags = kFileTypeFlat;
+            tmpTime = SWAP_BE32(((HFSCatalogFile *)entry)->modifyDate);
+            if (finderInfo) {
+                SwapFinderInfo((FndrFileInfo *)finderInfo, &((HFSCatalogFile *)entry)->userInfo);
+                valid = 1;
             }
             break;
 
@@ -741,8 +1528,8 @@ static long GetCatalogEntry(long * dirIndex, char ** name, long * flags, long *
 {
 	long              extentSize, nodeSize, curNode, index;
 	void              *extent;
-	char              *nodeBuf, *testKey, *entry;
-	BTNodeDescriptor  *node;
+	char              *testKey, *entry;
+	BTreeNode         *node;
 
 	if (gIsHFSPlus)
 	{
@@ -756,15 +1543,17 @@ static long GetCatalogEntry(long * dirIndex, char ** name, long * flags, long *
 	}
 
 	nodeSize = SWAP_BE16(gBTHeaders[kBTreeCatalog]->nodeSize);
-	nodeBuf  = (char *)malloc(nodeSize);
-	node     = (BTNodeDescriptor *)nodeBuf;
 
 	index   = *dirIndex % nodeSize;
 	curNode = *dirIndex / nodeSize;
 
 	// Read the BTree node and get the record for index.
-	ReadExtent(extent, extentSize, kHFSCatalogFileID, curNode * nodeSize, nodeSize, nodeBuf, 1);
-	GetBTreeRecord(index, nodeBuf, nodeSize, &testKey, &entry);
+	if ((node = GetBTreeNode(kBTreeCatalog, curNode, extent, extentSize, kHFSCatalogFileID, nodeSize)) == 0)
+	{
+		return -1;
+	}
+
+	GetBTreeRecord(index, node, &testKey, &entry);
 	GetCatalogEntryInfo(entry, flags, time, finderInfo, infoValid);
 
 	// Get the file name.
@@ -786,63 +1575,344 @@ static long GetCatalogEntry(long * dirIndex, char ** name, long * flags, long *
     // Update dirIndex.
     index++;
 
-    if (index == SWAP_BE16(node->numRecords))
+    if (index == node->numRecords)
 	{
 		index = 0;
-		curNode = SWAP_BE32(node->fLink);
+		curNode = SWAP_BE32(node->node->fLink);
     }
 
 	*dirIndex = curNode * nodeSize + index;
 
-	free(nodeBuf);
+	return 0;
+}
+
+
+//==============================================================================
+// Resolves a directory path (two leading slashes start in the system folder) to
+// the catalog position (node * nodeSize + index) of its first entry.
+
+static long ResolveDirIndex(char * dirPath, long * dirIndex)
+{
+	char entry[512];
+	long dirID, dirFlags;
+
+	dirID = kHFSRootFolderID;
+	*dirIndex = 0;
+
+	// Skip a lead '\'.  Start in the system folder if there are two.
+	if (dirPath[0] == '/')
+	{
+		if (dirPath[1] == '/')
+		{
+			if (gIsHFSPlus)
+			{
+				dirID = SWAP_BE32(((long *)gHFSPlus->finderInfo)[5]);
+			}
+			else 
+			{
+				dirID = SWAP_BE32(gHFSMDB->drFndrInfo[5]);
+			}
+
+			if (dirID == 0)
+			{
+				return -1;
+			}
+
+			dirPath++;
+		}
+
+		dirPath++;
+	}
+
+	// Ends on the thread record of the directory, with dirIndex set to the record after it.
+	if ((ResolvePathToCatalogEntry(dirPath, &dirFlags, entry, dirID, dirIndex) == -1) ||
+		((dirFlags & kFileTypeMask) != kFileTypeUnknown))
+	{
+		return -1;
+	}
 
 	return 0;
 }
 
 
+//==============================================================================
+// Reads a run of catalog nodes with a single ReadExtent() call, which leaves them in
+// the block cache (GetBTreeNode reads them from there). Returns the number of nodes.
+
+static long PrefetchCatalogNodes(long firstNode, long count, char * buffer)
+{
+	void		*extent;
+	uint64_t	extentSize;
+	long		nodeSize	= SWAP_BE16(gBTHeaders[kBTreeCatalog]->nodeSize);
+	long		totalNodes	= SWAP_BE32(gBTHeaders[kBTreeCatalog]->totalNodes);
+
+	if (firstNode >= totalNodes)
+	{
+		return 0;
+	}
+
+	if (count > (totalNodes - firstNode))
+	{
+		count = totalNodes - firstNode;
+	}
+
+	if (gIsHFSPlus)
+	{
+		extent     = &gHFSPlus->catalogFile.extents;
+		extentSize = SWAP_BE64(gHFSPlus->catalogFile.logicalSize);
+	}
+	else
+	{
+		extent     = (HFSExtentDescriptor *)&gHFSMDB->drCTExtRec;
+		extentSize = SWAP_BE32(gHFSMDB->drCTFlSize);
+	}
+
+	ReadExtent(extent, extentSize, kHFSCatalogFileID, (uint64_t)firstNode * nodeSize, (uint64_t)count * nodeSize, buffer, 1);
+
+#if CACHE_STATS
+	gPrefetchedNodes += count;
+#endif
+
+	return count;
+}
+
+
+//==============================================================================
+
+static long CompareDentryName(const char * name, const char * fileName, bool folded)
+{
+	char c1, c2;
+
+	do
+	{
+		c1 = *name++;
+		c2 = *fileName++;
+
+		if (folded)
+		{
+			c1 = ((c1 >= 'A') && (c1 <= 'Z')) ? (c1 + 32) : c1;
+			c2 = ((c2 >= 'A') && (c2 <= 'Z')) ? (c2 + 32) : c2;
+		}
+	} while ((c1 == c2) && c1);
+
+	return c1 - c2;
+}
+
+
+//==============================================================================
+// Returns the dentry for (fileName, dirID) on the current volume, or 0. Also
+// returns the hash bucket for the name.
+
+static Dentry * LookupDentry(char * fileName, long dirID, long * bucket)
+{
+	unsigned long hash = 2166136261U ^ dirID;
+	long index;
+	char *cp;
+
+	// FNV-1a over the (lower case) name, so that a case-insensitive match ends up in the same bucket.
+	for (cp = fileName; *cp; cp++)
+	{
+		hash = (hash ^ (unsigned char)(((*cp >= 'A') && (*cp <= 'Z')) ? (*cp + 32) : *cp)) * 16777619U;
+	}
+
+	*bucket = hash % kDentryHashSize;
+
+	if (gDentryHash == 0)
+	{
+		return 0;
+	}
+
+	for (index = gDentryHash[*bucket]; index >= 0; index = gDentries[index].next)
+	{
+		Dentry *dentry = &gDentries[index];
+
+		if ((dentry->ih == gCurrentIH) && (dentry->parentID == dirID) &&
+			(CompareDentryName(dentry->name, fileName, dentry->folded) == 0))
+		{
+			return dentry;
+		}
+	}
+
+	return 0;
+}
+
+
+//==============================================================================
+// Drops the dentries of ih that were cached with another volume stamp (the
+// volume was changed since).
+
+static void InvalidateDentries(CICell ih)
+{
+	long index;
+	short *prev;
+
+	if (gDentryHash == 0)
+	{
+		return;
+	}
+
+	for (index = 0; index < kDentryHashSize; index++)
+	{
+		for (prev = &gDentryHash[index]; *prev >= 0; )
+		{
+			Dentry *dentry = &gDentries[*prev];
+
+			if ((dentry->ih == ih) && (dentry->stamp != gVolumeStamp))
+			{
+				dentry->ih = 0;
+				*prev = dentry->next;
+			}
+			else
+			{
+				prev = &dentry->next;
+			}
+		}
+	}
+}
+
+
+//==============================================================================
+
+static bool IsThreadRecord(void * entry)
+{
+	switch (SWAP_BE16(*(short *)entry))
+	{
+		case kHFSFileThreadRecord       :
+		case kHFSPlusFileThreadRecord   :
+		case kHFSFolderThreadRecord     :
+		case kHFSPlusFolderThreadRecord :
+			return true;
+	}
+
+	return false;
+}
+
+
 //==============================================================================
 
 static long ReadCatalogEntry(char * fileName, long dirID, void * entry, long * dirIndex)
 {
-	long              length;
+	long              length, result, index, bucket, nextIndex = 0;
 	char              key[sizeof(HFSPlusCatalogKey)];
 	HFSCatalogKey     *hfsKey     = (HFSCatalogKey *)key;
 	HFSPlusCatalogKey *hfsPlusKey = (HFSPlusCatalogKey *)key;
-  
+	Dentry            *dentry     = LookupDentry(fileName, dirID, &bucket);
+
+	if (dentry)
+	{
+#if CACHE_STATS
+		gDentryHits++;
+#endif
+		if (dentry->result == 0)
+		{
+			bcopy(dentry->record, entry, kDentryRecordSize);
+
+			if (dirIndex)
+			{
+				*dirIndex = dentry->dirIndex;
+			}
+		}
+
+		return dentry->result;
+	}
+
+#if CACHE_STATS
+	gDentryMisses++;
+#endif
+
 	// Make the catalog key.
 	if (gIsHFSPlus)
 	{
 		hfsPlusKey->parentID = SWAP_BE32(dirID);
 		length = strlen(fileName);
 
-		if (length > 255)
+		if (length > 255)
+		{
+			length = 255;
+		}
+
+		utf_decodestr((u_int8_t *)fileName, hfsPlusKey->nodeName.unicode, &(hfsPlusKey->nodeName.length), 512, OSBigEndian);
+	}
+	else
+	{
+		hfsKey->parentID = SWAP_BE32(dirID);
+		length = strlen(fileName);
+
+		if (length > 31)
+		{
+			length = 31;
+		}
+
+		hfsKey->nodeName[0] = length;
+		strncpy((char *)(hfsKey->nodeName + 1), fileName, length);
+	}
+
+	result = ReadBTreeEntry(kBTreeCatalog, &key, entry, &nextIndex);
+
+	if (dirIndex && (result == 0))
+	{
+		*dirIndex = nextIndex;
+	}
+
+	// Cache the result (also when the name was not found). Thread records (looked up
+	// by ID with an empty name) are larger than a dentry holds, and are not cached.
+	if ((strlen(fileName) < kDentryMaxName) && ((result != 0) || !IsThreadRecord(entry)))
+	{
+		if (gDentries == 0)
+		{
+			gDentries = (Dentry *)malloc(kDentryCacheEntries * sizeof(Dentry));
+			gDentryHash = (short *)malloc(kDentryHashSize * sizeof(short));
+
+			if (!gDentries || !gDentryHash)
+			{
+				gDentries = 0;
+				gDentryHash = 0;
+				return result;
+			}
+
+			bzero(gDentries, kDentryCacheEntries * sizeof(Dentry));
+			memset(gDentryHash, 0xFF, kDentryHashSize * sizeof(short));
+		}
+
+		index = gDentryNext++ % kDentryCacheEntries;
+		dentry = &gDentries[index];
+
+		// Unlink the recycled entry from its hash chain.
+		if (dentry->ih)
 		{
-			length = 255;
+			short *prev;
+
+			for (prev = &gDentryHash[dentry->bucket]; *prev != index; prev = &gDentries[*prev].next);
+
+			*prev = dentry->next;
 		}
 
-		utf_decodestr((u_int8_t *)fileName, hfsPlusKey->nodeName.unicode, &(hfsPlusKey->nodeName.length), 512, OSBigEndian);
-	}
-	else
-	{
-		hfsKey->parentID = SWAP_BE32(dirID);
-		length = strlen(fileName);
+		dentry->ih			= gCurrentIH;
+		dentry->parentID	= dirID;
+		dentry->stamp		= gVolumeStamp;
+		dentry->result		= result;
+		dentry->dirIndex	= nextIndex;
+		dentry->bucket		= bucket;
+		dentry->folded		= !gCaseSensitive;	// Known here (set when the catalog header is read).
+		dentry->next		= gDentryHash[bucket];
 
-		if (length > 31)
+		strcpy(dentry->name, fileName);
+
+		if (result == 0)
 		{
-			length = 31;
+			bcopy(entry, dentry->record, kDentryRecordSize);
 		}
 
-		hfsKey->nodeName[0] = length;
-		strncpy((char *)(hfsKey->nodeName + 1), fileName, length);
+		gDentryHash[bucket] = index;
 	}
 
-	return ReadBTreeEntry(kBTreeCatalog, &key, entry, dirIndex);
+	return result;
 }
 
 
 //==============================================================================
 
-static long ReadExtentsEntry(long fileID, long startBlock, void * entry)
+static long ReadExtentsEntry(long fileID, long forkType, long startBlock, void * entry)
 {
     char             key[sizeof(HFSPlusExtentKey)];
     HFSExtentKey     *hfsKey     = (HFSExtentKey *)key;
@@ -851,13 +1921,13 @@ static long ReadExtentsEntry(long fileID, long startBlock, void * entry)
     // Make the extents key.
     if (gIsHFSPlus)
 	{
-        hfsPlusKey->forkType   = 0;
+        hfsPlusKey->forkType   = forkType;
         hfsPlusKey->fileID     = SWAP_BE32(fileID);
         hfsPlusKey->startBlock = SWAP_BE32(startBlock);
     }
 	else
 	{
-        hfsKey->forkType   = 0;
+        hfsKey->forkType   = forkType;
         hfsKey->fileID     = SWAP_BE32(fileID);
         hfsKey->startBlock = SWAP_BE16(startBlock);
     }
@@ -866,6 +1936,34 @@ static long ReadExtentsEntry(long fileID, long startBlock, void * entry)
 }
 
 
+#if HFS_COMPRESSION_SUPPORT
+//==============================================================================
+// Looks up an (inline) extended attribute. The record is copied to buffer, which
+// must hold kAttrRecordMaxSize bytes. Returns the size of the attribute data (at
+// buffer + 16) or -1 when not found.
+
+static long ReadAttribute(long fileID, char * attrName, char * buffer)
+{
+    HFSPlusAttrKey key;
+    long           attrSize;
+
+    bzero(&key, sizeof(key));
+
+    key.fileID = SWAP_BE32(fileID);
+    utf_decodestr((u_int8_t *)attrName, key.attrName, &key.attrNameLen, sizeof(key.attrName), OSBigEndian);
+
+    if (ReadBTreeEntry(kBTreeAttributes, &key, buffer, 0) == -1)
+	{
+        return -1;
+	}
+
+    attrSize = SWAP_BE32(((HFSPlusAttrData *)buffer)->attrSize);
+
+    return (attrSize > (kAttrRecordMaxSize - 16)) ? (kAttrRecordMaxSize - 16) : attrSize;
+}
+#endif
+
+
 //==============================================================================
 
 static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex)
@@ -873,11 +1971,12 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
     long             extentSize;
     void             *extent;
     short            extentFile;
-    char             *nodeBuf;
-    BTNodeDescriptor *node;
+    BTreeNode        *node;
     long             nodeSize, result = 0, entrySize = 0;
     long             curNode, index = 0, lowerBound, upperBound;
     char             *testKey, *recordData;
+    u_int16_t        foldedName[kHFSPlusMaxFileNameChars + 1];   // utf_decodestr() may store one more.
+    u_int32_t        foldedLength = 0;
 
     // Figure out which tree is being looked at.
     if (btree == kBTreeCatalog)
@@ -893,6 +1992,18 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
             extentSize = SWAP_BE32(gHFSMDB->drCTFlSize);
         }
         extentFile = kHFSCatalogFileID;
+    }
+	else if (btree == kBTreeAttributes)
+	{
+        // HFS+ only (and optional there).
+        if (!gIsHFSPlus || (gHFSPlus->attributesFile.logicalSize == 0))
+		{
+            return -1;
+		}
+
+        extent     = &gHFSPlus->attributesFile.extents;
+        extentSize = SWAP_BE64(gHFSPlus->attributesFile.logicalSize);
+        extentFile = kHFSAttributesFileID;
     }
 	else
 	{
@@ -923,30 +2034,41 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
 
     curNode  = SWAP_BE32(gBTHeaders[btree]->rootNode);
     nodeSize = SWAP_BE16(gBTHeaders[btree]->nodeSize);
-    nodeBuf  = (char *)malloc(nodeSize);
-    node     = (BTNodeDescriptor *)nodeBuf;
+
+    // Case fold the name of the search key once (instead of in every compare).
+    if (gIsHFSPlus && (btree == kBTreeCatalog) && !gCaseSensitive)
+	{
+        foldedLength = FoldUnicodeString(((HFSPlusCatalogKey *)key)->nodeName.unicode,
+                                         SWAP_BE16(((HFSPlusCatalogKey *)key)->nodeName.length), foldedName);
+    }
 
     while (1)
 	{
-        // Read the current node.
-        ReadExtent(extent, extentSize, extentFile,
-                   curNode * nodeSize, nodeSize, nodeBuf, 1);
-    
+        // Get the current node (from the node cache when possible).
+        if ((node = GetBTreeNode(btree, curNode, extent, extentSize, extentFile, nodeSize)) == 0)
+		{
+            return -1;
+		}
+
         // Find the matching key.
         lowerBound = 0;
-        upperBound = SWAP_BE16(node->numRecords) - 1;
+        upperBound = node->numRecords - 1;
 
         while (lowerBound <= upperBound)
 		{
             index = (lowerBound + upperBound) / 2;
 
-            GetBTreeRecord(index, nodeBuf, nodeSize, &testKey, &recordData);
+            GetBTreeRecord(index, node, &testKey, &recordData);
 
             if (gIsHFSPlus)
 			{
                 if (btree == kBTreeCatalog)
 				{
-                    result = CompareHFSPlusCatalogKeys(key, testKey);
+                    result = CompareHFSPlusCatalogKeys(key, testKey, foldedName, foldedLength);
+                }
+				else if (btree == kBTreeAttributes)
+				{
+                    result = CompareHFSPlusAttrKeys(key, testKey);
                 }
 				else
 				{
@@ -982,11 +2104,11 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
 		if (result < 0)
 		{
 			index = upperBound;
-			GetBTreeRecord(index, nodeBuf, nodeSize, &testKey, &recordData);
+			GetBTreeRecord(index, node, &testKey, &recordData);
 		}
     
 		// Found the closest key... Recurse on it if this is an index node.
-		if (node->kind == kBTIndexNode)
+		if (node->node->kind == kBTIndexNode)
 		{
 			curNode = SWAP_BE32( *((long *)recordData) );
 		}
@@ -999,7 +2121,6 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
 	// Return error if the file was not found.
 	if (result != 0)
 	{
-		free(nodeBuf);
 		return -1;
 	}
 
@@ -1025,6 +2146,22 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
 				break;
 		}
 	}
+	else if (btree == kBTreeAttributes)
+	{
+		// Inline data only (the record header followed by the data). Capped to what
+		// the caller's buffer (kAttrRecordMaxSize) can take.
+		if (SWAP_BE32(((HFSPlusAttrData *)recordData)->recordType) != kHFSPlusAttrInlineData)
+		{
+			return -1;
+		}
+
+		entrySize = 16 + SWAP_BE32(((HFSPlusAttrData *)recordData)->attrSize);
+
+		if (entrySize > kAttrRecordMaxSize)
+		{
+			entrySize = kAttrRecordMaxSize;
+		}
+	}
 	else
 	{
 		if (gIsHFSPlus)
@@ -1044,29 +2181,164 @@ static long ReadBTreeEntry(long btree, void * key, char * entry, long * dirIndex
 	{
 		index++;
 
-		if (index == SWAP_BE16(node->numRecords))
+		if (index == node->numRecords)
 		{
 			index = 0;
-			curNode = SWAP_BE32(node->fLink);
+			curNode = SWAP_BE32(node->node->fLink);
 		}
 
 		*dirIndex = curNode * nodeSize + index;
 	}
 
-	free(nodeBuf);
-
 	return 0;
 }
 
 
 //==============================================================================
 
-static void GetBTreeRecord(long index, char * nodeBuffer, long nodeSize, char ** key, char ** data)
+// Returns a B-tree node, from the node cache or read from disk (through the
+// block cache). Nodes stay valid until the next call.
+
+static BTreeNode * GetBTreeNode(long btree, long number, void * extent, uint64_t extentSize, long extentFile, long nodeSize)
+{
+	BTreeNode	*cached, *victim = 0, scratch;
+	long		index, first, last, maxRecords, result;
+
+	for (index = 0; index < (kBTNodeCacheIndexNodes + kBTNodeCacheLeafNodes); index++)
+	{
+		cached = &gBTNodeCache[index];
+
+		if ((cached->number == number) && (cached->btree == btree) && (cached->ih == gCurrentIH) && (cached->nodeSize == nodeSize))
+		{
+			cached->time = ++gBTNodeCacheTime;
+#if CACHE_STATS
+			gBTNodeHits++;
+#endif
+			return cached;
+		}
+	}
+
+#if CACHE_STATS
+	gBTNodeMisses++;
+#endif
+
+	// Take the scratch buffers (room for the node and its record offsets) for this
+	// call. A read through an extent map that isn't cached yet looks up the extents
+	// B-tree, and gets here again before our read is done, so the nested call must
+	// not see (and reuse or free) the buffer that our read goes to.
+	if (gBTNodeNesting >= kBTNodeMaxNesting)
+	{
+		return 0;
+	}
+
+	if (gBTNodeScratch == 0)
+	{
+		gBTNodeScratch = (BTreeNode *)malloc(sizeof(BTreeNode));
+
+		if (gBTNodeScratch == 0)
+		{
+			return 0;
+		}
+
+		bzero(gBTNodeScratch, sizeof(BTreeNode));
+	}
+
+	scratch = *gBTNodeScratch;
+	bzero(gBTNodeScratch, sizeof(BTreeNode));
+
+	if (scratch.nodeSize != nodeSize)
+	{
+		if (scratch.node)
+		{
+			free(scratch.node);
+		}
+
+		if ((scratch.node = (BTNodeDescriptor *)malloc(nodeSize * 2)) == 0)
+		{
+			return 0;
+		}
+
+		scratch.nodeSize = nodeSize;
+		scratch.offsets = (u_int16_t *)((char *)scratch.node + nodeSize);
+	}
+
+	gBTNodeNesting++;
+	result = ReadExtent(extent, extentSize, extentFile, number * nodeSize, nodeSize, scratch.node, 1);
+	gBTNodeNesting--;
+
+	if (result != nodeSize)
+	{
+		// Keep our buffers (instead of any that a nested call left there).
+		if (gBTNodeScratch->node)
+		{
+			free(gBTNodeScratch->node);
+		}
+
+		*gBTNodeScratch = scratch;
+		return 0;
+	}
+
+	// Decode (byte swap) the record offsets once.
+	maxRecords = (nodeSize - sizeof(BTNodeDescriptor)) / 2;
+	scratch.numRecords = SWAP_BE16(scratch.node->numRecords);
+
+	if (scratch.numRecords > maxRecords)
+	{
+		scratch.numRecords = maxRecords;
+	}
+
+	for (index = 0; index < scratch.numRecords; index++)
+	{
+		scratch.offsets[index] = SWAP_BE16(*((u_int16_t *)((char *)scratch.node + (nodeSize - 2 * index - 2))));
+	}
+
+	// Pick a free or the least recently used entry of the pool.
+	first = (scratch.node->kind == kBTIndexNode) ? 0 : kBTNodeCacheIndexNodes;
+	last  = (scratch.node->kind == kBTIndexNode) ? kBTNodeCacheIndexNodes : (kBTNodeCacheIndexNodes + kBTNodeCacheLeafNodes);
+
+	for (index = first; index < last; index++)
+	{
+		cached = &gBTNodeCache[index];
+
+		if (cached->ih == 0)
+		{
+			victim = cached;
+			break;
+		}
+
+		if ((victim == 0) || (cached->time < victim->time))
+		{
+			victim = cached;
+		}
+	}
+
+	// The victim's buffers become the scratch buffers (replacing any that a nested
+	// call left there).
+	if (gBTNodeScratch->node)
+	{
+		free(gBTNodeScratch->node);
+	}
+
+	*gBTNodeScratch = *victim;
+	*victim = scratch;
+
+	victim->ih		= gCurrentIH;
+	victim->btree	= btree;
+	victim->number	= number;
+	victim->time	= ++gBTNodeCacheTime;
+
+	return victim;
+}
+
+
+//==============================================================================
+
+static void GetBTreeRecord(long index, BTreeNode * node, char ** key, char ** data)
 {
 	long keySize;
-	long recordOffset = SWAP_BE16(*((short *)(nodeBuffer + (nodeSize - 2 * index - 2))));
+	long recordOffset = ((index >= 0) && (index < node->numRecords)) ? node->offsets[index] : sizeof(BTNodeDescriptor);
     
-	*key = nodeBuffer + recordOffset;
+	*key = (char *)node->node + recordOffset;
 
 	if (gIsHFSPlus)
 	{
@@ -1083,21 +2355,39 @@ static void GetBTreeRecord(long index, char * nodeBuffer, long nodeSize, char **
 
 //==============================================================================
 
-static long ReadExtent(char * extent, uint64_t extentSize, long extentFile, uint64_t offset, uint64_t size, void * buffer, long cache)
+// Returns the extent map of a file (fork), built on first use from its extent
+// record and the extents overflow file.
+
+static ExtentMap * GetExtentMap(char * extent, uint64_t extentSize, long extentFile, long forkType)
 {
-	uint64_t  lastOffset;
-	long long blockNumber, countedBlocks = 0;
-	long long nextExtent = 0, sizeRead = 0, readSize;
-	long long nextExtentBlock, currentExtentBlock = 0;
-	long long readOffset;
-	long long extentDensity, sizeofExtent, currentExtentSize;
-	char      *currentExtent, *extentBuffer = 0, *bufferPos = buffer;
+	ExtentMap		*map, *victim = 0;
+	ExtentMapping	*extents, *grown;
+	char			*record = extent, *extentBuffer = 0;
+	long			index, count = 0, capacity, extentDensity, sizeofExtent;
+	u_int32_t		countedBlocks = 0, blockCount;
+	u_int32_t		firstStart = GetExtentStart(extent, 0);
+	u_int32_t		firstCount = GetExtentSize(extent, 0);
+	u_int64_t		totalBlocks = (extentSize + gBlockSize - 1) / gBlockSize;
 
-	if (offset >= extentSize)
+	for (index = 0; index < kExtentMapCacheSize; index++)
 	{
-		return 0;
+		map = &gExtentMaps[index];
+
+		if ((map->ih == gCurrentIH) && (map->fileID == extentFile) && (map->forkType == forkType) &&
+			(map->firstStart == firstStart) && (map->firstCount == firstCount) && (map->stamp == gVolumeStamp))
+		{
+			map->time = ++gExtentMapTime;
+#if CACHE_STATS
+			gExtentMapHits++;
+#endif
+			return map;
+		}
 	}
 
+#if CACHE_STATS
+	gExtentMapMisses++;
+#endif
+
 	if (gIsHFSPlus)
 	{
 		extentDensity = kHFSPlusExtentDensity;
@@ -1109,77 +2399,198 @@ static long ReadExtent(char * extent, uint64_t extentSize, long extentFile, uint
 		sizeofExtent  = sizeof(HFSExtentDescriptor);
 	}
 
-	lastOffset = offset + size;
+	capacity = extentDensity;
 
-	while (offset < lastOffset)
+	if ((extents = (ExtentMapping *)malloc(capacity * sizeof(ExtentMapping))) == 0)
 	{
-		blockNumber = offset / gBlockSize;
+		return 0;
+	}
 
-		// Find the extent for the offset.
-		for (; ; nextExtent++)
+	// Walk the extent records until all blocks of the file are mapped.
+	while (countedBlocks < totalBlocks)
+	{
+		for (index = 0; (index < extentDensity) && (countedBlocks < totalBlocks); index++)
 		{
-			if (nextExtent < extentDensity)
+			if ((blockCount = GetExtentSize(record, index)) == 0)
 			{
-				if ((countedBlocks+GetExtentSize(extent, nextExtent)-1)<blockNumber)
-				{
-					countedBlocks += GetExtentSize(extent, nextExtent);
-					continue;
-				}
-
-				currentExtent = extent + nextExtent * sizeofExtent;
 				break;
 			}
 
-			if (extentBuffer == 0)
+			// Physically contiguous with the previous extent (allocation only split it
+			// across records)? Then extend that mapping, so it is read in one go.
+			if (count && ((extents[count - 1].physical + extents[count - 1].count) == GetExtentStart(record, index)))
 			{
-				extentBuffer = malloc(sizeofExtent * extentDensity);
+				extents[count - 1].count += blockCount;
+				countedBlocks += blockCount;
+				continue;
+			}
 
-				if (extentBuffer == 0)
+			if (count == capacity)
+			{
+				if ((grown = (ExtentMapping *)realloc(extents, (capacity * 2) * sizeof(ExtentMapping))) == 0)
 				{
-					return -1;
+					break;
 				}
+
+				extents = grown;
+				capacity *= 2;
 			}
 
-			nextExtentBlock = nextExtent / extentDensity;
+			extents[count].logical	= countedBlocks;
+			extents[count].physical	= GetExtentStart(record, index);
+			extents[count].count	= blockCount;
+
+			countedBlocks += blockCount;
+			count++;
+		}
+
+		if ((index < extentDensity) || (countedBlocks >= totalBlocks))
+		{
+			break;
+		}
+
+		// Next extent record (from the extents overflow file).
+		if ((extentBuffer == 0) && ((extentBuffer = malloc(sizeofExtent * extentDensity)) == 0))
+		{
+			break;
+		}
+
+		if (ReadExtentsEntry(extentFile, forkType, countedBlocks, extentBuffer) == -1)
+		{
+			break;
+		}
+
+		record = extentBuffer;
+	}
+
+	if (extentBuffer)
+	{
+		free(extentBuffer);
+	}
+
+	// Note: looked up again (ReadExtentsEntry() may have added maps for the B-tree files).
+	for (index = 0; index < kExtentMapCacheSize; index++)
+	{
+		map = &gExtentMaps[index];
+
+		if (map->ih == 0)
+		{
+			victim = map;
+			break;
+		}
+
+		if ((victim == 0) || (map->time < victim->time))
+		{
+			victim = map;
+		}
+	}
+
+	if (victim->extents)
+	{
+		free(victim->extents);
+	}
+
+	victim->ih			= gCurrentIH;
+	victim->fileID		= extentFile;
+	victim->stamp		= gVolumeStamp;
+	victim->firstStart	= firstStart;
+	victim->firstCount	= firstCount;
+	victim->forkType	= forkType;
+	victim->time		= ++gExtentMapTime;
+	victim->count		= count;
+	victim->extents		= extents;
+
+	return victim;
+}
+
+
+//==============================================================================
+
+static long ReadExtent(char * extent, uint64_t extentSize, long extentFile, uint64_t offset, uint64_t size, void * buffer, long cache)
+{
+	return ReadForkExtent(extent, extentSize, extentFile, kDataForkType, offset, size, buffer, cache);
+}
+
+
+//==============================================================================
+
+static long ReadForkExtent(char * extent, uint64_t extentSize, long extentFile, long forkType, uint64_t offset, uint64_t size, void * buffer, long cache)
+{
+	uint64_t		lastOffset;
+	long long		blockNumber, sizeRead = 0, readSize, readOffset;
+	long			index = 0, lowerBound, upperBound;
+	char			*bufferPos = buffer;
+	ExtentMap		*map;
+	ExtentMapping	*mapping;
+
+	if (offset >= extentSize)
+	{
+		return 0;
+	}
+
+	if ((map = GetExtentMap(extent, extentSize, extentFile, forkType)) == 0)
+	{
+		return -1;
+	}
+
+	lastOffset = offset + size;
+
+	while (offset < lastOffset)
+	{
+		blockNumber = offset / gBlockSize;
+
+		// Find the extent for the offset (usually the one following the last).
+		if ((index >= map->count) || (blockNumber < map->extents[index].logical) ||
+			(blockNumber >= (map->extents[index].logical + map->extents[index].count)))
+		{
+			lowerBound = 0;
+			upperBound = map->count - 1;
 
-			if (currentExtentBlock != nextExtentBlock)
+			while (lowerBound <= upperBound)
 			{
-				ReadExtentsEntry(extentFile, countedBlocks, extentBuffer);
-				currentExtentBlock = nextExtentBlock;
-			}
+				index = (lowerBound + upperBound) / 2;
 
-			currentExtentSize = GetExtentSize(extentBuffer, nextExtent % extentDensity);
+				if (blockNumber < map->extents[index].logical)
+				{
+					upperBound = index - 1;
+				}
+				else if (blockNumber >= (map->extents[index].logical + map->extents[index].count))
+				{
+					lowerBound = index + 1;
+				}
+				else
+				{
+					break;
+				}
+			}
 
-			if ((countedBlocks + currentExtentSize - 1) >= blockNumber)
+			if (lowerBound > upperBound)
 			{
-				currentExtent = extentBuffer + sizeofExtent * (nextExtent % extentDensity);
-				break;
+				break;	// Not mapped (damaged extent records).
 			}
-      
-			countedBlocks += currentExtentSize;
 		}
 
-		readOffset = ((blockNumber - countedBlocks) * gBlockSize) + (offset % gBlockSize);
+		mapping = &map->extents[index];
 
-		readSize = GetExtentSize(currentExtent, 0) * gBlockSize - readOffset;
+		readOffset = ((blockNumber - mapping->logical) * gBlockSize) + (offset % gBlockSize);
+
+		readSize = (long long)mapping->count * gBlockSize - readOffset;
 
 		if (readSize > (size - sizeRead))
 		{
 			readSize = size - sizeRead;
 		}
 
-		readOffset += (long long)GetExtentStart(currentExtent, 0) * gBlockSize;
+		readOffset += (long long)mapping->physical * gBlockSize;
+
+		IO_TRACE_SUBSYSTEM((extentFile < kHFSFirstUserCatalogNodeID) ? kIOTraceHFSMetadata : kIOTraceFileData);
 
 		CacheRead(gCurrentIH, bufferPos, gAllocationOffset + readOffset, readSize, cache);
 
 		sizeRead += readSize;
 		offset += readSize;
 		bufferPos += readSize;
-	}
-
-	if (extentBuffer)
-	{
-		free(extentBuffer);
+		index++;
 	}
 
 	return sizeRead;
@@ -1262,13 +2673,17 @@ static long CompareHFSCatalogKeys(void * key, void * testKey)
 
 //==============================================================================
 
-static long CompareHFSPlusCatalogKeys(void * key, void * testKey)
+static long CompareHFSPlusCatalogKeys(void * key, void * testKey, u_int16_t * foldedName, u_int32_t foldedLength)
 {
     HFSPlusCatalogKey *searchKey, *trialKey;
     long result, searchParentID, trialParentID;
   
     searchKey = key;
     trialKey  = testKey;
+
+#if CACHE_STATS
+    gKeyCompares++;
+#endif
   
     searchParentID = SWAP_BE32(searchKey->parentID);
     trialParentID  = SWAP_BE32(trialKey->parentID);
@@ -1298,10 +2713,10 @@ static long CompareHFSPlusCatalogKeys(void * key, void * testKey)
         }
 		else
 		{
-            result = FastUnicodeCompare(&searchKey->nodeName.unicode[0],
-                                        SWAP_BE16(searchKey->nodeName.length),
-                                        &trialKey->nodeName.unicode[0],
-                                        SWAP_BE16(trialKey->nodeName.length), OSBigEndian);
+            // Search key name folded by ReadBTreeEntry().
+            result = FastUnicodeCompareFolded(foldedName, foldedLength,
+                                              &trialKey->nodeName.unicode[0],
+                                              SWAP_BE16(trialKey->nodeName.length));
         }
     }
 
@@ -1416,3 +2831,45 @@ static long CompareHFSPlusExtentsKeys(void * key, void * testKey)
     return result;
 }
 
+
+
+//==============================================================================
+// Attribute keys are ordered by file ID, name (binary) and start block.
+
+static long CompareHFSPlusAttrKeys(void * key, void * testKey)
+{
+	HFSPlusAttrKey	*searchKey, *trialKey;
+	u_int32_t		index, length, searchLength, trialLength;
+
+	searchKey = key;
+	trialKey  = testKey;
+
+	if (searchKey->fileID != trialKey->fileID)
+	{
+		return (SWAP_BE32(searchKey->fileID) > SWAP_BE32(trialKey->fileID)) ? 1 : -1;
+	}
+
+	searchLength = SWAP_BE16(searchKey->attrNameLen);
+	trialLength  = SWAP_BE16(trialKey->attrNameLen);
+	length = (searchLength < trialLength) ? searchLength : trialLength;
+
+	for (index = 0; index < length; index++)
+	{
+		if (searchKey->attrName[index] != trialKey->attrName[index])
+		{
+			return (SWAP_BE16(searchKey->attrName[index]) > SWAP_BE16(trialKey->attrName[index])) ? 1 : -1;
+		}
+	}
+
+	if (searchLength != trialLength)
+	{
+		return (searchLength > trialLength) ? 1 : -1;
+	}
+
+	if (searchKey->startBlock != trialKey->startBlock)
+	{
+		return (SWAP_BE32(searchKey->startBlock) > SWAP_BE32(trialKey->startBlock)) ? 1 : -1;
+	}
+
+	return 0;
+}
@@ -24,8 +24,14 @@ extern long HFSInitPartition(CICell ih);
 extern long HFSLoadFile(CICell ih, char * filePath);
 extern long HFSReadFile(CICell ih, char * filePath, void *base, uint64_t offset, uint64_t length);
 extern long HFSGetDirEntry(CICell ih, char * dirPath, long * dirIndex, char ** name, long * flags, long * time, FinderInfo * finderInfo, long * infoValid);
+extern void * HFSOpenDir(CICell ih, char * dirPath);
+extern long HFSReadDir(CICell ih, void * dir, DirEntry * entry);
+extern void HFSCloseDir(CICell ih, void * dir);
+extern long HFSPrefetchDir(CICell ih, char * dirPath);
+extern long HFSGetFileSize(CICell ih, char * filePath, uint64_t * size);
 extern void HFSGetDescription(CICell ih, char *str, long strMaxLen);
 extern long HFSGetFileBlock(CICell ih, char *str, unsigned long long *firstBlock);
 extern long HFSGetUUID(CICell ih, char *uuidStr);
+extern void HFSPrintStats(void);
 extern void HFSFree(CICell ih);
 extern bool HFSProbe (const void *buf);
\ No newline at end of file
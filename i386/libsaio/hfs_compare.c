@@ -28,6 +28,12 @@
  */
 
 #include <sl.h>
+
+// Use the precomputed case tables (instead of decompressing them at runtime).
+#ifndef UNCOMPRESSED
+	#define UNCOMPRESSED 1
+#endif
+
 #include "hfs_CaseTables.h"
 
 #if ! UNCOMPRESSED
@@ -84,7 +90,7 @@ int32_t	FastRelString(u_int8_t * str1, u_int8_t * str2)
 	int32_t  bestGuess;
 	u_int8_t length, length2;
 
-#if ! UNCOMPRESED
+#if ! UNCOMPRESSED
         InitCompareTables();
 #endif
 
@@ -241,6 +247,107 @@ int32_t FastUnicodeCompare( u_int16_t * str1, register u_int32_t length1,
 }
 
 
+//
+//	FoldUnicodeString - Case fold a (big endian) Unicode string once, for use with
+//	FastUnicodeCompareFolded(). Ignorable characters are dropped. The folded string
+//	stays big endian (like the catalog keys it is compared with). Returns its length.
+//
+
+u_int32_t FoldUnicodeString(u_int16_t * str, u_int32_t length, u_int16_t * folded)
+{
+	register u_int16_t c;
+	register u_int16_t temp;
+	u_int32_t foldedLength = 0;
+
+#if ! UNCOMPRESSED
+        InitCompareTables();
+#endif
+
+	while (length--) {
+		c = SWAP_BE16(*(str++));
+
+		if ((temp = gLowerCaseTable[c>>8]) != 0)		// is there a subtable for this upper byte?
+			c = gLowerCaseTable[temp + (c & 0x00FF)];	// yes, so fold the char
+
+		if (c != 0)		/* skip ignorable chars */
+			folded[foldedLength++] = SWAP_BE16(c);
+	}
+
+	return foldedLength;
+}
+
+
+//
+//	FastUnicodeCompareFolded - Same result as FastUnicodeCompare() for a string that was
+//	folded by FoldUnicodeString() and a big endian string (a catalog key).
+//
+//	Runs of ASCII characters (U+0001 to U+007F) are compared two at a time, with
+//	A-Z folded arithmetically. Anything else (or a difference) takes a step through
+//	the lower case table.
+//
+
+int32_t FastUnicodeCompareFolded(u_int16_t * folded, register u_int32_t length1,
+                                 u_int16_t * str2, register u_int32_t length2)
+{
+	register u_int16_t c1,c2;
+	register u_int16_t temp;
+	register u_int32_t word;
+
+#if ! UNCOMPRESSED
+        InitCompareTables();
+#endif
+
+	while (1) {
+		/* ASCII fast path. Little endian loads of two big endian chars: high bytes in bits 0-7 and 16-23 */
+		while (length1 >= 2 && length2 >= 2) {
+			word = *(u_int32_t *)str2;
+
+			if ((word & 0x80FF80FF) || !(word & 0x00007F00) || !(word & 0x7F000000))
+				break;	/* not ASCII (or NUL) */
+
+			/* Fold 'A'-'Z' to lower case (sets 0x20 in the lanes that are >= 'A' and <= 'Z'). */
+			word |= (((word + 0x3F003F00) & ~(word + 0x25002500)) & 0x80008000) >> 2;
+
+			if (word != *(u_int32_t *)folded)
+				break;
+
+			folded += 2;
+			str2 += 2;
+			length1 -= 2;
+			length2 -= 2;
+		}
+
+		/* One char per string (str1 is folded already and has no ignorable chars) */
+		c1 = 0;
+		c2 = 0;
+
+		if (length1) {
+			c1 = SWAP_BE16(*(folded++));
+			--length1;
+		}
+
+		/* Find next non-ignorable char from str2, or zero if no more */
+		while (length2 && c2 == 0) {
+			c2 = SWAP_BE16(*(str2++));
+			--length2;
+			if ((temp = gLowerCaseTable[c2>>8]) != 0)		// is there a subtable for this upper byte?
+				c2 = gLowerCaseTable[temp + (c2 & 0x00FF)];	// yes, so fold the char
+		}
+
+		if (c1 != c2)	/* found a difference, so stop looping */
+			break;
+
+		if (c1 == 0)		/* did we reach the end of both strings at the same time? */
+			return 0;	/* yes, so strings are equal */
+	}
+
+	if (c1 < c2)
+		return -1;
+	else
+		return 1;
+}
+
+
 //
 //  BinaryUnicodeCompare - Compare two Unicode strings; produce a relative ordering
 //  Compared using a 16-bit binary comparison (no case folding)
@@ -0,0 +1,500 @@
+/*
+ * Inflate (RFC 1951) with zlib (RFC 1950) framing, for the zlib compressed files
+ * of HFS+ (decmpfs). Decodes a complete stream from memory into memory, so there
+ * is no window: matches are copied straight from the output.
+ *
+ * Huffman codes of up to kFastBits bits are decoded with a single table lookup,
+ * longer ones bit by bit from the canonical code (counts per length).
+ */
+
+#include "libsaio.h"
+
+
+#define kMaxBits		15				// Longest code.
+#define kFastBits		9				// Codes up to this length are decoded with one lookup.
+#define kMaxLengthCodes	286
+#define kMaxDistCodes	30
+#define kFixedLengths	288
+
+typedef struct Huffman
+{
+	short	count[kMaxBits + 1];		// Number of codes of each length.
+	short	symbol[kFixedLengths];		// Symbols, ordered by code.
+	short	fast[1 << kFastBits];		// (symbol << 4) | length, for the (bit reversed) codes up to kFastBits bits.
+} Huffman;
+
+typedef struct InflateState
+{
+	u_int8_t		*dst;
+	u_int32_t		dstSize;
+	u_int32_t		dstPos;
+	const u_int8_t	*src;
+	u_int32_t		srcSize;
+	u_int32_t		srcPos;				// Next byte to load into bitBuffer.
+	u_int32_t		bitBuffer;
+	int				bitCount;
+} InflateState;
+
+static const short lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+
+static const short lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+
+static const short distBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+
+static const short distExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static const u_int8_t codeLengthOrder[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Not on the stack (the booter's stack is small).
+static Huffman	gLengthCode, gDistCode, gCodeLengthCode;
+static Huffman	gFixedLengthCode, gFixedDistCode;
+static bool		gFixedCodesBuilt = false;
+
+
+//==============================================================================
+
+static inline void refill(InflateState * s)
+{
+	// Past the end of the input, zeros are shifted in (checked for at the end).
+	while (s->bitCount <= 24)
+	{
+		s->bitBuffer |= (u_int32_t)((s->srcPos < s->srcSize) ? s->src[s->srcPos] : 0) << s->bitCount;
+		s->srcPos++;
+		s->bitCount += 8;
+	}
+}
+
+
+//==============================================================================
+
+static inline u_int32_t bits(InflateState * s, int need)
+{
+	u_int32_t value;
+
+	refill(s);
+
+	value = s->bitBuffer & ((1 << need) - 1);
+	s->bitBuffer >>= need;
+	s->bitCount -= need;
+
+	return value;
+}
+
+
+//==============================================================================
+// Builds the decoding tables from the code lengths of n symbols. Returns -1 for
+// an over-subscribed set of lengths (incomplete codes are allowed).
+
+static int buildHuffman(Huffman * h, const u_int8_t * lengths, int n)
+{
+	int		symbol, len, left, code, reversed, index;
+	short	offsets[kMaxBits + 2];
+	short	nextCode[kMaxBits + 1];
+
+	bzero(h, sizeof(Huffman));
+
+	for (symbol = 0; symbol < n; symbol++)
+	{
+		h->count[lengths[symbol]]++;
+	}
+
+	h->count[0] = 0;
+
+	for (left = 1, len = 1; len <= kMaxBits; len++)
+	{
+		left <<= 1;
+		left -= h->count[len];
+
+		if (left < 0)
+		{
+			return -1;
+		}
+	}
+
+	offsets[1] = 0;
+	nextCode[1] = 0;
+
+	for (len = 1; len < kMaxBits; len++)
+	{
+		offsets[len + 1] = offsets[len] + h->count[len];
+		nextCode[len + 1] = (nextCode[len] + h->count[len]) << 1;
+	}
+
+	for (symbol = 0; symbol < n; symbol++)
+	{
+		if ((len = lengths[symbol]) == 0)
+		{
+			continue;
+		}
+
+		h->symbol[offsets[len]++] = symbol;
+
+		// Codes are sent MSB first, but read from the bit buffer LSB first.
+		code = nextCode[len]++;
+
+		if (len <= kFastBits)
+		{
+			for (reversed = 0, index = 0; index < len; index++)
+			{
+				reversed = (reversed << 1) | ((code >> index) & 1);
+			}
+
+			for (index = reversed; index < (1 << kFastBits); index += (1 << len))
+			{
+				h->fast[index] = (symbol << 4) | len;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+//==============================================================================
+
+static int decodeSymbol(InflateState * s, const Huffman * h)
+{
+	int entry, len, code = 0, first = 0, index = 0, count;
+
+	refill(s);
+
+	if ((entry = h->fast[s->bitBuffer & ((1 << kFastBits) - 1)]))
+	{
+		s->bitBuffer >>= (entry & 15);
+		s->bitCount -= (entry & 15);
+
+		return entry >> 4;
+	}
+
+	// Longer code (or none): walk the canonical code one bit at a time.
+	for (len = 1; len <= kMaxBits; len++)
+	{
+		code |= (s->bitBuffer >> (len - 1)) & 1;
+		count = h->count[len];
+
+		if ((code - count) < first)
+		{
+			s->bitBuffer >>= len;
+			s->bitCount -= len;
+
+			return h->symbol[index + (code - first)];
+		}
+
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+
+//==============================================================================
+
+static int inflateCodes(InflateState * s, const Huffman * lengthCode, const Huffman * distCode)
+{
+	int			symbol;
+	u_int32_t	length, dist;
+	u_int8_t	*from, *to;
+
+	while (1)
+	{
+		if ((symbol = decodeSymbol(s, lengthCode)) < 0)
+		{
+			return -1;
+		}
+
+		if (symbol < 256)
+		{
+			if (s->dstPos >= s->dstSize)
+			{
+				return -1;
+			}
+
+			s->dst[s->dstPos++] = symbol;
+		}
+		else if (symbol == 256)
+		{
+			return 0;
+		}
+		else
+		{
+			symbol -= 257;
+
+			if (symbol >= 29)
+			{
+				return -1;
+			}
+
+			length = lengthBase[symbol] + bits(s, lengthExtra[symbol]);
+
+			if (((symbol = decodeSymbol(s, distCode)) < 0) || (symbol >= kMaxDistCodes))
+			{
+				return -1;
+			}
+
+			dist = distBase[symbol] + bits(s, distExtra[symbol]);
+
+			if ((dist > s->dstPos) || (length > (s->dstSize - s->dstPos)))
+			{
+				return -1;
+			}
+
+			// Byte by byte: the source may overlap the destination.
+			from = s->dst + s->dstPos - dist;
+			to = s->dst + s->dstPos;
+			s->dstPos += length;
+
+			while (length--)
+			{
+				*to++ = *from++;
+			}
+		}
+	}
+}
+
+
+//==============================================================================
+
+static int inflateStored(InflateState * s)
+{
+	u_int32_t length;
+
+	// Drop the rest of the current byte, and give back the bytes still buffered.
+	s->srcPos -= (s->bitCount >> 3);
+	s->bitBuffer = 0;
+	s->bitCount = 0;
+
+	if ((s->srcPos + 4) > s->srcSize)
+	{
+		return -1;
+	}
+
+	length = s->src[s->srcPos] | (s->src[s->srcPos + 1] << 8);
+
+	if ((s->src[s->srcPos + 2] != (~length & 0xFF)) || (s->src[s->srcPos + 3] != ((~length >> 8) & 0xFF)))
+	{
+		return -1;
+	}
+
+	s->srcPos += 4;
+
+	if ((length > (s->srcSize - s->srcPos)) || (length > (s->dstSize - s->dstPos)))
+	{
+		return -1;
+	}
+
+	memcpy(s->dst + s->dstPos, s->src + s->srcPos, length);
+
+	s->dstPos += length;
+	s->srcPos += length;
+
+	return 0;
+}
+
+
+//==============================================================================
+
+static int inflateDynamic(InflateState * s)
+{
+	int			lengthCodes, distCodes, codeLengthCodes, index, symbol, repeat;
+	u_int8_t	lengths[kMaxLengthCodes + kMaxDistCodes], previous;
+
+	lengthCodes		= bits(s, 5) + 257;
+	distCodes		= bits(s, 5) + 1;
+	codeLengthCodes	= bits(s, 4) + 4;
+
+	if ((lengthCodes > kMaxLengthCodes) || (distCodes > kMaxDistCodes))
+	{
+		return -1;
+	}
+
+	bzero(lengths, 19);
+
+	for (index = 0; index < codeLengthCodes; index++)
+	{
+		lengths[codeLengthOrder[index]] = bits(s, 3);
+	}
+
+	if (buildHuffman(&gCodeLengthCode, lengths, 19) == -1)
+	{
+		return -1;
+	}
+
+	for (index = 0; index < (lengthCodes + distCodes); )
+	{
+		if ((symbol = decodeSymbol(s, &gCodeLengthCode)) < 0)
+		{
+			return -1;
+		}
+
+		if (symbol < 16)
+		{
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		previous = 0;
+
+		if (symbol == 16)
+		{
+			if (index == 0)
+			{
+				return -1;
+			}
+
+			previous = lengths[index - 1];
+			repeat = 3 + bits(s, 2);
+		}
+		else if (symbol == 17)
+		{
+			repeat = 3 + bits(s, 3);
+		}
+		else
+		{
+			repeat = 11 + bits(s, 7);
+		}
+
+		if ((index + repeat) > (lengthCodes + distCodes))
+		{
+			return -1;
+		}
+
+		while (repeat--)
+		{
+			lengths[index++] = previous;
+		}
+	}
+
+	// There has to be an end-of-block code.
+	if (lengths[256] == 0)
+	{
+		return -1;
+	}
+
+	if ((buildHuffman(&gLengthCode, lengths, lengthCodes) == -1) ||
+		(buildHuffman(&gDistCode, lengths + lengthCodes, distCodes) == -1))
+	{
+		return -1;
+	}
+
+	return inflateCodes(s, &gLengthCode, &gDistCode);
+}
+
+
+//==============================================================================
+
+static int inflateFixed(InflateState * s)
+{
+	int			symbol;
+	u_int8_t	lengths[kFixedLengths];
+
+	if (!gFixedCodesBuilt)
+	{
+		for (symbol = 0; symbol < 144; symbol++)
+		{
+			lengths[symbol] = 8;
+		}
+
+		for (; symbol < 256; symbol++)
+		{
+			lengths[symbol] = 9;
+		}
+
+		for (; symbol < 280; symbol++)
+		{
+			lengths[symbol] = 7;
+		}
+
+		for (; symbol < kFixedLengths; symbol++)
+		{
+			lengths[symbol] = 8;
+		}
+
+		buildHuffman(&gFixedLengthCode, lengths, kFixedLengths);
+
+		for (symbol = 0; symbol < kMaxDistCodes; symbol++)
+		{
+			lengths[symbol] = 5;
+		}
+
+		buildHuffman(&gFixedDistCode, lengths, kMaxDistCodes);
+
+		gFixedCodesBuilt = true;
+	}
+
+	return inflateCodes(s, &gFixedLengthCode, &gFixedDistCode);
+}
+
+
+//==============================================================================
+// Decompresses a zlib stream. Returns the number of bytes stored at dst, or -1
+// for a damaged stream (or one that doesn't fit in dstSize bytes).
+
+long decompressZlib(u_int8_t * dst, u_int32_t dstSize, const u_int8_t * src, u_int32_t srcSize)
+{
+	int				last, type, result;
+	InflateState	state;
+
+	// Header: deflate, no preset dictionary, and the check bits.
+	if ((srcSize < 2) || ((src[0] & 0x0F) != 8) || (src[1] & 0x20) || ((((src[0] << 8) | src[1]) % 31) != 0))
+	{
+		return -1;
+	}
+
+	state.dst		= dst;
+	state.dstSize	= dstSize;
+	state.dstPos	= 0;
+	state.src		= src;
+	state.srcSize	= srcSize;
+	state.srcPos	= 2;
+	state.bitBuffer	= 0;
+	state.bitCount	= 0;
+
+	do
+	{
+		last = bits(&state, 1);
+		type = bits(&state, 2);
+
+		switch (type)
+		{
+			case 0:
+				result = inflateStored(&state);
+				break;
+
+			case 1:
+				result = inflateFixed(&state);
+				break;
+
+			case 2:
+				result = inflateDynamic(&state);
+				break;
+
+			default:
+				result = -1;
+		}
+
+		// Ran out of input (zeros were decoded)?
+		if ((state.srcPos - (state.bitCount >> 3)) > srcSize)
+		{
+			result = -1;
+		}
+
+		if (result == -1)
+		{
+			return -1;
+		}
+	} while (!last);
+
+	return state.dstPos;
+}
@@ -0,0 +1,70 @@
+/*
+ * Disk I/O trace records, published as property 'boot-io-trace' under
+ * /efi/platform when IO_TRACE_SUPPORT is set (see disk.c). Also included
+ * by the decoder in libsaio/tools/iotrace.c – keep it free of booter types.
+ */
+
+#ifndef __LIBSAIO_IOTRACE_H
+#define __LIBSAIO_IOTRACE_H
+
+#include <stdint.h>
+
+
+#define IO_TRACE_SIGNATURE		0x52544F49		// 'IOTR'
+#define IO_TRACE_VERSION		1
+#define IO_TRACE_RECORDS		2048			// Ring size (64 KB).
+
+// Callers of the disk layer (what the read was for).
+enum
+{
+	kIOTraceOther			= 0,
+	kIOTraceGPT				= 1,
+	kIOTraceHFSMetadata		= 2,
+	kIOTraceFileData		= 3
+};
+
+// Record flags.
+#define kIOTraceHit				0x01		// Served from the sector cache (no device access).
+#define kIOTraceBulk			0x02		// Issued by bulkRead() (sector cache bypassed).
+#define kIOTraceError			0x04		// Read failed.
+
+
+typedef struct IOTraceRecord
+{
+	uint64_t	tscStart;
+	uint64_t	tscEnd;
+	uint64_t	lba;
+	uint32_t	count;						// Sectors (512 bytes).
+	uint8_t		biosdev;
+	uint8_t		flags;
+	uint8_t		subsystem;
+	uint8_t		reserved;
+} IOTraceRecord;
+
+
+typedef struct IOTraceHeader
+{
+	uint32_t	signature;
+	uint32_t	version;
+	uint32_t	capacity;					// Number of records in the ring.
+	uint32_t	total;						// Number of records written (oldest is at total % capacity when wrapped).
+	uint64_t	tscFrequency;				// In Hz.
+} IOTraceHeader;
+
+
+typedef struct IOTrace
+{
+	IOTraceHeader	header;
+	IOTraceRecord	records[IO_TRACE_RECORDS];
+} IOTrace;
+
+
+#if IO_TRACE_SUPPORT
+	extern uint8_t gIOTraceSubsystem;
+
+	#define IO_TRACE_SUBSYSTEM(subsystem)	gIOTraceSubsystem = (subsystem)
+#else
+	#define IO_TRACE_SUBSYSTEM(subsystem)
+#endif
+
+#endif /* !__LIBSAIO_IOTRACE_H */
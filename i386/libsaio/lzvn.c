@@ -0,0 +1,210 @@
+/*
+ * LZVN decoder, for the LZVN compressed files of HFS+ (decmpfs) and for LZVN
+ * compressed kernels and kernelcaches.
+ *
+ * An LZVN stream is a series of opcodes, each one emitting a number of literal
+ * bytes (L, copied from the stream) followed by a match (M bytes copied from D
+ * bytes back in the output). The opcode forms:
+ *
+ *   sml_d  LLMMMDDD DDDDDDDD <L>        L 0-3, M 3-(10 - 2L), D < 1536 (low bits != 6/7)
+ *   med_d  101LLMMM DDDDDDMM DDDDDDDD   L 0-3, M 3-34, D < 16384
+ *   lrg_d  LLMMM111 DDDDDDDD DDDDDDDD   L 0-3, M 3-(10 - 2L), D < 65536 (little endian)
+ *   pre_d  LLMMM110 <L>                 L 0-3, M 3-(10 - 2L), previous D
+ *   sml_m  1111MMMM                     M 1-15, previous D
+ *   lrg_m  11110000 MMMMMMMM            M 16-271, previous D
+ *   sml_l  1110LLLL <L>                 L 1-15
+ *   lrg_l  11100000 LLLLLLLL <L>        L 16-271
+ *   nop    00001110 or 00010110
+ *   eos    00000110 (followed by 7 zero bytes)
+ *
+ * Other opcodes (00xxx110 not listed above, 0x70-0x7F and 0xD0-0xDF) are invalid.
+ */
+
+#include "libsaio.h"
+
+
+//==============================================================================
+// Decompresses an LZVN stream. Returns the number of bytes stored at dst, or -1
+// for a damaged stream (or one that doesn't fit in dstSize bytes).
+
+long decompressLZVN(u_int8_t * dst, u_int32_t dstSize, const u_int8_t * src, u_int32_t srcSize)
+{
+	u_int8_t		opcode, *to, *from;
+	u_int32_t		literals, match, opcodeLength;
+	u_int32_t		dist = 0;
+	u_int8_t		*dstEnd = dst + dstSize;
+	u_int8_t		*dstStart = dst;
+	const u_int8_t	*srcEnd = src + srcSize;
+
+	while (src < srcEnd)
+	{
+		opcode = *src;
+
+		switch (opcode >> 4)
+		{
+			case 0x0: case 0x1: case 0x2: case 0x3:
+			case 0x4: case 0x5: case 0x6:
+			case 0x8: case 0x9:
+			case 0xC:
+				literals = opcode >> 6;
+				match = ((opcode >> 3) & 7) + 3;
+
+				switch (opcode & 7)
+				{
+					case 6:
+						if (opcode < 0x40)
+						{
+							if (opcode == 0x06)
+							{
+								return dst - dstStart;			// eos
+							}
+
+							if ((opcode == 0x0E) || (opcode == 0x16))
+							{
+								src++;							// nop
+								continue;
+							}
+
+							return -1;							// udef
+						}
+
+						opcodeLength = 1;						// pre_d
+						break;
+
+					case 7:
+						if ((src + 3) > srcEnd)
+						{
+							return -1;
+						}
+
+						dist = src[1] | (src[2] << 8);			// lrg_d
+						opcodeLength = 3;
+						break;
+
+					default:
+						if ((src + 2) > srcEnd)
+						{
+							return -1;
+						}
+
+						dist = ((opcode & 7) << 8) | src[1];	// sml_d
+						opcodeLength = 2;
+				}
+				break;
+
+			case 0xA: case 0xB:
+				if ((src + 3) > srcEnd)
+				{
+					return -1;
+				}
+
+				literals = (opcode >> 3) & 3;					// med_d
+				match = (((opcode & 7) << 2) | (src[1] & 3)) + 3;
+				dist = (src[1] >> 2) | (src[2] << 6);
+				opcodeLength = 3;
+				break;
+
+			case 0xE:
+				if (opcode == 0xE0)
+				{
+					if ((src + 2) > srcEnd)
+					{
+						return -1;
+					}
+
+					literals = src[1] + 16;						// lrg_l
+					opcodeLength = 2;
+				}
+				else
+				{
+					literals = opcode & 0x0F;					// sml_l
+					opcodeLength = 1;
+				}
+
+				match = 0;
+				break;
+
+			case 0xF:
+				if (opcode == 0xF0)
+				{
+					if ((src + 2) > srcEnd)
+					{
+						return -1;
+					}
+
+					match = src[1] + 16;						// lrg_m
+					opcodeLength = 2;
+				}
+				else
+				{
+					match = opcode & 0x0F;						// sml_m
+					opcodeLength = 1;
+				}
+
+				literals = 0;
+				break;
+
+			default:
+				return -1;										// udef (0x70-0x7F, 0xD0-0xDF)
+		}
+
+		src += opcodeLength;
+
+		// Literals (mostly 0-3, copied as a word when there is room for it).
+		if (literals)
+		{
+			if ((literals > (u_int32_t)(srcEnd - src)) || (literals > (u_int32_t)(dstEnd - dst)))
+			{
+				return -1;
+			}
+
+			if ((literals <= 4) && ((srcEnd - src) >= 4) && ((dstEnd - dst) >= 4))
+			{
+				*(u_int32_t *)dst = *(u_int32_t *)src;
+			}
+			else
+			{
+				memcpy(dst, src, literals);
+			}
+
+			dst += literals;
+			src += literals;
+		}
+
+		// Match.
+		if (match)
+		{
+			if ((dist == 0) || (dist > (u_int32_t)(dst - dstStart)) || (match > (u_int32_t)(dstEnd - dst)))
+			{
+				return -1;
+			}
+
+			from = dst - dist;
+			to = dst;
+			dst += match;
+
+			if ((dist >= 8) && ((u_int32_t)(dstEnd - to) >= (match + 8)))
+			{
+				// Eight bytes at a time (may write up to seven bytes past the match,
+				// which the next opcodes overwrite).
+				do
+				{
+					*(u_int32_t *)to = *(u_int32_t *)from;
+					*(u_int32_t *)(to + 4) = *(u_int32_t *)(from + 4);
+					to += 8;
+					from += 8;
+				} while (to < dst);
+			}
+			else
+			{
+				// Overlapping (repeats the last dist bytes), or near the end.
+				while (match--)
+				{
+					*to++ = *from++;
+				}
+			}
+		}
+	}
+
+	return -1;	// No end of stream marker.
+}
@@ -0,0 +1,686 @@
+/*
+ * Native NVMe read support. Namespaces on NVMe controllers are read with polled
+ * commands on a single I/O queue pair, transferring straight into the target
+ * buffer (via PRP lists) instead of bouncing through BIOS_ADDR like INT13 does.
+ *
+ * Unlike AHCI ports, an NVMe controller cannot be borrowed from the option ROM:
+ * the state of its queues is unknown, so the controller is reset and set up from
+ * scratch. INT13 can no longer be used for its drives after that, which is why
+ * the MBR and GPT header of all BIOS hard drives are captured first (see
+ * diskReadSignature), and drives are claimed by matching against that data.
+ */
+
+#include "libsaio.h"
+#include "platform.h"
+#include "pci.h"
+#include "cpu/proc_reg.h"
+
+
+#if NVME_SUPPORT
+
+#define NVME_CLASS_CODE			0x010802	// Mass storage, Non-Volatile memory, NVM Express
+
+#define NVME_MAX_CONTROLLERS	4
+#define NVME_MAX_NAMESPACES		8
+
+// Controller registers.
+#define NVME_CAP				0x00
+#define NVME_CC					0x14
+#define NVME_CSTS				0x1C
+#define NVME_AQA				0x24
+#define NVME_ASQ				0x28
+#define NVME_ACQ				0x30
+#define NVME_DOORBELLS			0x1000
+
+#define NVME_CC_EN				0x00000001
+#define NVME_CC_IOSQES			(6 << 16)	// 64 byte submission queue entries.
+#define NVME_CC_IOCQES			(4 << 20)	// 16 byte completion queue entries.
+
+#define NVME_CSTS_RDY			0x00000001
+#define NVME_CSTS_CFS			0x00000002
+
+// Admin commands.
+#define NVME_ADMIN_CREATE_SQ	0x01
+#define NVME_ADMIN_CREATE_CQ	0x05
+#define NVME_ADMIN_IDENTIFY		0x06
+
+// NVM commands.
+#define NVME_CMD_READ			0x02
+
+#define NVME_PAGE_SIZE			4096		// CC.MPS = 0
+#define NVME_QUEUE_ENTRIES		16			// Plenty for polled, one at a time, commands.
+#define NVME_MAX_PAGES			256			// 1 MB per command (PRP list fits in one page).
+#define NVME_BOUNCE_SIZE		(64 * 1024)	// For unaligned buffers and partial blocks.
+
+#define NVME_TIMEOUT_MS			5000
+
+
+typedef struct
+{
+	uint32_t	cdw0;						// Opcode (7:0) and command identifier (31:16).
+	uint32_t	nsid;
+	uint32_t	reserved[2];
+	uint64_t	metadata;
+	uint64_t	prp1;
+	uint64_t	prp2;
+	uint32_t	cdw10;
+	uint32_t	cdw11;
+	uint32_t	cdw12;
+	uint32_t	cdw13;
+	uint32_t	cdw14;
+	uint32_t	cdw15;
+} NVMeCommand;
+
+
+typedef struct
+{
+	uint32_t	result;
+	uint32_t	reserved;
+	uint16_t	sqHead;
+	uint16_t	sqID;
+	uint16_t	commandID;
+	uint16_t	status;						// Phase tag (bit 0) and status field.
+} NVMeCompletion;
+
+
+typedef struct
+{
+	uint16_t					id;
+	uint16_t					sqTail;
+	uint16_t					cqHead;
+	uint16_t					phase;
+	NVMeCommand *				sq;
+	volatile NVMeCompletion *	cq;
+} NVMeQueue;
+
+
+typedef struct
+{
+	volatile uint8_t *	regs;
+	uint32_t			doorbellStride;
+	uint32_t			readyTimeout;		// In milliseconds (CAP.TO).
+	uint32_t			maxPages;			// Per command (CAP.MPSMIN and MDTS).
+	uint16_t			commandID;
+	bool				failed;				// Set after a timeout (see nvmeSubmit).
+
+	NVMeQueue			admin;
+	NVMeQueue			io;
+
+	uint64_t *			prpList;
+	char *				bounce;				// Also used for identify data.
+} NVMeController;
+
+
+typedef struct
+{
+	NVMeController *	controller;
+	uint32_t			nsid;
+	uint32_t			blockShift;			// log2 of the LBA size (9 for 512 bytes).
+	int					biosdev;			// -1 until claimed by nvmeProbe().
+	bool				unusable;			// Set when reading the signature failed.
+	char *				signature;			// See nvmeReadSignature (read on first probe).
+} NVMeNamespace;
+
+
+static NVMeController gNVMeControllers[NVME_MAX_CONTROLLERS];
+static int gNVMeControllerCount = 0;
+
+static NVMeNamespace gNVMeNamespaces[NVME_MAX_NAMESPACES];
+static int gNVMeNamespaceCount = 0;
+
+static bool nvmeProbe(int biosdev, const void * signature);
+static int  nvmeRead(int biosdev, unsigned long long secno, unsigned int count, void * buffer);
+
+static struct DiskBackend gNVMeBackend =
+{
+	.name			= "NVMe",
+	.probe			= nvmeProbe,
+	.read			= nvmeRead,
+	.next			= NULL
+};
+
+
+//==============================================================================
+
+static inline uint32_t nvmeReadReg(NVMeController * controller, uint32_t reg)
+{
+	return *(volatile uint32_t *)(controller->regs + reg);
+}
+
+
+//==============================================================================
+
+static inline void nvmeWriteReg(NVMeController * controller, uint32_t reg, uint32_t value)
+{
+	*(volatile uint32_t *)(controller->regs + reg) = value;
+}
+
+
+//==============================================================================
+
+static inline uint64_t nvmeDeadline(uint32_t ms)
+{
+	// Assume a fast CPU when the TSC frequency is unknown (longer timeout).
+	uint64_t tscPerMs = (gPlatform.CPU.TSCFrequency ? gPlatform.CPU.TSCFrequency : 4000000000ULL) / 1000;
+
+	return rdtsc64() + (ms * tscPerMs);
+}
+
+
+//==============================================================================
+// Waits (up to ms milliseconds) for (CSTS & NVME_CSTS_RDY) == ready.
+
+static bool nvmeWaitReady(NVMeController * controller, uint32_t ready, uint32_t ms)
+{
+	uint64_t deadline = nvmeDeadline(ms);
+
+	do
+	{
+		uint32_t csts = nvmeReadReg(controller, NVME_CSTS);
+
+		if ((csts != 0xFFFFFFFF) && ((csts & NVME_CSTS_RDY) == ready))
+		{
+			return true;
+		}
+	} while (rdtsc64() < deadline);
+
+	return false;
+}
+
+
+//==============================================================================
+
+static void * nvmeAlloc(uint32_t size)
+{
+	char * buffer = malloc(size + NVME_PAGE_SIZE);
+
+	if (buffer)
+	{
+		buffer = (char *)(((uint32_t)buffer + NVME_PAGE_SIZE - 1) & ~(NVME_PAGE_SIZE - 1));
+		bzero(buffer, size);
+	}
+
+	return buffer;
+}
+
+
+//==============================================================================
+// Submits a command and polls for its completion. Returns the status field
+// (0 on success) or -1 on a timeout.
+//
+// A command that timed out may still complete, and write to its buffer, at any
+// time later on. The controller is therefore not used again after a timeout, and
+// completions for other commands than ours (which shouldn't be there) are skipped.
+
+static int nvmeSubmit(NVMeController * controller, NVMeQueue * queue, NVMeCommand * command)
+{
+	volatile NVMeCompletion * completion;
+	uint64_t deadline;
+	uint16_t commandID;
+	int status;
+
+	if (controller->failed)
+	{
+		return -1;
+	}
+
+	commandID = ++controller->commandID;
+	command->cdw0 |= ((uint32_t)commandID << 16);
+
+	bcopy(command, &queue->sq[queue->sqTail], sizeof(NVMeCommand));
+
+	queue->sqTail = ((queue->sqTail + 1) % NVME_QUEUE_ENTRIES);
+
+	nvmeWriteReg(controller, (NVME_DOORBELLS + ((2 * queue->id) * controller->doorbellStride)), queue->sqTail);
+
+	deadline = nvmeDeadline(NVME_TIMEOUT_MS);
+
+	do
+	{
+		completion = &queue->cq[queue->cqHead];
+
+		while ((completion->status & 1) != queue->phase)
+		{
+			if (rdtsc64() > deadline)
+			{
+				controller->failed = true;
+
+				_DISK_DEBUG_DUMP("NVMe: command %d timed out (controller disabled)\n", commandID);
+
+				return -1;
+			}
+		}
+
+		status = (completion->status >> 1);
+
+		if (++queue->cqHead == NVME_QUEUE_ENTRIES)
+		{
+			queue->cqHead = 0;
+			queue->phase ^= 1;
+		}
+
+		nvmeWriteReg(controller, (NVME_DOORBELLS + ((2 * queue->id + 1) * controller->doorbellStride)), queue->cqHead);
+	} while (completion->commandID != commandID);
+
+	return status;
+}
+
+
+//==============================================================================
+
+static int nvmeIdentify(NVMeController * controller, uint32_t nsid, uint32_t cns)
+{
+	NVMeCommand command;
+
+	bzero(&command, sizeof(command));
+
+	command.cdw0	= NVME_ADMIN_IDENTIFY;
+	command.nsid	= nsid;
+	command.prp1	= (uint32_t)controller->bounce;
+	command.cdw10	= cns;
+
+	return nvmeSubmit(controller, &controller->admin, &command);
+}
+
+
+//==============================================================================
+// Reads blocks (in the LBA size of the namespace) into a dword aligned buffer.
+
+static int nvmeReadBlocks(NVMeNamespace * ns, uint64_t lba, uint32_t blocks, char * buffer)
+{
+	NVMeController * controller = ns->controller;
+	NVMeCommand command;
+
+	uint32_t bytes = (blocks << ns->blockShift);
+	uint32_t first = (NVME_PAGE_SIZE - ((uint32_t)buffer & (NVME_PAGE_SIZE - 1)));
+
+	bzero(&command, sizeof(command));
+
+	command.cdw0	= NVME_CMD_READ;
+	command.nsid	= ns->nsid;
+	command.prp1	= (uint32_t)buffer;
+	command.cdw10	= (uint32_t)lba;
+	command.cdw11	= (uint32_t)(lba >> 32);
+	command.cdw12	= (blocks - 1);
+
+	if (bytes > first)
+	{
+		if (bytes <= (first + NVME_PAGE_SIZE))
+		{
+			command.prp2 = (uint32_t)(buffer + first);
+		}
+		else
+		{
+			uint32_t i, page = ((uint32_t)buffer + first);
+
+			for (i = 0; page < ((uint32_t)buffer + bytes); i++, page += NVME_PAGE_SIZE)
+			{
+				controller->prpList[i] = page;
+			}
+
+			command.prp2 = (uint32_t)controller->prpList;
+		}
+	}
+
+	return nvmeSubmit(controller, &controller->io, &command) ? -1 : 0;
+}
+
+
+//==============================================================================
+// Reads count 512-byte sectors, translating them to larger LBAs when needed.
+
+static int nvmeReadSectors(NVMeNamespace * ns, unsigned long long secno, unsigned int count, char * buffer)
+{
+	NVMeController * controller = ns->controller;
+
+	uint32_t shift			= (ns->blockShift - 9);
+	uint32_t maxBlocks		= (((controller->maxPages - 1) * NVME_PAGE_SIZE) >> ns->blockShift);
+	uint32_t bounceBlocks	= (NVME_BOUNCE_SIZE >> ns->blockShift);
+
+	while (count)
+	{
+		uint64_t lba = (secno >> shift);
+		uint32_t offset = (secno & ((1 << shift) - 1));
+		uint32_t blocks = ((count >> shift) > maxBlocks) ? maxBlocks : (count >> shift);
+		uint32_t nsecs;
+
+		if ((offset == 0) && blocks && (((uint32_t)buffer & 3) == 0))
+		{
+			// Whole blocks straight into the target buffer.
+			if (nvmeReadBlocks(ns, lba, blocks, buffer) != 0)
+			{
+				return -1;
+			}
+
+			nsecs = (blocks << shift);
+		}
+		else
+		{
+			// Unaligned buffer, or a partial block (only with LBAs larger than 512 bytes).
+			blocks = (((offset + count) + (1 << shift) - 1) >> shift);
+			blocks = (blocks > bounceBlocks) ? bounceBlocks : blocks;
+
+			if (nvmeReadBlocks(ns, lba, blocks, controller->bounce) != 0)
+			{
+				return -1;
+			}
+
+			nsecs = ((blocks << shift) - offset);
+			nsecs = (nsecs > count) ? count : nsecs;
+
+			bcopy((controller->bounce + (offset * 512)), buffer, (nsecs * 512));
+		}
+
+		secno	+= nsecs;
+		buffer	+= (nsecs * 512);
+		count	-= nsecs;
+	}
+
+	return 0;
+}
+
+
+//==============================================================================
+// Backend read function (see struct DiskBackend).
+
+static int nvmeRead(int biosdev, unsigned long long secno, unsigned int count, void * buffer)
+{
+	int i;
+
+	for (i = 0; i < gNVMeNamespaceCount; i++)
+	{
+		if ((gNVMeNamespaces[i].biosdev == biosdev) && !gNVMeNamespaces[i].controller->failed)
+		{
+			return nvmeReadSectors(&gNVMeNamespaces[i], secno, count, buffer);
+		}
+	}
+
+	return -1;
+}
+
+
+//==============================================================================
+// Reads the signature of a namespace: the first 512 bytes of LBA 0 (MBR) and of
+// LBA 1 (GPT header, with the disk GUID), in the LBA size of the namespace, like
+// diskReadSignature() does.
+
+static int nvmeReadSignature(NVMeNamespace * ns, char * signature)
+{
+	NVMeController * controller = ns->controller;
+
+	if (nvmeReadBlocks(ns, 0, 2, controller->bounce) != 0)
+	{
+		return -1;
+	}
+
+	bcopy(controller->bounce, signature, 512);
+	bcopy((controller->bounce + (1 << ns->blockShift)), (signature + 512), 512);
+
+	return 0;
+}
+
+
+//==============================================================================
+// Backend probe function. Claims biosdev for the first of our (unclaimed)
+// namespaces with the same signature. INT13 can't read our drives anymore (see
+// nvmeInit), so when two of them look the same (cloned disks) one of them still
+// has to be picked; they are offered in BIOS order, and taken in ours.
+
+static bool nvmeProbe(int biosdev, const void * signature)
+{
+	int i;
+
+	for (i = 0; i < gNVMeNamespaceCount; i++)
+	{
+		NVMeNamespace * ns = &gNVMeNamespaces[i];
+
+		if ((ns->biosdev >= 0) || ns->unusable || ns->controller->failed)
+		{
+			continue;
+		}
+
+		if (ns->signature == NULL)
+		{
+			ns->signature = malloc(DISK_SIGNATURE_SIZE);
+
+			if ((ns->signature == NULL) || (nvmeReadSignature(ns, ns->signature) != 0))
+			{
+				ns->unusable = true;
+
+				continue;
+			}
+		}
+
+		if (memcmp(ns->signature, signature, DISK_SIGNATURE_SIZE) == 0)
+		{
+			ns->biosdev = biosdev;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+//==============================================================================
+// Resets the controller and sets up the admin queue and one I/O queue pair.
+
+static bool nvmeInitController(NVMeController * controller)
+{
+	NVMeCommand command;
+
+	uint32_t capLow		= nvmeReadReg(controller, NVME_CAP);
+	uint32_t capHigh	= nvmeReadReg(controller, (NVME_CAP + 4));
+
+	// We use 4 KB memory pages, and at least two queue entries are required.
+	if ((capLow == 0xFFFFFFFF) || (((capHigh >> 16) & 0x0F) != 0) || ((capLow & 0xFFFF) < (NVME_QUEUE_ENTRIES - 1)))
+	{
+		return false;
+	}
+
+	controller->doorbellStride	= (4 << (capHigh & 0x0F));
+	controller->readyTimeout	= ((((capLow >> 24) & 0xFF) + 1) * 500);
+	controller->maxPages		= NVME_MAX_PAGES;
+
+	controller->admin.sq	= nvmeAlloc(NVME_QUEUE_ENTRIES * sizeof(NVMeCommand));
+	controller->admin.cq	= nvmeAlloc(NVME_QUEUE_ENTRIES * sizeof(NVMeCompletion));
+	controller->io.sq		= nvmeAlloc(NVME_QUEUE_ENTRIES * sizeof(NVMeCommand));
+	controller->io.cq		= nvmeAlloc(NVME_QUEUE_ENTRIES * sizeof(NVMeCompletion));
+	controller->prpList		= nvmeAlloc(NVME_PAGE_SIZE);
+	controller->bounce		= nvmeAlloc(NVME_BOUNCE_SIZE);
+
+	if (!controller->admin.sq || !controller->admin.cq || !controller->io.sq || !controller->io.cq || !controller->prpList || !controller->bounce)
+	{
+		return false;
+	}
+
+	controller->admin.id	= 0;
+	controller->admin.phase	= 1;
+	controller->io.id		= 1;
+	controller->io.phase	= 1;
+
+	// Disable the controller (drops all queues set up by the option ROM).
+	nvmeWriteReg(controller, NVME_CC, (nvmeReadReg(controller, NVME_CC) & ~NVME_CC_EN));
+
+	if (!nvmeWaitReady(controller, 0, controller->readyTimeout))
+	{
+		return false;
+	}
+
+	nvmeWriteReg(controller, NVME_AQA, (((NVME_QUEUE_ENTRIES - 1) << 16) | (NVME_QUEUE_ENTRIES - 1)));
+	nvmeWriteReg(controller, NVME_ASQ, (uint32_t)controller->admin.sq);
+	nvmeWriteReg(controller, (NVME_ASQ + 4), 0);
+	nvmeWriteReg(controller, NVME_ACQ, (uint32_t)controller->admin.cq);
+	nvmeWriteReg(controller, (NVME_ACQ + 4), 0);
+
+	nvmeWriteReg(controller, NVME_CC, (NVME_CC_IOCQES | NVME_CC_IOSQES | NVME_CC_EN));
+
+	if (!nvmeWaitReady(controller, NVME_CSTS_RDY, controller->readyTimeout) || (nvmeReadReg(controller, NVME_CSTS) & NVME_CSTS_CFS))
+	{
+		return false;
+	}
+
+	// Maximum data transfer size (in units of the minimum page size).
+	if (nvmeIdentify(controller, 0, 1) != 0)
+	{
+		return false;
+	}
+
+	uint8_t mdts = ((uint8_t *)controller->bounce)[77];
+
+	if (mdts && (mdts < 8) && ((1U << mdts) < controller->maxPages))
+	{
+		controller->maxPages = (1 << mdts);
+	}
+
+	if (controller->maxPages < 2)
+	{
+		return false;
+	}
+
+	bzero(&command, sizeof(command));
+
+	command.cdw0	= NVME_ADMIN_CREATE_CQ;
+	command.prp1	= (uint32_t)controller->io.cq;
+	command.cdw10	= (((NVME_QUEUE_ENTRIES - 1) << 16) | controller->io.id);
+	command.cdw11	= 1;						// Physically contiguous, no interrupts.
+
+	if (nvmeSubmit(controller, &controller->admin, &command) != 0)
+	{
+		return false;
+	}
+
+	bzero(&command, sizeof(command));
+
+	command.cdw0	= NVME_ADMIN_CREATE_SQ;
+	command.prp1	= (uint32_t)controller->io.sq;
+	command.cdw10	= (((NVME_QUEUE_ENTRIES - 1) << 16) | controller->io.id);
+	command.cdw11	= ((controller->io.id << 16) | 1);	// Completion queue and physically contiguous.
+
+	return (nvmeSubmit(controller, &controller->admin, &command) == 0);
+}
+
+
+//==============================================================================
+
+static void nvmeInitNamespaces(NVMeController * controller)
+{
+	uint32_t nsid, namespaces;
+
+	if (nvmeIdentify(controller, 0, 1) != 0)
+	{
+		return;
+	}
+
+	namespaces = *(uint32_t *)(controller->bounce + 516);
+
+	for (nsid = 1; (nsid <= namespaces) && (gNVMeNamespaceCount < NVME_MAX_NAMESPACES); nsid++)
+	{
+		if (nvmeIdentify(controller, nsid, 0) != 0)
+		{
+			continue;
+		}
+
+		uint64_t blocks = *(uint64_t *)controller->bounce;
+		uint8_t format = (((uint8_t *)controller->bounce)[26] & 0x0F);
+		uint8_t blockShift = ((uint8_t *)controller->bounce)[128 + (format * 4) + 2];
+
+		// Inactive namespace, or an LBA size we can't handle (metadata is ignored).
+		if ((blocks == 0) || (blockShift < 9) || (blockShift > 12))
+		{
+			continue;
+		}
+
+		NVMeNamespace * ns = &gNVMeNamespaces[gNVMeNamespaceCount++];
+
+		bzero(ns, sizeof(NVMeNamespace));
+
+		ns->controller	= controller;
+		ns->nsid		= nsid;
+		ns->blockShift	= blockShift;
+		ns->biosdev		= -1;
+
+		_DISK_DEBUG_DUMP("NVMe namespace %d: %d MB (%d byte blocks)\n", nsid, (uint32_t)(blocks >> (20 - blockShift)), (1 << blockShift));
+	}
+}
+
+
+//==============================================================================
+// Called from initPartitionChain() in sys.c
+
+void nvmeInit(void)
+{
+	int i, biosdev;
+	PCIDevice_t * devices;
+	int deviceCount = pciGetDevices(&devices, NULL);
+	char signature[DISK_SIGNATURE_SIZE];
+	bool signaturesRead = false;
+
+	for (i = 0; (i < deviceCount) && (gNVMeControllerCount < NVME_MAX_CONTROLLERS); i++)
+	{
+		if (devices[i].classCode != NVME_CLASS_CODE)
+		{
+			continue;
+		}
+
+		uint32_t bar0 = pciConfigRead(READ_LONG, devices[i].address, PCI_BAR0);
+
+		// 64-bit BARs mapped above 4 GB are out of reach.
+		if (((bar0 & 0x06) == 0x04) && pciConfigRead(READ_LONG, devices[i].address, (PCI_BAR0 + 4)))
+		{
+			continue;
+		}
+
+		bar0 &= ~0x0F;
+
+		if (bar0 == 0)
+		{
+			continue;
+		}
+
+		// Capture what INT13 sees before the first controller is taken away from it.
+		if (!signaturesRead)
+		{
+			for (biosdev = kBIOSDevTypeHardDrive; biosdev < (kBIOSDevTypeHardDrive + 8); biosdev++)
+			{
+				diskReadSignature(biosdev, signature);
+			}
+
+			signaturesRead = true;
+		}
+
+		uint16_t command = pciConfigRead(READ_WORD, devices[i].address, PCI_COMMAND);
+
+		if ((command & (PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER)) != (PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER))
+		{
+			pciConfigWrite16(devices[i].address, PCI_COMMAND, (command | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER));
+		}
+
+		NVMeController * controller = &gNVMeControllers[gNVMeControllerCount];
+
+		bzero(controller, sizeof(NVMeController));
+
+		controller->regs = (volatile uint8_t *)bar0;
+
+		_DISK_DEBUG_DUMP("NVMe controller %04x:%04x at 0x%x\n", devices[i].vendorID, devices[i].deviceID, bar0);
+
+		if (!nvmeInitController(controller))
+		{
+			_DISK_DEBUG_DUMP("NVMe controller %04x:%04x: initialization failed\n", devices[i].vendorID, devices[i].deviceID);
+
+			continue;
+		}
+
+		gNVMeControllerCount++;
+
+		nvmeInitNamespaces(controller);
+	}
+
+	if (gNVMeNamespaceCount)
+	{
+		diskRegisterBackend(&gNVMeBackend);
+	}
+}
+
+#endif // NVME_SUPPORT
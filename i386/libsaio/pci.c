@@ -36,3 +36,102 @@ uint32_t pciConfigRead(uint8_t readType, uint32_t pciAddress, uint8_t pciRegiste
 	return data;
 }
 
+
+//==============================================================================
+
+void pciConfigWrite(uint8_t writeType, uint32_t pciAddress, uint8_t pciRegister, uint32_t data)
+{
+	pciAddress |= (pciRegister & ~3);
+	outl(PCI_ADDR_REG, pciAddress);
+
+	switch (writeType)
+	{
+		case WRITE_BYTE: 
+				outb(PCI_DATA_REG + (pciRegister & 3), data);
+			break;
+		
+		case WRITE_WORD: 
+				outw(PCI_DATA_REG + (pciRegister & 2), data);
+			break;
+
+		case WRITE_LONG: 
+				outl(PCI_DATA_REG, data);
+			break;
+	}
+}
+
+
+//==============================================================================
+// Brute force scan of all PCI buses (done once). Returns the number of devices
+// found, with devices pointing to the (static) device table. Devices beyond the
+// first PCI_MAX_DEVICES are left out, in which case *truncated (optional) is set.
+
+int pciGetDevices(PCIDevice_t ** devices, bool * truncated)
+{
+	static PCIDevice_t pciDevices[PCI_MAX_DEVICES];
+	static int pciDeviceCount = -1;
+	static bool pciDevicesTruncated = false;
+
+	uint32_t bus, dev, func, address, id;
+
+	if (pciDeviceCount < 0)
+	{
+		pciDeviceCount = 0;
+
+		for (bus = 0; bus < 256; bus++)
+		{
+			for (dev = 0; dev < 32; dev++)
+			{
+				for (func = 0; func < 8; func++)
+				{
+					address = PCIADDR(bus, dev, func);
+					id = pciConfigRead(READ_LONG, address, PCI_VENDOR_ID);
+
+					if ((id & 0xFFFF) == 0xFFFF)
+					{
+						if (func == 0)
+						{
+							break; // No device.
+						}
+
+						continue;
+					}
+
+					if (pciDeviceCount < PCI_MAX_DEVICES)
+					{
+						PCIDevice_t * device = &pciDevices[pciDeviceCount++];
+
+						device->address		= address;
+						device->vendorID	= (id & 0xFFFF);
+						device->deviceID	= (id >> 16);
+						device->classCode	= (pciConfigRead(READ_LONG, address, PCI_CLASS_REVISION) >> 8);
+
+						id = pciConfigRead(READ_LONG, address, PCI_SUBSYSTEM_ID);
+
+						device->subVendorID	= (id & 0xFFFF);
+						device->subDeviceID	= (id >> 16);
+					}
+					else
+					{
+						pciDevicesTruncated = true;
+					}
+
+					// Skip functions 1-7 of single function devices.
+					if ((func == 0) && ((pciConfigRead(READ_BYTE, address, PCI_HEADER_TYPE) & 0x80) == 0))
+					{
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	*devices = pciDevices;
+
+	if (truncated)
+	{
+		*truncated = pciDevicesTruncated;
+	}
+
+	return pciDeviceCount;
+}
@@ -6,16 +6,51 @@
  *
  */
 
+#ifndef __LIBSAIO_PCI_H
+#define __LIBSAIO_PCI_H
+
 #define READ_BYTE	1
 #define READ_WORD	2
 #define READ_LONG	4
 
+#define WRITE_BYTE	READ_BYTE
+#define WRITE_WORD	READ_WORD
+#define WRITE_LONG	READ_LONG
+
 #define PCI_ADDR_REG	0xcf8
 #define PCI_DATA_REG	0xcfc
 
 #define PCIADDR(bus, dev, func)		(1 << 31) | (bus << 16) | (dev << 11) | (func << 8)
 
+#define PCI_MAX_DEVICES				128
+
+// Configuration space registers.
+#define PCI_VENDOR_ID				0x00
+#define PCI_COMMAND					0x04
+#define PCI_CLASS_REVISION			0x08
+#define PCI_HEADER_TYPE				0x0e
+#define PCI_BAR0					0x10
+#define PCI_BAR5					0x24
+#define PCI_SUBSYSTEM_ID			0x2c
+
+#define PCI_COMMAND_MEMORY			0x0002
+#define PCI_COMMAND_MASTER			0x0004
+
+
+typedef struct
+{
+	uint32_t	address;				// PCIADDR(bus, dev, func)
+	uint16_t	vendorID;
+	uint16_t	deviceID;
+	uint32_t	classCode;				// Base class, sub class and programming interface.
+	uint16_t	subVendorID;
+	uint16_t	subDeviceID;
+} PCIDevice_t;
+
+
 uint32_t pciConfigRead( uint8_t readType, uint32_t pciAddress, uint8_t pciRegister);
+void pciConfigWrite(uint8_t writeType, uint32_t pciAddress, uint8_t pciRegister, uint32_t data);
+int pciGetDevices(PCIDevice_t ** devices, bool * truncated);
 
 //==============================================================================
 // Note: Currently only called from: i386/libsaio/cpu/dynamic_data.h
@@ -34,3 +69,12 @@ static inline uint32_t pciConfigRead32(uint32_t pciAddress, uint8_t pciRegister)
 	return (uint32_t)pciConfigRead(READ_LONG, pciAddress, pciRegister);
 }
 
+
+//==============================================================================
+
+static inline void pciConfigWrite16(uint32_t pciAddress, uint8_t pciRegister, uint16_t data)
+{
+	pciConfigWrite(WRITE_WORD, pciAddress, pciRegister, data);
+}
+
+#endif /* !__LIBSAIO_PCI_H */
@@ -41,7 +41,7 @@ extern void   bios(biosBuf_t *bb);
 
 extern int	bgetc(void);
 extern int	biosread(int dev, int cyl, int head, int sec, int num);
-extern int	ebiosread(int dev, unsigned long long sec, int count);
+extern int	ebiosread(int dev, unsigned long long sec, int count, void * buffer);
 extern int	get_drive_info(int drive, struct driveInfo *dp);
 extern void	putc(int ch);
 extern void	putca(int ch, int attr, int repeat);
@@ -79,6 +79,7 @@ extern void	moveKernelBootArgs(void);
 extern void	CacheReset();
 extern void	CacheInit(CICell ih, long blockSize);
 extern long	CacheRead(CICell ih, char *buffer, long long offset, long length, long cache);
+extern void	CachePrintStats(void);
 
 /* console.c */
 extern bool	gVerboseMode;
@@ -91,8 +92,20 @@ extern int	verbose(const char *format, ...);
 extern void	stop(const char *format, ...);
 
 
+/* ahci.c */
+extern void		ahciInit(void);
+
+
+/* nvme.c */
+extern void		nvmeInit(void);
+
+
 /* disk.c */
 extern int		testBiosread( int biosdev, unsigned long long secno);
+extern void		diskPrintStats(void);
+extern void		diskRegisterBackend(struct DiskBackend * backend);
+extern bool		diskReadSignature(int biosdev, void * signature);
+extern void *	diskGetIOTrace(uint32_t * size);
 extern BVRef	diskScanBootVolumes(int biosdev, int *count);
 extern BVRef	diskScanGPTBootVolumes(int biosdev, int *count);
 extern void		diskSeek(BVRef bvr, long long position);
@@ -112,18 +125,29 @@ extern int	  testFAT32EFIBootSector( int biosdev, unsigned int secno, void * buf
 
 /* hfs_compare.c */
 extern int32_t FastUnicodeCompare(u_int16_t *uniStr1, u_int32_t len1, u_int16_t *uniStr2, u_int32_t len2, int byte_order);
+extern int32_t FastUnicodeCompareFolded(u_int16_t *folded, u_int32_t len1, u_int16_t *uniStr2, u_int32_t len2);
+extern u_int32_t FoldUnicodeString(u_int16_t *uniStr, u_int32_t len, u_int16_t *folded);
 extern void utf_encodestr( const u_int16_t * ucsp, int ucslen, u_int8_t * utf8p, u_int32_t bufsize, int byte_order );
 extern void utf_decodestr(const u_int8_t *utf8p, u_int16_t *ucsp, u_int16_t *ucslen, u_int32_t bufsize, int byte_order );
 
 
+/* inflate.c */
+extern long decompressZlib(u_int8_t *dst, u_int32_t dstSize, const u_int8_t *src, u_int32_t srcSize);
+
+
 /* load.c */
 extern bool gLoadKernelDrivers;
 extern long ThinFatFile(void **binary, unsigned long *length);
 extern long DecodeMachO(void *binary, entry_t *rentry, char **raddr, int *rsize);
 
 
+/* lzvn.c */
+extern long decompressLZVN(u_int8_t *dst, u_int32_t dstSize, const u_int8_t *src, u_int32_t srcSize);
+
+
 /* memory.c */
 long AllocateKernelMemory( long inSize );
+void ReleaseKernelMemory(long address);
 long AllocateMemoryRange(char * rangeName, long start, long length, long type);
 
 
@@ -161,6 +185,7 @@ extern long   LoadThinFatFile(const char *fileSpec, void **binary);
 extern long   GetDirEntry(const char *dirSpec, long *dirIndex, const char **name, long *flags, long *time);
 extern long   GetFileInfo(const char *dirSpec, const char *name,long *flags, long *time);
 extern long   GetFileBlock(const char *fileSpec, unsigned long long *firstBlock);
+extern long   GetFileSize(const char *fileSpec, uint64_t *size);
 extern long   GetFSUUID(char *spec, char *uuidStr);
 extern long   CreateUUIDString(uint8_t uubytes[], int nbytes, char *uuidStr);
 extern int    openmem(char *buf, int len);
@@ -176,6 +201,8 @@ extern struct dirstuff * vol_opendir(BVRef bvr, const char *path);
 extern int    closedir(struct dirstuff *dirp);
 extern int    readdir(struct dirstuff *dirp, const char **name, long *flags, long *time);
 extern int    readdir_ext(struct dirstuff * dirp, const char ** name, long * flags, long * time, FinderInfo *finderInfo, long *infoValid);
+extern int    readdir_entry(struct dirstuff * dirp, DirEntry * entry);
+extern long   PrefetchDir(const char * dirSpec);
 extern void   flushdev(void);
 extern void   scanBootVolumes(int biosdev, int *count);
 
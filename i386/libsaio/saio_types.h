@@ -127,12 +127,42 @@ struct driveInfo
 };
 
 
+// Read backend for drives that can be accessed without INT13 (see disk.c).
+#define DISK_SIGNATURE_SIZE		1024	// First 512 bytes of LBA 0 (MBR) and LBA 1 (GPT header).
+
+struct DiskBackend
+{
+	const char *			name;
+
+	// Returns true when the signature of the drive (as read by INT13, see
+	// diskReadSignature) matches that of a drive handled by the backend.
+	bool					(*probe)(int biosdev, const void * signature);
+
+	// Reads count 512-byte sectors into buffer (any address). Returns 0 on success.
+	int						(*read)(int biosdev, unsigned long long secno, unsigned int count, void * buffer);
+
+	struct DiskBackend *	next;
+};
+
+
 typedef struct FinderInfo
 {
 	unsigned char data[16];
 } FinderInfo;
 
 
+// Returned by readdir_entry(). Name and record stay valid until the next call.
+typedef struct DirEntry
+{
+	const char *   name;            /* entry name */
+	long           flags;           /* file type and permissions */
+	long           time;            /* modification time */
+	FinderInfo     finderInfo;      /* valid when infoValid is set */
+	long           infoValid;
+	void *         record;          /* file system catalog record */
+} DirEntry;
+
+
 struct         BootVolume;
 typedef struct BootVolume * BVRef;
 typedef struct BootVolume * CICell;
@@ -145,6 +175,11 @@ typedef long (*FSGetDirEntry)(CICell ih, char * dirPath, long * dirIndex,
                               char ** name, long * flags, long * time,
                               FinderInfo * finderInfo, long * infoValid);
 typedef long (* FSGetUUID)(CICell ih, char *uuidStr);
+typedef void * (*FSOpenDir)(CICell ih, char * dirPath);
+typedef long (*FSReadDir)(CICell ih, void * dir, DirEntry * entry);
+typedef void (*FSCloseDir)(CICell ih, void * dir);
+typedef long (*FSPrefetchDir)(CICell ih, char * dirPath);
+typedef long (*FSGetFileSize)(CICell ih, char * filePath, uint64_t * size);
 typedef void (*BVGetDescription)(CICell ih, char * str, long strMaxLen);
 // Can be just pointed to free or a special free function
 typedef void (*BVFree)(CICell ih);
@@ -170,6 +205,7 @@ struct dirstuff
 	char *         dir_path;        /* directory path */
 	long           dir_index;       /* directory entry index */
 	BVRef          dir_bvr;         /* volume reference */
+	void *         dir_fs;          /* file system iterator (fs_opendir) */
 };
 
 #define BVSTRLEN 32
@@ -189,6 +225,11 @@ struct BootVolume
 	FSLoadFile       fs_loadfile;     /* FSLoadFile function */
 	FSReadFile       fs_readfile;     /* FSReadFile function */
 	FSGetDirEntry    fs_getdirentry;  /* FSGetDirEntry function */
+	FSOpenDir        fs_opendir;      /* FSOpenDir function (optional) */
+	FSReadDir        fs_readdir;      /* FSReadDir function */
+	FSCloseDir       fs_closedir;     /* FSCloseDir function */
+	FSPrefetchDir    fs_prefetchdir;  /* FSPrefetchDir function (optional) */
+	FSGetFileSize    fs_getfilesize;  /* FSGetFileSize function (optional) */
 	FSGetFileBlock   fs_getfileblock; /* FSGetFileBlock function */
 	FSGetUUID        fs_getuuid;      /* FSGetUUID function */
 	unsigned int     bps;             /* bytes per sector for this device */
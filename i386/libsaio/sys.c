@@ -341,7 +341,6 @@ static char* gMakeDirSpec;
 
 long GetFileInfo(const char * dirSpec, const char * name, long * flags, long * time)
 {
-	long index = 0;
 	const char * entryName;
 
 	if (gMakeDirSpec == 0)
@@ -373,14 +372,26 @@ long GetFileInfo(const char * dirSpec, const char * name, long * flags, long * t
 		dirSpec = gMakeDirSpec;
 	}
 
-	while (GetDirEntry(dirSpec, &index, &entryName, flags, time) == 0)
+	// One directory iterator for the whole scan (instead of a lookup per entry).
+	struct dirstuff * dirp = opendir(dirSpec);
+
+	if (dirp == NULL)
+	{
+		return -1;
+	}
+
+	while (readdir(dirp, &entryName, flags, time) == 0)
 	{
 		if (strcmp(entryName, name) == 0)
 		{
+			closedir(dirp);
+
 			return 0;  // success
 		}
 	}
 
+	closedir(dirp);
+
 	return -1;  // file not found
 }
 
@@ -404,6 +415,24 @@ long GetFileBlock(const char *fileSpec, unsigned long long *firstBlock)
 }
 
 
+//==============================================================================
+// Returns 0 and the (uncompressed) size of a file from its catalog entry, without
+// reading it, or -1 when the file doesn't exist or the file system can't tell.
+
+long GetFileSize(const char * fileSpec, uint64_t * size)
+{
+	const char * filePath;
+	BVRef        bvr;
+
+	if (((bvr = getBootVolumeRef(fileSpec, &filePath)) == NULL) || (bvr->fs_getfilesize == NULL))
+	{
+		return -1;
+	}
+
+	return bvr->fs_getfilesize(bvr, (char *)filePath, size);
+}
+
+
 //==============================================================================
 // iob_from_fdesc()
 //
@@ -603,14 +632,29 @@ struct dirstuff * vol_opendir(BVRef bvr, const char * path)
 
 	if (dirp)
 	{
+		bzero(dirp, sizeof(struct dirstuff));
+
 		dirp->dir_path = newString(path);
 
 		if (dirp->dir_path)
 		{
 			dirp->dir_bvr = bvr;
-		}
 
-		return dirp;
+			// Use the file system iterator when there is one (keeps the current leaf node around).
+			if (bvr->fs_opendir)
+			{
+				dirp->dir_fs = bvr->fs_opendir(bvr, dirp->dir_path);
+
+				if (dirp->dir_fs == NULL)
+				{
+					closedir(dirp);
+
+					return NULL;
+				}
+			}
+
+			return dirp;
+		}
 	}
 
 	closedir(dirp);
@@ -623,29 +667,14 @@ struct dirstuff * vol_opendir(BVRef bvr, const char * path)
 
 struct dirstuff * opendir(const char * path)
 {
-	struct dirstuff * dirp = 0;
 	const char *      dirPath;
 	BVRef             bvr;
 
 	if ((bvr = getBootVolumeRef(path, &dirPath)))
 	{
-		dirp = (struct dirstuff *) malloc(sizeof(struct dirstuff));
-
-		if (dirp)
-		{
-			dirp->dir_path = newString(dirPath);
-    
-			if (dirp->dir_path)
-			{
-				dirp->dir_bvr = bvr;
-			}
-
-			return dirp;
-		}
+		return vol_opendir(bvr, dirPath);
 	}
 
-    closedir(dirp);
-
     return NULL;
 }
 
@@ -656,6 +685,11 @@ int closedir(struct dirstuff * dirp)
 {
 	if (dirp)
 	{
+		if (dirp->dir_fs)
+		{
+			dirp->dir_bvr->fs_closedir(dirp->dir_bvr, dirp->dir_fs);
+		}
+
 		if (dirp->dir_path)
 		{
 			free(dirp->dir_path);
@@ -672,10 +706,7 @@ int closedir(struct dirstuff * dirp)
 
 int readdir(struct dirstuff * dirp, const char ** name, long * flags,long * time)
 {
-	return dirp->dir_bvr->fs_getdirentry(dirp->dir_bvr, 
-										 /* dirPath */   dirp->dir_path,
-										 /* dirIndex */  &dirp->dir_index,
-										 /* dirEntry */  (char **)name, flags, time, 0, 0);
+	return readdir_ext(dirp, name, flags, time, 0, 0);
 }
 
 
@@ -683,11 +714,77 @@ int readdir(struct dirstuff * dirp, const char ** name, long * flags,long * time
 
 int readdir_ext(struct dirstuff * dirp, const char ** name, long * flags, long * time, FinderInfo *finderInfo, long *infoValid)
 {
-	return dirp->dir_bvr->fs_getdirentry(dirp->dir_bvr,
-										 /* dirPath */   dirp->dir_path,
-										 /* dirIndex */  &dirp->dir_index,
-										 /* dirEntry */  (char **)name,
-										 flags, time, finderInfo, infoValid);
+	DirEntry entry;
+
+	if (dirp->dir_fs == NULL)
+	{
+		return dirp->dir_bvr->fs_getdirentry(dirp->dir_bvr,
+											 /* dirPath */   dirp->dir_path,
+											 /* dirIndex */  &dirp->dir_index,
+											 /* dirEntry */  (char **)name,
+											 flags, time, finderInfo, infoValid);
+	}
+
+	if (readdir_entry(dirp, &entry) != 0)
+	{
+		return -1;
+	}
+
+	*name  = entry.name;
+	*flags = entry.flags;
+
+	if (time)
+	{
+		*time = entry.time;
+	}
+
+	if (finderInfo)
+	{
+		*finderInfo = entry.finderInfo;
+	}
+
+	if (infoValid)
+	{
+		*infoValid = entry.infoValid;
+	}
+
+	return 0;
+}
+
+
+//==============================================================================
+// Returns name, type, time, FinderInfo and catalog record of the next entry.
+// Returns 0 on success or -1 when there are no additional entries.
+
+int readdir_entry(struct dirstuff * dirp, DirEntry * entry)
+{
+	if (dirp->dir_fs)
+	{
+		return dirp->dir_bvr->fs_readdir(dirp->dir_bvr, dirp->dir_fs, entry);
+	}
+
+	entry->record = NULL;
+
+	return dirp->dir_bvr->fs_getdirentry(dirp->dir_bvr, dirp->dir_path, &dirp->dir_index, (char **)&entry->name,
+										 &entry->flags, &entry->time, &entry->finderInfo, &entry->infoValid);
+}
+
+
+//==============================================================================
+// Reads the file system metadata for a directory walk ahead of it (when the
+// file system supports that).
+
+long PrefetchDir(const char * dirSpec)
+{
+	const char * dirPath;
+	BVRef        bvr;
+
+	if (((bvr = getBootVolumeRef(dirSpec, &dirPath)) == NULL) || (bvr->fs_prefetchdir == NULL))
+	{
+		return -1;
+	}
+
+	return bvr->fs_prefetchdir(bvr, (char *)dirPath);
 }
 
 
@@ -903,6 +1000,14 @@ static BVRef newBootVolumeRef(int biosdev, int partno)
 
 void initPartitionChain(void)
 {
+#if AHCI_SUPPORT
+	ahciInit();	// Registers the AHCI read backend (when a controller is found).
+#endif
+
+#if NVME_SUPPORT
+	nvmeInit();	// Takes over NVMe controllers and registers the NVMe read backend.
+#endif
+
 	gPlatform.BootPartitionChain = diskScanGPTBootVolumes(gPlatform.BIOSDevice, 0);
 }
 
@@ -0,0 +1,358 @@
+/***
+  *
+  * Name        : cachereplay
+  * Version     : 1.0.0
+  * Type        : Command line tool
+  * Description : Replays a metadata access pattern through CacheRead (libsaio/cache.c, built
+  *               as is) on top of a simulated disk, and reports the hit rate, the number of
+  *               disk requests and bytes, the hash probes per lookup and the time per call.
+  *               Every block that CacheRead returns is checked against the disk contents.
+  *
+  *               The pattern is either a built-in kext load (catalog B-tree lookups with
+  *               8 KB nodes: root, index and leaf nodes around the Extensions folder, some
+  *               elsewhere, extents B-tree lookups and a second volume now and then), or the
+  *               HFS metadata reads of a disk I/O trace ('boot-io-trace', see iotrace.c).
+  *               Note that a trace holds the reads that got past the metadata cache, so it
+  *               replays the cache misses of that boot, not every CacheRead call.
+  *
+  * Usage       : cachereplay [-b <cache block size>]              (built-in pattern)
+  *               cachereplay [-b <cache block size>] <trace file>   (raw dump of 'boot-io-trace')
+  *
+  * Compile with: cc -O2 -I .. cachereplay.c -o cachereplay -Wall -Wno-format
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <strings.h>
+#include <time.h>
+
+#include "iotrace.h"
+
+// cache.c is included below with its booter header (sl.h) left out, and with
+// the disk replaced by replaySeek() and replayRead().
+#define __LIBSAIO_SL_H
+#define CACHE_STATS		1
+
+typedef struct BootVolume { int biosdev; } * CICell;
+
+static void replaySeek(CICell ih, long long position);
+static long replayRead(CICell ih, long address, long length);
+
+#define Seek(c, p)		replaySeek(c, p);
+#define Read(c, a, l)	replayRead(c, a, l);
+
+#include "cache.c"
+
+#define MAX_VOLUMES		8
+#define MAX_ACCESSES	(1 << 20)
+#define NODE_SIZE		8192
+#define BENCH_SECONDS	1.0
+
+typedef struct Access
+{
+	uint8_t		volume;
+	long long	offset;
+	long		length;
+} Access;
+
+static struct BootVolume gVolumes[MAX_VOLUMES];
+static Access * gAccesses;
+static long gAccessCount;
+
+static long long gPosition;
+static unsigned long gDiskRequests, gDiskBytes;
+static bool gFillDisk = true;			// Off when timing (only the cache is measured).
+static int failures;
+
+
+//==============================================================================
+// Disk contents: every 32-bit word holds (part of) its own offset and volume.
+
+static inline uint32_t diskWord(CICell ih, long long offset)
+{
+	return (uint32_t)(offset >> 2) ^ ((uint32_t)ih->biosdev << 28);
+}
+
+
+//==============================================================================
+
+static void replaySeek(CICell ih, long long position)
+{
+	gPosition = position;
+}
+
+
+//==============================================================================
+
+static long replayRead(CICell ih, long address, long length)
+{
+	uint32_t * words = (uint32_t *)address;
+	long i;
+
+	for (i = 0; gFillDisk && (i < (length / 4)); i++)
+	{
+		words[i] = diskWord(ih, gPosition + (i * 4));
+	}
+
+	gDiskRequests++;
+	gDiskBytes += length;
+
+	return length;
+}
+
+
+//==============================================================================
+
+static void addAccess(int volume, long long offset, long length)
+{
+	if (gAccessCount < MAX_ACCESSES)
+	{
+		gAccesses[gAccessCount].volume = volume;
+		gAccesses[gAccessCount].offset = offset;
+		gAccesses[gAccessCount].length = length;
+		gAccessCount++;
+	}
+}
+
+
+//==============================================================================
+// A kext load without kernelcache: path lookups in a 4 level catalog B-tree (48 MB,
+// the leaves of /System/Library/Extensions close together), extents B-tree lookups
+// for fragmented files, and now and then the helper partition (second volume).
+
+static void makeKextLoadPattern(void)
+{
+	const long long catalog = 0x1000000, extents = 0x400000;	// B-tree file offsets.
+	const long leafNodes = 6000, indexNodes = 48;
+	long lookup, leaf = 2000, level;
+
+	for (lookup = 0; lookup < 20000; lookup++)
+	{
+		int volume = ((lookup % 1000) > 980) ? 1 : 0;
+
+		// Header node (once per B-tree open), root, index nodes, leaf.
+		if ((lookup % 50) == 0)
+		{
+			addAccess(volume, catalog, NODE_SIZE);
+		}
+
+		addAccess(volume, catalog + NODE_SIZE, NODE_SIZE);
+
+		for (level = 0; level < 2; level++)
+		{
+			addAccess(volume, catalog + ((2 + (level * 8) + ((leaf * 8) / leafNodes)) * NODE_SIZE), NODE_SIZE);
+		}
+
+		// Mostly walks through the Extensions folder leaves, sometimes elsewhere.
+		leaf = ((rand() % 10) == 0) ? (rand() % leafNodes) : (2000 + ((leaf - 2000 + (rand() % 3)) % 400));
+		addAccess(volume, catalog + ((2 + indexNodes + leaf) * NODE_SIZE), NODE_SIZE);
+
+		// Directory listings read the next leaf as well.
+		if ((rand() % 4) == 0)
+		{
+			addAccess(volume, catalog + ((2 + indexNodes + leaf + 1) * NODE_SIZE), NODE_SIZE);
+		}
+
+		// Extents overflow lookups (4 KB nodes, a small tree).
+		if ((rand() % 8) == 0)
+		{
+			addAccess(volume, extents + (4096 * (rand() % 3)), 4096);
+		}
+	}
+}
+
+
+//==============================================================================
+
+static bool loadTracePattern(const char * path)
+{
+	FILE * fp = fopen(path, "rb");
+	IOTraceHeader header;
+	IOTraceRecord record;
+	uint32_t i, count, first;
+	int volume, biosdevs[MAX_VOLUMES], volumeCount = 0;
+
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error: can't open %s\n", path);
+		return false;
+	}
+
+	if ((fread(&header, sizeof(header), 1, fp) != 1) || (header.signature != IO_TRACE_SIGNATURE) || (header.version != IO_TRACE_VERSION))
+	{
+		fprintf(stderr, "Error: %s is not a disk I/O trace\n", path);
+		fclose(fp);
+		return false;
+	}
+
+	// Oldest record first (the ring may have wrapped).
+	count = (header.total < header.capacity) ? header.total : header.capacity;
+	first = (header.total < header.capacity) ? 0 : (header.total % header.capacity);
+
+	for (i = 0; i < count; i++)
+	{
+		fseek(fp, sizeof(header) + (((first + i) % header.capacity) * sizeof(record)), SEEK_SET);
+
+		if (fread(&record, sizeof(record), 1, fp) != 1)
+		{
+			break;
+		}
+
+		if ((record.subsystem != kIOTraceHFSMetadata) || (record.flags & kIOTraceError))
+		{
+			continue;
+		}
+
+		for (volume = 0; (volume < volumeCount) && (biosdevs[volume] != record.biosdev); volume++);
+
+		if (volume == volumeCount)
+		{
+			if (volumeCount == MAX_VOLUMES)
+			{
+				continue;
+			}
+
+			biosdevs[volumeCount++] = record.biosdev;
+		}
+
+		addAccess(volume, record.lba * 512, record.count * 512);
+	}
+
+	fclose(fp);
+
+	return true;
+}
+
+
+//==============================================================================
+// Replays the pattern once (on an empty cache), checking what CacheRead returns.
+
+static void replay(long blockSize, bool check)
+{
+	static char buffer[0x100000];
+	long i, j;
+	int volume = -1;
+
+	CacheReset();
+
+	for (i = 0; i < gAccessCount; i++)
+	{
+		Access * access = &gAccesses[i];
+
+		if (access->volume != volume)
+		{
+			volume = access->volume;
+			CacheInit(&gVolumes[volume], blockSize);	// Like HFSInitPartition on a volume switch.
+		}
+
+		if (access->length > (long)sizeof(buffer))
+		{
+			continue;
+		}
+
+		CacheRead(&gVolumes[volume], buffer, access->offset, access->length, 1);
+
+		if (check)
+		{
+			for (j = 0; j < (access->length / 4); j++)
+			{
+				if (((uint32_t *)buffer)[j] != diskWord(&gVolumes[volume], access->offset + (j * 4)))
+				{
+					if (failures++ < 10)
+					{
+						printf("FAILED: wrong data at offset 0x%llx (access %ld)\n", access->offset + (j * 4), i);
+					}
+
+					break;
+				}
+			}
+		}
+	}
+}
+
+
+//==============================================================================
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+//==============================================================================
+
+int main(int argc, char * argv[])
+{
+	long blockSize = 4096, i, replays = 0;
+	double start, seconds = 0;
+	unsigned long bytes = 0;
+
+	if ((argc > 2) && (strcmp(argv[1], "-b") == 0))
+	{
+		blockSize = strtol(argv[2], NULL, 0);
+		argc -= 2;
+		argv += 2;
+	}
+
+	if ((gAccesses = malloc(MAX_ACCESSES * sizeof(Access))) == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < MAX_VOLUMES; i++)
+	{
+		gVolumes[i].biosdev = 0x80 + i;
+	}
+
+	srand(1);
+
+	if (argc > 1)
+	{
+		if (!loadTracePattern(argv[1]))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		makeKextLoadPattern();
+	}
+
+	for (i = 0; i < gAccessCount; i++)
+	{
+		bytes += gAccesses[i].length;
+	}
+
+	// Once with checks and statistics.
+	replay(blockSize, true);
+
+	printf("%ld reads (%lu KB), cache block size %ld\n", gAccessCount, bytes >> 10, blockSize);
+	printf("  hits %lu, misses %lu, evictions %lu, hash probes per lookup %.2f\n", gCacheHits, gCacheMisses, gCacheEvicts,
+		   (gCacheHits + gCacheMisses) ? ((double)gCacheProbes / (gCacheHits + gCacheMisses)) : 0.0);
+	printf("  disk requests %lu (%lu KB)\n", gDiskRequests, gDiskBytes >> 10);
+
+	// Then for speed (without filling in the simulated disk reads).
+	gFillDisk = false;
+
+	do
+	{
+		start = now();
+		replay(blockSize, false);
+		seconds += now() - start;
+		replays++;
+	} while (seconds < BENCH_SECONDS);
+
+	printf("  %.0f ns per CacheRead call\n", (seconds * 1e9) / (replays * gAccessCount));
+	printf("%s\n", failures ? "FAILED" : "All data checked.");
+
+	return failures ? 1 : 0;
+}
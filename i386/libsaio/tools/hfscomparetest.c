@@ -0,0 +1,382 @@
+/***
+  *
+  * Name        : hfscomparetest
+  * Version     : 1.0.0
+  * Type        : Command line tool
+  * Description : Checks that FastUnicodeCompareFolded (with a key folded by FoldUnicodeString)
+  *               orders HFS+ catalog names exactly like FastUnicodeCompare, which it replaced
+  *               in CompareHFSPlusCatalogKeys (libsaio/hfs_compare.c, built as is). A single
+  *               difference makes files unfindable, so it compares:
+  *
+  *               - every 16-bit char against a set of others (one char names);
+  *               - every pair of ASCII chars in both lanes of the two char fast path;
+  *               - random name pairs (default 3M): mostly ASCII with upper and lower case,
+  *                 NUL, DEL, Latin-1, other scripts and ignorable chars, where the second
+  *                 name is often a slightly changed copy of the first (so that the compare
+  *                 runs deep), at every length and alignment;
+  *
+  *               and reports the speed of both.
+  *
+  * Usage       : hfscomparetest              (3M random pairs)
+  *               hfscomparetest <pairs>
+  *
+  * Compile with: cc -O2 -I .. hfscomparetest.c -o hfscomparetest -Wall
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+#if __APPLE__
+	#include <libkern/OSByteOrder.h>
+#else
+	// Little endian hosts (like the booter).
+	#define OSSwapBigToHostInt16(x)		__builtin_bswap16(x)
+	#define OSSwapLittleToHostInt16(x)	(x)
+
+	enum { OSUnknownByteOrder, OSLittleEndian, OSBigEndian };
+#endif
+
+// hfs_compare.c is included below with its booter header (sl.h) left out.
+#define __LIBSAIO_SL_H
+#define SWAP_BE16(x)	OSSwapBigToHostInt16(x)
+#define SWAP_LE16(x)	OSSwapLittleToHostInt16(x)
+
+#include "hfs_compare.c"
+
+#define MAX_NAME		255				// HFS+ name length (in UTF-16 chars).
+#define BENCH_SECONDS	1.0
+
+static int failures;
+
+// The lower case table drops these.
+static const u_int16_t ignorables[] = { 0x200C, 0x200D, 0x200E, 0x200F, 0x202A, 0x202B, 0x202C, 0x202D, 0x202E, 0x206A, 0xFEFF };
+
+
+//==============================================================================
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+//==============================================================================
+
+static int sign(int32_t value)
+{
+	return (value > 0) - (value < 0);
+}
+
+
+//==============================================================================
+// Compares two (big endian) names both ways, and reports a difference.
+
+static void compareNames(u_int16_t * name1, u_int32_t length1, u_int16_t * name2, u_int32_t length2)
+{
+	u_int16_t folded[MAX_NAME + 2];
+	u_int32_t foldedLength = FoldUnicodeString(name1, length1, folded);
+	int expected = sign(FastUnicodeCompare(name1, length1, name2, length2, OSBigEndian));
+	int result = sign(FastUnicodeCompareFolded(folded, foldedLength, name2, length2));
+	u_int32_t i;
+
+	if (result != expected)
+	{
+		if (failures++ < 20)
+		{
+			printf("FAILED: %d instead of %d for\n  ", result, expected);
+
+			for (i = 0; i < length1; i++)
+			{
+				printf("%04X ", SWAP_BE16(name1[i]));
+			}
+
+			printf("\n  ");
+
+			for (i = 0; i < length2; i++)
+			{
+				printf("%04X ", SWAP_BE16(name2[i]));
+			}
+
+			printf("\n");
+		}
+	}
+}
+
+
+//==============================================================================
+
+static u_int16_t randomChar(void)
+{
+	int kind = rand() % 100;
+
+	if (kind < 60)
+	{
+		return 'A' + (rand() % 26) + ((rand() & 1) ? 0x20 : 0);		// Letters.
+	}
+
+	if (kind < 80)
+	{
+		return 0x20 + (rand() % 0x60);									// ASCII (with '@', '[', '`', '{', DEL).
+	}
+
+	if (kind < 82)
+	{
+		return rand() % 0x20;											// Control chars (and NUL).
+	}
+
+	if (kind < 90)
+	{
+		return 0x80 + (rand() % 0x180);									// Latin-1 and Latin Extended.
+	}
+
+	if (kind < 95)
+	{
+		return ignorables[rand() % (sizeof(ignorables) / sizeof(ignorables[0]))];
+	}
+
+	return rand() & 0xFFFF;												// Anything.
+}
+
+
+//==============================================================================
+// A (big endian) copy of a name with a few changes.
+
+static u_int32_t changeName(u_int16_t * name, u_int32_t length, u_int16_t * copy)
+{
+	u_int32_t i, changes = rand() % 4, at;
+	u_int16_t c;
+
+	memcpy(copy, name, length * sizeof(u_int16_t));
+
+	while (changes--)
+	{
+		at = length ? (rand() % length) : 0;
+
+		switch (rand() % 5)
+		{
+			case 0:		// Other case.
+				if (length)
+				{
+					c = SWAP_BE16(copy[at]);
+					copy[at] = SWAP_BE16((((c | 0x20) >= 'a') && ((c | 0x20) <= 'z')) ? (c ^ 0x20) : c);
+				}
+				break;
+
+			case 1:		// Other char.
+				if (length)
+				{
+					copy[at] = SWAP_BE16(randomChar());
+				}
+				break;
+
+			case 2:		// Inserted ignorable char.
+				if (length < MAX_NAME)
+				{
+					memmove(copy + at + 1, copy + at, (length - at) * sizeof(u_int16_t));
+					copy[at] = SWAP_BE16(ignorables[rand() % (sizeof(ignorables) / sizeof(ignorables[0]))]);
+					length++;
+				}
+				break;
+
+			case 3:		// Shorter.
+				length = at;
+				break;
+
+			default:	// Longer.
+				for (i = rand() % 4; i-- && (length < MAX_NAME); )
+				{
+					copy[length++] = SWAP_BE16(randomChar());
+				}
+		}
+	}
+
+	return length;
+}
+
+
+//==============================================================================
+
+static void testSingleChars(void)
+{
+	static const u_int16_t others[] = { 0x0000, 0x0001, 0x0020, 0x0041, 0x005A, 0x0061, 0x007A, 0x007F, 0x0080,
+										0x00C0, 0x00E0, 0x00FF, 0x0100, 0x0130, 0x0131, 0x03A3, 0x03C3, 0x0410,
+										0x0430, 0x200C, 0x2160, 0x2170, 0xFB00, 0xFEFF, 0xFF21, 0xFF41, 0xFFFF };
+	u_int16_t name1[2], name2[2];
+	u_int32_t c, i;
+
+	for (c = 0; c < 0x10000; c++)
+	{
+		for (i = 0; i < (sizeof(others) / sizeof(others[0])); i++)
+		{
+			name1[0] = SWAP_BE16(c);
+			name2[0] = SWAP_BE16(others[i]);
+			compareNames(name1, 1, name2, 1);
+			compareNames(name2, 1, name1, 1);
+		}
+	}
+}
+
+
+//==============================================================================
+// Two char ASCII names (one fast path step), and the same followed by a third
+// char (fast path, then the table).
+
+static void testASCIIPairs(void)
+{
+	u_int16_t name1[4], name2[4];
+	u_int32_t a, b, lane;
+
+	for (lane = 0; lane < 2; lane++)
+	{
+		for (a = 0; a < 0x80; a++)
+		{
+			for (b = 0; b < 0x80; b++)
+			{
+				name1[lane] = SWAP_BE16(a);
+				name2[lane] = SWAP_BE16(b);
+				name1[lane ^ 1] = name2[lane ^ 1] = SWAP_BE16('m');
+				name1[2] = SWAP_BE16('x');
+				name2[2] = SWAP_BE16('X');
+
+				compareNames(name1, 2, name2, 2);
+				compareNames(name1, 3, name2, 3);
+				compareNames(name1, 2, name2, 3);
+				compareNames(name1, 3, name2, 2);
+			}
+		}
+	}
+}
+
+
+//==============================================================================
+
+static void testRandomPairs(unsigned long pairs)
+{
+	// One char of slack in front, for odd (16-bit) alignment.
+	static u_int16_t buffer1[MAX_NAME + 2], buffer2[MAX_NAME + 2], name[MAX_NAME + 2];
+	u_int16_t * name1, * name2;
+	u_int32_t length1, length2, i;
+	unsigned long pair;
+
+	for (pair = 0; pair < pairs; pair++)
+	{
+		length1 = (rand() % 4) ? (rand() % 32) : (rand() % (MAX_NAME + 1));
+
+		for (i = 0; i < length1; i++)
+		{
+			name[i] = SWAP_BE16(randomChar());
+		}
+
+		name1 = buffer1 + (rand() & 1);
+		name2 = buffer2 + (rand() & 1);
+
+		memcpy(name1, name, length1 * sizeof(u_int16_t));
+
+		if (rand() % 8)
+		{
+			length2 = changeName(name1, length1, name2);
+		}
+		else
+		{
+			for (length2 = rand() % 32, i = 0; i < length2; i++)
+			{
+				name2[i] = SWAP_BE16(randomChar());
+			}
+		}
+
+		compareNames(name1, length1, name2, length2);
+		compareNames(name2, length2, name1, length1);
+	}
+}
+
+
+//==============================================================================
+// Catalog lookup like: one search key against many (mostly ASCII) names.
+
+static void benchmark(void)
+{
+	static u_int16_t names[1024][40];
+	u_int16_t key[40], folded[40];
+	u_int32_t lengths[1024], keyLength = 24, foldedLength, i, j;
+	u_int64_t compares[2] = { 0, 0 };
+	double start, seconds[2] = { 0, 0 };
+	volatile int32_t sink = 0;
+	int pass;
+
+	for (i = 0; i < keyLength; i++)
+	{
+		key[i] = SWAP_BE16("AppleIntelCPUPowerManagement"[i]);
+	}
+
+	for (i = 0; i < 1024; i++)
+	{
+		lengths[i] = changeName(key, keyLength, names[i]);
+	}
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		do
+		{
+			start = now();
+
+			for (j = 0; j < 1000; j++)
+			{
+				if (pass == 0)
+				{
+					for (i = 0; i < 1024; i++)
+					{
+						sink += FastUnicodeCompare(key, keyLength, names[i], lengths[i], OSBigEndian);
+					}
+				}
+				else
+				{
+					foldedLength = FoldUnicodeString(key, keyLength, folded);	// Once per lookup.
+
+					for (i = 0; i < 1024; i++)
+					{
+						sink += FastUnicodeCompareFolded(folded, foldedLength, names[i], lengths[i]);
+					}
+				}
+			}
+
+			seconds[pass] += now() - start;
+			compares[pass] += 1024 * 1000;
+		} while (seconds[pass] < BENCH_SECONDS);
+	}
+
+	printf("FastUnicodeCompare %.1f ns, FastUnicodeCompareFolded %.1f ns per compare (24 char key, similar names).\n",
+		   (seconds[0] * 1e9) / compares[0], (seconds[1] * 1e9) / compares[1]);
+}
+
+
+//==============================================================================
+
+int main(int argc, char * argv[])
+{
+	unsigned long pairs = (argc > 1) ? strtoul(argv[1], NULL, 0) : 3000000;
+
+	srand(1);
+
+	testSingleChars();
+	testASCIIPairs();
+	testRandomPairs(pairs);
+
+	if (failures)
+	{
+		printf("FAILED (%d differences)\n", failures);
+		return 1;
+	}
+
+	benchmark();
+	printf("All tests passed.\n");
+
+	return 0;
+}
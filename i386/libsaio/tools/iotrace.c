@@ -0,0 +1,198 @@
+/***
+  *
+  * Name        : iotrace
+  * Version     : 1.0.0
+  * Type        : Command line tool
+  * Description : Decodes the disk I/O trace ('boot-io-trace' under /efi/platform) recorded by
+  *               RevoBoot when IO_TRACE_SUPPORT is set, into a timeline and a seek histogram.
+  *
+  * Usage       : iotrace              (reads the property from the I/O Registry)
+  *               iotrace <file>       (reads a raw dump of the property)
+  *
+  * Compile with: cc -I .. iotrace.c -o iotrace -Wall -framework IOKit -framework CoreFoundation
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <IOKit/IOKitLib.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "iotrace.h"
+
+#define SEEK_BUCKETS	40
+
+static const char * subsystemNames[] = { "other", "gpt", "hfs-meta", "file-data" };
+
+
+//==============================================================================
+
+static void * readTraceFromRegistry(size_t * size)
+{
+	void * trace = NULL;
+	io_registry_entry_t platform = IORegistryEntryFromPath(kIOMasterPortDefault, "IODeviceTree:/efi/platform");
+
+	if (platform)
+	{
+		CFDataRef data = (CFDataRef) IORegistryEntryCreateCFProperty(platform, CFSTR("boot-io-trace"), kCFAllocatorDefault, 0);
+
+		if (data)
+		{
+			*size = CFDataGetLength(data);
+			trace = malloc(*size);
+
+			if (trace)
+			{
+				memcpy(trace, CFDataGetBytePtr(data), *size);
+			}
+
+			CFRelease(data);
+		}
+
+		IOObjectRelease(platform);
+	}
+
+	return trace;
+}
+
+
+//==============================================================================
+
+static void * readTraceFromFile(const char * path, size_t * size)
+{
+	void * trace = NULL;
+	FILE * fp = fopen(path, "rb");
+
+	if (fp)
+	{
+		fseek(fp, 0, SEEK_END);
+		*size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		trace = malloc(*size);
+
+		if (trace && (fread(trace, 1, *size, fp) != *size))
+		{
+			free(trace);
+			trace = NULL;
+		}
+
+		fclose(fp);
+	}
+
+	return trace;
+}
+
+
+//==============================================================================
+
+int main(int argc, char * argv[])
+{
+	size_t size = 0;
+	IOTrace * trace = (argc > 1) ? readTraceFromFile(argv[1], &size) : readTraceFromRegistry(&size);
+
+	if (trace == NULL)
+	{
+		fprintf(stderr, "Error: no I/O trace found (was RevoBoot built with IO_TRACE_SUPPORT set to 1?)\n");
+		return 1;
+	}
+
+	if ((size < sizeof(IOTraceHeader)) || (trace->header.signature != IO_TRACE_SIGNATURE) || (trace->header.version != IO_TRACE_VERSION))
+	{
+		fprintf(stderr, "Error: unsupported trace format\n");
+		return 1;
+	}
+
+	uint32_t capacity	= trace->header.capacity;
+	uint32_t count		= (trace->header.total > capacity) ? capacity : trace->header.total;
+	uint32_t first		= (trace->header.total > capacity) ? (trace->header.total % capacity) : 0;
+	double tscPerUs		= trace->header.tscFrequency ? (trace->header.tscFrequency / 1000000.0) : 1.0;
+
+	if ((sizeof(IOTraceHeader) + (count * sizeof(IOTraceRecord))) > size)
+	{
+		fprintf(stderr, "Error: truncated trace\n");
+		return 1;
+	}
+
+	if (trace->header.total > capacity)
+	{
+		printf("Note: ring wrapped, %u oldest records lost\n\n", trace->header.total - capacity);
+	}
+
+	unsigned long long seekHistogram[SEEK_BUCKETS] = { 0 };
+	unsigned long long busyTime[4] = { 0 }, sectors[4] = { 0 }, reads[4] = { 0 }, hits[4] = { 0 };
+	uint64_t tscBase = trace->records[first].tscStart;
+	uint64_t lastEnd[256] = { 0 };
+	uint8_t lastValid[256] = { 0 };
+	uint32_t i;
+
+	printf("    time (ms)  duration (us)  dev        lba    count  subsystem  flags\n");
+
+	for (i = 0; i < count; i++)
+	{
+		IOTraceRecord * record = &trace->records[(first + i) % capacity];
+		uint8_t subsystem = (record->subsystem < 4) ? record->subsystem : kIOTraceOther;
+
+		printf("%13.3f  %13.1f  %02xh  %10llu  %7u  %-9s  %s%s%s\n",
+			   (record->tscStart - tscBase) / (tscPerUs * 1000.0),
+			   (record->tscEnd - record->tscStart) / tscPerUs,
+			   record->biosdev, (unsigned long long)record->lba, record->count, subsystemNames[subsystem],
+			   (record->flags & kIOTraceHit) ? "hit " : "",
+			   (record->flags & kIOTraceBulk) ? "bulk " : "",
+			   (record->flags & kIOTraceError) ? "error" : "");
+
+		if (record->flags & kIOTraceHit)
+		{
+			hits[subsystem] += record->count;
+			continue;
+		}
+
+		reads[subsystem]++;
+		sectors[subsystem] += record->count;
+		busyTime[subsystem] += (record->tscEnd - record->tscStart);
+
+		// Seek distance (log2 of sectors) from the end of the previous device read.
+		if (lastValid[record->biosdev])
+		{
+			uint64_t distance = (record->lba > lastEnd[record->biosdev]) ? (record->lba - lastEnd[record->biosdev]) : (lastEnd[record->biosdev] - record->lba);
+			int bucket = 0;
+
+			while (distance && (bucket < (SEEK_BUCKETS - 1)))
+			{
+				distance >>= 1;
+				bucket++;
+			}
+
+			seekHistogram[bucket]++;
+		}
+
+		lastEnd[record->biosdev] = record->lba + record->count;
+		lastValid[record->biosdev] = 1;
+	}
+
+	printf("\nsubsystem      reads    hits (sectors)        KB   busy (ms)      MB/s\n");
+
+	for (i = 0; i < 4; i++)
+	{
+		double ms = busyTime[i] / (tscPerUs * 1000.0);
+
+		printf("%-9s  %9llu  %16llu  %8llu  %10.1f  %8.1f\n", subsystemNames[i], reads[i], hits[i], sectors[i] / 2, ms,
+			   ms ? ((sectors[i] * 512.0) / (ms * 1000.0)) : 0.0);
+	}
+
+	printf("\nseek distance (sectors)   reads\n");
+
+	for (i = 0; i < SEEK_BUCKETS; i++)
+	{
+		if (seekHistogram[i])
+		{
+			printf("%s%-22llu  %6llu\n", i ? "< " : "  ", i ? (1ULL << i) : 0ULL, seekHistogram[i]);
+		}
+	}
+
+	free(trace);
+
+	return 0;
+}
@@ -0,0 +1,949 @@
+/***
+  *
+  * Name        : lzvntest
+  * Version     : 1.0.0
+  * Type        : Command line tool
+  * Description : Tests decompressLZVN (libsaio/lzvn.c, built as is) with reference vectors
+  *               for every opcode form, malformed and truncated streams, the undefined
+  *               opcodes, pre_d / sml_m / lrg_m without a previous distance and the eight
+  *               byte match copies at the end of the output. Then it checks it against a
+  *               plain byte at a time decoder on encoded and randomly damaged streams, and
+  *               compares its decode speed with decompressLZSS (boot2/lzss.c) on the same
+  *               payloads.
+  *
+  * Usage       : lzvntest              (built-in payloads)
+  *               lzvntest <file>...    (payload files)
+  *
+  * Compile with: cc -O2 -I .. -I ../../boot2 lzvntest.c -o lzvntest -Wall
+  *
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+// lzvn.c and lzss.c are included below with their booter headers left out.
+#define __LIBSAIO_LIBSAIO_H
+#define __LIBSAIO_SL_H
+#define __BOOT2_BOOT_H
+
+#include "lzss.h"
+#include "lzvn.c"
+#include "lzss.c"
+
+#define GUARD_SIZE		64
+#define GUARD_BYTE		0xA5
+#define HASH_SIZE		(1 << 16)
+#define MAX_CHAIN		64
+#define FUZZ_ROUNDS		20000
+#define BENCH_SECONDS	1.0			// Per decoder and payload.
+
+static int failures;
+
+
+//==============================================================================
+
+static void check(int ok, const char * name, const char * what, long value)
+{
+	if (!ok)
+	{
+		printf("FAILED: %s: %s (%ld)\n", name, what, value);
+		failures++;
+	}
+}
+
+
+//==============================================================================
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+
+//==============================================================================
+
+static void * allocate(size_t size)
+{
+	void * buffer = malloc(size);
+
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+
+	return buffer;
+}
+
+
+//==============================================================================
+// Straight from the opcode table in lzvn.c, one byte at a time and with every
+// check spelled out. Same results as decompressLZVN (-1 or the output size).
+
+static long referenceLZVN(u_int8_t * dst, u_int32_t dstSize, const u_int8_t * src, u_int32_t srcSize)
+{
+	u_int32_t in = 0, out = 0, dist = 0, literals, match, i;
+	u_int8_t opcode;
+
+	while (in < srcSize)
+	{
+		opcode = src[in];
+
+		if ((opcode == 0x0E) || (opcode == 0x16))						// nop
+		{
+			in++;
+			continue;
+		}
+
+		if (opcode == 0x06)												// eos
+		{
+			return out;
+		}
+
+		if (((opcode < 0x40) && ((opcode & 7) == 6)) || ((opcode >= 0x70) && (opcode <= 0x7F)) || ((opcode >= 0xD0) && (opcode <= 0xDF)))
+		{
+			return -1;													// udef
+		}
+
+		if ((opcode & 0xF0) == 0xE0)									// sml_l, lrg_l
+		{
+			match = 0;
+
+			if (opcode == 0xE0)
+			{
+				if ((in + 2) > srcSize)
+				{
+					return -1;
+				}
+
+				literals = src[in + 1] + 16;
+				in += 2;
+			}
+			else
+			{
+				literals = opcode & 0x0F;
+				in += 1;
+			}
+		}
+		else if ((opcode & 0xF0) == 0xF0)								// sml_m, lrg_m
+		{
+			literals = 0;
+
+			if (opcode == 0xF0)
+			{
+				if ((in + 2) > srcSize)
+				{
+					return -1;
+				}
+
+				match = src[in + 1] + 16;
+				in += 2;
+			}
+			else
+			{
+				match = opcode & 0x0F;
+				in += 1;
+			}
+		}
+		else if ((opcode & 0xE0) == 0xA0)								// med_d
+		{
+			if ((in + 3) > srcSize)
+			{
+				return -1;
+			}
+
+			literals = (opcode >> 3) & 3;
+			match = (((opcode & 7) << 2) | (src[in + 1] & 3)) + 3;
+			dist = (src[in + 1] >> 2) | (src[in + 2] << 6);
+			in += 3;
+		}
+		else
+		{
+			literals = opcode >> 6;
+			match = ((opcode >> 3) & 7) + 3;
+
+			if ((opcode & 7) == 6)										// pre_d
+			{
+				in += 1;
+			}
+			else if ((opcode & 7) == 7)									// lrg_d
+			{
+				if ((in + 3) > srcSize)
+				{
+					return -1;
+				}
+
+				dist = src[in + 1] | (src[in + 2] << 8);
+				in += 3;
+			}
+			else														// sml_d
+			{
+				if ((in + 2) > srcSize)
+				{
+					return -1;
+				}
+
+				dist = ((opcode & 7) << 8) | src[in + 1];
+				in += 2;
+			}
+		}
+
+		for (i = 0; i < literals; i++)
+		{
+			if ((in >= srcSize) || (out >= dstSize))
+			{
+				return -1;
+			}
+
+			dst[out++] = src[in++];
+		}
+
+		if (match && ((dist == 0) || (dist > out) || (match > (dstSize - out))))
+		{
+			return -1;
+		}
+
+		for (i = 0; i < match; i++, out++)
+		{
+			dst[out] = dst[out - dist];
+		}
+	}
+
+	return -1;
+}
+
+
+//==============================================================================
+
+static u_int32_t hash3(const u_int8_t * p)
+{
+	return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+
+//==============================================================================
+// Finds the longest match (up to maxLength bytes, at most maxDistance back) with
+// hash chains on three bytes. Returns its length (0 when there is none).
+
+static u_int32_t findMatch(const u_int8_t * src, u_int32_t srclen, u_int32_t pos, int32_t * head, int32_t * prev,
+						   u_int32_t maxLength, u_int32_t maxDistance, u_int32_t * distance)
+{
+	u_int32_t length, bestLength = 0;
+	int32_t candidate, chain;
+
+	if ((pos + 2) >= srclen)
+	{
+		return 0;
+	}
+
+	for (candidate = head[hash3(src + pos)], chain = 0; (candidate >= 0) && (chain < MAX_CHAIN); candidate = prev[candidate], chain++)
+	{
+		if ((pos - candidate) > maxDistance)
+		{
+			break;
+		}
+
+		for (length = 0; (length < maxLength) && ((pos + length) < srclen) && (src[candidate + length] == src[pos + length]); length++);
+
+		if (length > bestLength)
+		{
+			bestLength = length;
+			*distance = pos - candidate;
+		}
+	}
+
+	return bestLength;
+}
+
+
+//==============================================================================
+
+static void insertPositions(const u_int8_t * src, u_int32_t srclen, u_int32_t pos, u_int32_t count, int32_t * head, int32_t * prev)
+{
+	u_int32_t hash;
+
+	for (; count--; pos++)
+	{
+		if ((pos + 2) < srclen)
+		{
+			hash = hash3(src + pos);
+			prev[pos] = head[hash];
+			head[hash] = pos;
+		}
+	}
+}
+
+
+//==============================================================================
+
+static u_int8_t * putLiterals(u_int8_t * out, const u_int8_t * src, u_int32_t count)
+{
+	u_int32_t length;
+
+	while (count)
+	{
+		length = (count > 271) ? 271 : count;
+
+		if (length < 16)
+		{
+			*out++ = 0xE0 | length;										// sml_l
+		}
+		else
+		{
+			*out++ = 0xE0;												// lrg_l
+			*out++ = length - 16;
+		}
+
+		memcpy(out, src, length);
+		out += length;
+		src += length;
+		count -= length;
+	}
+
+	return out;
+}
+
+
+//==============================================================================
+
+static u_int8_t * putMatches(u_int8_t * out, u_int32_t count)
+{
+	u_int32_t length;
+
+	while (count)
+	{
+		length = (count > 271) ? 271 : count;
+
+		if (length < 16)
+		{
+			*out++ = 0xF0 | length;										// sml_m
+		}
+		else
+		{
+			*out++ = 0xF0;												// lrg_m
+			*out++ = length - 16;
+		}
+
+		count -= length;
+	}
+
+	return out;
+}
+
+
+//==============================================================================
+// Greedy LZVN encoder that uses every opcode form (nops too, when asked for).
+// Returns the compressed size.
+
+static u_int32_t compressLZVN(u_int8_t * dst, const u_int8_t * src, u_int32_t srclen, int nops)
+{
+	static int32_t head[HASH_SIZE];
+	int32_t * prev = allocate((srclen + 1) * sizeof(int32_t));
+
+	u_int8_t * out = dst;
+	u_int32_t pos = 0, literalStart = 0, previousDistance = 0, distance = 0, length, first, literals;
+
+	memset(head, 0xFF, sizeof(head));
+
+	while (pos < srclen)
+	{
+		length = findMatch(src, srclen, pos, head, prev, 1024, 0xFFFF, &distance);
+
+		if (length < 3)
+		{
+			insertPositions(src, srclen, pos++, 1, head, prev);
+			continue;
+		}
+
+		// All but the last (up to three) literals go first.
+		literals = (pos - literalStart) & 3;
+		out = putLiterals(out, src + literalStart, (pos - literalStart) - literals);
+		literalStart = pos - literals;
+
+		if (nops && ((rand() % 16) == 0))
+		{
+			*out++ = (rand() & 1) ? 0x0E : 0x16;
+		}
+
+		if ((distance == previousDistance) && (literals == 0))
+		{
+			first = 0;													// sml_m / lrg_m only
+		}
+		else if (distance == previousDistance)
+		{
+			first = (length < (10 - (2 * literals))) ? length : (10 - (2 * literals));
+			*out++ = (literals << 6) | ((first - 3) << 3) | 6;			// pre_d
+		}
+		else if (distance < 0x600)
+		{
+			first = (length < (10 - (2 * literals))) ? length : (10 - (2 * literals));
+			*out++ = (literals << 6) | ((first - 3) << 3) | (distance >> 8);	// sml_d
+			*out++ = distance & 0xFF;
+		}
+		else if (distance < 0x4000)
+		{
+			first = (length < 34) ? length : 34;
+			*out++ = 0xA0 | (literals << 3) | ((first - 3) >> 2);		// med_d
+			*out++ = ((distance & 0x3F) << 2) | ((first - 3) & 3);
+			*out++ = distance >> 6;
+		}
+		else
+		{
+			first = (length < (10 - (2 * literals))) ? length : (10 - (2 * literals));
+			*out++ = (literals << 6) | ((first - 3) << 3) | 7;			// lrg_d
+			*out++ = distance & 0xFF;
+			*out++ = distance >> 8;
+		}
+
+		if (first)
+		{
+			memcpy(out, src + literalStart, literals);
+			out += literals;
+		}
+		else
+		{
+			out = putLiterals(out, src + literalStart, literals);
+		}
+
+		out = putMatches(out, length - first);
+		previousDistance = distance;
+
+		insertPositions(src, srclen, pos, length, head, prev);
+		pos += length;
+		literalStart = pos;
+	}
+
+	out = putLiterals(out, src + literalStart, pos - literalStart);
+	memcpy(out, "\x06\0\0\0\0\0\0\0", 8);								// eos
+
+	free(prev);
+
+	return (out + 8) - dst;
+}
+
+
+//==============================================================================
+// Same as the one in boot2/tools/lzsstest.c (without the matches into the spaces
+// of the initial ring). Returns the compressed size.
+
+static u_int32_t compressLZSS(u_int8_t * dst, const u_int8_t * src, u_int32_t srclen)
+{
+	static int32_t head[HASH_SIZE];
+	int32_t * prev = allocate((srclen + 1) * sizeof(int32_t));
+
+	u_int8_t * flags = NULL;
+	u_int8_t * out = dst;
+	u_int32_t pos = 0, bit = 8, length, distance = 0, slot;
+
+	memset(head, 0xFF, sizeof(head));
+
+	while (pos < srclen)
+	{
+		if (bit == 8)
+		{
+			flags = out++;
+			*flags = 0;
+			bit = 0;
+		}
+
+		length = findMatch(src, srclen, pos, head, prev, F, N, &distance);
+
+		if (length <= THRESHOLD)
+		{
+			length = 1;
+			*flags |= (1 << bit);
+			*out++ = src[pos];
+		}
+		else
+		{
+			slot = (pos + R - distance) & N_MIN_1;
+			*out++ = (slot & 0xFF);
+			*out++ = (((slot >> 4) & 0xF0) | (length - THRESHOLD - 1));
+		}
+
+		bit++;
+		insertPositions(src, srclen, pos, length, head, prev);
+		pos += length;
+	}
+
+	free(prev);
+
+	return out - dst;
+}
+
+
+//==============================================================================
+// Decodes a stream into a buffer of exactly dstSize bytes (followed by guard
+// bytes) and checks the result, the output and the guard bytes.
+
+static void testVector(const char * name, const void * stream, u_int32_t streamSize, const void * expected, long expectedSize, u_int32_t dstSize)
+{
+	u_int8_t * output = allocate(dstSize + GUARD_SIZE);
+	u_int8_t * src = allocate(streamSize + 1);	// Exactly as large as the stream.
+	long result;
+	u_int32_t i;
+
+	memcpy(src, stream, streamSize);
+	memset(output, GUARD_BYTE, dstSize + GUARD_SIZE);
+
+	result = decompressLZVN(output, dstSize, src, streamSize);
+
+	check(result == expectedSize, name, "result", result);
+
+	if ((result == expectedSize) && (expectedSize > 0))
+	{
+		check(memcmp(output, expected, expectedSize) == 0, name, "output differs", expectedSize);
+	}
+
+	for (i = 0; i < GUARD_SIZE; i++)
+	{
+		if (output[dstSize + i] != GUARD_BYTE)
+		{
+			check(0, name, "wrote past dstSize, at", dstSize + i);
+			break;
+		}
+	}
+
+	free(src);
+	free(output);
+}
+
+
+//==============================================================================
+
+#define VECTOR(name, stream, expected)	testVector(name, stream, sizeof(stream) - 1, expected, sizeof(expected) - 1, 1024)
+#define INVALID(name, stream)			testVector(name, stream, sizeof(stream) - 1, "", -1, 1024)
+
+static void testReferenceVectors(void)
+{
+	char name[32], stream[8];
+	int opcode;
+
+	// One of each opcode form.
+	VECTOR("eos",			"\x06\0\0\0\0\0\0\0", "");
+	VECTOR("eos (short)",	"\x06", "");
+	VECTOR("nops",			"\x0E\x16\x0E\x06\0\0\0\0\0\0\0", "");
+	VECTOR("sml_l",			"\xE3" "abc" "\x06", "abc");
+	VECTOR("lrg_l",			"\xE0\x01" "0123456789abcdefg" "\x06", "0123456789abcdefg");
+	VECTOR("sml_d",			"\x40\x01" "x" "\x06", "xxxx");
+	VECTOR("sml_d L=3 M=4",	"\xC8\x02" "xyz" "\x06", "xyzyzyz");
+	VECTOR("med_d",			"\xE8" "abcdefgh" "\xA0\x20\x00\x06", "abcdefghabc");
+	VECTOR("med_d L=3 M=34", "\xE5" "abcde" "\xBF\x23\x00" "fgh" "\x06", "abcdefghabcdefghabcdefghabcdefghabcdefghab");
+	VECTOR("lrg_d",			"\xE4" "abcd" "\x2F\x04\x00\x06", "abcdabcdabcd");
+	VECTOR("pre_d",			"\xE2" "ab" "\x40\x02" "c" "\x46" "d" "\x06", "abcbcbdbdb");
+	VECTOR("sml_m",			"\xE2" "ab" "\x00\x02" "\xF7\x06", "abababababab");
+	VECTOR("lrg_m",			"\xE1" "a" "\x00\x01" "\xF0\x00\x06", "aaaaaaaaaaaaaaaaaaaa");
+	VECTOR("nop between",	"\xE1" "a" "\x0E" "\x00\x01" "\x16\xF1\x06", "aaaaa");
+
+	// Damaged streams.
+	INVALID("no eos",				"\xE3" "abc");
+	INVALID("empty",				"");
+	INVALID("sml_l truncated",		"\xE3" "ab");
+	INVALID("lrg_l truncated",		"\xE0");
+	INVALID("lrg_l data truncated",	"\xE0\x00" "abc");
+	INVALID("sml_d truncated",		"\xE1" "a" "\x00");
+	INVALID("med_d truncated",		"\xE1" "a" "\xA0\x04");
+	INVALID("lrg_d truncated",		"\xE1" "a" "\x07\x01");
+	INVALID("lrg_m truncated",		"\xE1" "a" "\x00\x01" "\xF0");
+	INVALID("literals truncated",	"\xC0\x01" "ab");
+	INVALID("D past start",			"\xE2" "ab" "\x00\x03\x06");
+	INVALID("D past start (lrg_d)",	"\xE2" "ab" "\x07\x00\x01\x06");
+	INVALID("D zero",				"\xE2" "ab" "\x00\x00\x06");
+	INVALID("pre_d without D",		"\x46" "a" "\x06");
+	INVALID("sml_m without D",		"\xE2" "ab" "\xF3\x06");
+	INVALID("lrg_m without D",		"\xE2" "ab" "\xF0\x00\x06");
+
+	// Undefined opcodes.
+	for (opcode = 0; opcode < 256; opcode++)
+	{
+		if ((((opcode & 0xC7) == 0x06) && (opcode != 0x06) && (opcode != 0x0E) && (opcode != 0x16)) ||
+			((opcode & 0xF0) == 0x70) || ((opcode & 0xF0) == 0xD0))
+		{
+			sprintf(name, "udef 0x%02X", opcode);
+			memcpy(stream, "\xE1" "a" "\x00\x01", 4);
+			stream[4] = opcode;
+			memcpy(stream + 5, "\xE1" "b\x06", 3);
+			testVector(name, stream, 8, "", -1, 1024);
+		}
+	}
+
+	// Output too small (literals, sml_d, lrg_m).
+	testVector("dst too small (sml_l)", "\xE3" "abc" "\x06", 5, "", -1, 2);
+	testVector("dst too small (sml_d)", "\x40\x01" "x" "\x06", 4, "", -1, 3);
+	testVector("dst too small (lrg_m)", "\xE1" "a" "\x00\x01" "\xF0\x00\x06", 7, "", -1, 19);
+	testVector("dst exact (lrg_m)", "\xE1" "a" "\x00\x01" "\xF0\x00\x06", 7, "aaaaaaaaaaaaaaaaaaaa", 20, 20);
+}
+
+
+//==============================================================================
+// The largest distance of sml_d, med_d and lrg_d, after as many literals (and
+// after one less, which must fail).
+
+static void testDistances(void)
+{
+	static const u_int32_t distances[] = { 0x5FF, 0x3FFF, 0xFFFF };
+	u_int8_t * stream = allocate(0x11000);
+	u_int8_t * expected = allocate(0x10010);
+	u_int8_t * out;
+	u_int32_t form, extra, distance, i;
+	char name[64];
+
+	for (form = 0; form < 3; form++)
+	{
+		distance = distances[form];
+
+		for (i = 0; i < distance; i++)
+		{
+			expected[i] = rand() & 0xFF;
+		}
+
+		for (i = distance; i < (distance + 3); i++)
+		{
+			expected[i] = expected[i - distance];
+		}
+
+		for (extra = 0; extra < 2; extra++)
+		{
+			out = putLiterals(stream, expected, distance - extra);
+
+			if (form == 0)
+			{
+				*out++ = distance >> 8;							// sml_d, M=3
+				*out++ = distance & 0xFF;
+			}
+			else if (form == 1)
+			{
+				*out++ = 0xA0;									// med_d, M=3
+				*out++ = (distance & 0x3F) << 2;
+				*out++ = distance >> 6;
+			}
+			else
+			{
+				*out++ = 0x07;									// lrg_d, M=3
+				*out++ = distance & 0xFF;
+				*out++ = distance >> 8;
+			}
+
+			*out++ = 0x06;
+
+			sprintf(name, "D=0x%X%s", distance, extra ? " past start" : "");
+			testVector(name, stream, out - stream, expected, extra ? -1L : (long)(distance + 3), distance + 3);
+		}
+	}
+
+	free(expected);
+	free(stream);
+}
+
+
+//==============================================================================
+// Matches (8 to 20 bytes back) that end 0 to 9 bytes before the end of dst, so
+// that the eight byte copies are right at the edge (and sometimes can't be used).
+
+static void testCopyEdges(void)
+{
+	u_int8_t stream[64], expected[128];
+	char name[64];
+	u_int32_t distance, length, slack, streamSize, i;
+
+	for (distance = 8; distance <= 20; distance++)
+	{
+		for (length = 3; length <= 34; length++)
+		{
+			// 32 literals, a med_d match and eos.
+			stream[0] = 0xE0;
+			stream[1] = 32 - 16;
+
+			for (i = 0; i < 32; i++)
+			{
+				stream[2 + i] = expected[i] = 'A' + ((i * 7) % 26);
+			}
+
+			stream[34] = 0xA0 | ((length - 3) >> 2);
+			stream[35] = ((distance & 0x3F) << 2) | ((length - 3) & 3);
+			stream[36] = distance >> 6;
+			stream[37] = 0x06;
+			streamSize = 38;
+
+			for (i = 32; i < (32 + length); i++)
+			{
+				expected[i] = expected[i - distance];
+			}
+
+			for (slack = 0; slack < 10; slack++)
+			{
+				sprintf(name, "copy edge D=%u M=%u +%u", distance, length, slack);
+				testVector(name, stream, streamSize, expected, 32 + length, 32 + length + slack);
+			}
+
+			sprintf(name, "copy edge D=%u M=%u -1", distance, length);
+			testVector(name, stream, streamSize, expected, -1, 32 + length - 1);
+		}
+	}
+}
+
+
+//==============================================================================
+// Compares decompressLZVN with the reference decoder on a stream and on damaged
+// and truncated copies of it.
+
+static void testAgainstReference(const char * name, const u_int8_t * stream, u_int32_t streamSize, u_int32_t size)
+{
+	u_int8_t * damaged = allocate(streamSize);
+	u_int8_t * expected = allocate(size + GUARD_SIZE);
+	u_int8_t * output = allocate(size + GUARD_SIZE);
+	long result, reference;
+	u_int32_t round, i, length;
+
+	for (round = 0; round < FUZZ_ROUNDS; round++)
+	{
+		memcpy(damaged, stream, streamSize);
+		length = streamSize;
+
+		if (round & 1)
+		{
+			length = rand() % (streamSize + 1);		// Truncated.
+		}
+		else
+		{
+			for (i = 1 + (rand() % 4); i--; )
+			{
+				damaged[rand() % streamSize] = rand() & 0xFF;
+			}
+		}
+
+		memset(expected, GUARD_BYTE, size + GUARD_SIZE);
+		memset(output, GUARD_BYTE, size + GUARD_SIZE);
+
+		reference = referenceLZVN(expected, size, damaged, length);
+		result = decompressLZVN(output, size, damaged, length);
+
+		check(result == reference, name, "damaged stream result differs, round", round);
+
+		if ((result == reference) && (result > 0))
+		{
+			check(memcmp(output, expected, result) == 0, name, "damaged stream output differs, round", round);
+		}
+
+		for (i = 0; i < GUARD_SIZE; i++)
+		{
+			if (output[size + i] != GUARD_BYTE)
+			{
+				check(0, name, "damaged stream written past dstSize, round", round);
+				break;
+			}
+		}
+	}
+
+	free(output);
+	free(expected);
+	free(damaged);
+}
+
+
+//==============================================================================
+
+static void testPayload(const char * name, const u_int8_t * data, u_int32_t size)
+{
+	u_int32_t bound = size + (size / 8) + 64;
+	u_int8_t * lzvn = allocate(bound);
+	u_int8_t * lzss = allocate(bound);
+	u_int8_t * output = allocate(size + GUARD_SIZE);
+	u_int32_t lzvnSize, lzssSize, pass;
+	double start, seconds[2] = { 0, 0 };
+	u_int64_t decoded[2] = { 0, 0 };
+	char fuzzName[64];
+
+	// With nops (correctness), then without (speed, like a real kernelcache).
+	lzvnSize = compressLZVN(lzvn, data, size, 1);
+	testVector(name, lzvn, lzvnSize, data, size, size);
+
+	// Damaged copies of (the stream of) the first 16 KB.
+	if (size > 16384)
+	{
+		lzvnSize = compressLZVN(lzvn, data, 16384, 1);
+	}
+
+	sprintf(fuzzName, "%s (damaged)", name);
+	testAgainstReference(fuzzName, lzvn, lzvnSize, (size < 16384) ? size : 16384);
+
+	lzvnSize = compressLZVN(lzvn, data, size, 0);
+	testVector(name, lzvn, lzvnSize, data, size, size);
+
+	lzssSize = compressLZSS(lzss, data, size);
+	check(decompressLZSS(output, size, lzss, lzssSize) == (int)size, name, "decompressLZSS size", size);
+	check(memcmp(output, data, size) == 0, name, "decompressLZSS output differs", size);
+
+	if (size < (1 << 20))
+	{
+		free(output);
+		free(lzss);
+		free(lzvn);
+		return;
+	}
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		do
+		{
+			start = now();
+
+			if (pass == 0)
+			{
+				decompressLZVN(output, size, lzvn, lzvnSize);
+			}
+			else
+			{
+				decompressLZSS(output, size, lzss, lzssSize);
+			}
+
+			seconds[pass] += now() - start;
+			decoded[pass] += size;
+		} while (seconds[pass] < BENCH_SECONDS);
+	}
+
+	printf("%-10s %9u bytes  LZVN %9u (%7.1f MB/s)  LZSS %9u (%7.1f MB/s)\n", name, size,
+		   lzvnSize, (decoded[0] / seconds[0]) / 1e6, lzssSize, (decoded[1] / seconds[1]) / 1e6);
+
+	free(output);
+	free(lzss);
+	free(lzvn);
+}
+
+
+//==============================================================================
+// Built-in payloads (same kinds as lzsstest).
+
+static void testBuiltInPayloads(void)
+{
+	static const char * words[] = { "kernel ", "extension ", "IOPCIDevice ", "com.apple.", "driver ", "\n", "    ",
+									"IOService", "OSBundleLibraries ", "<key>", "</key>", "<string>", "</string>" };
+	u_int32_t length = 2 << 20, i, j;
+	u_int8_t * data = allocate(length);
+
+	for (i = 0; i < length; )
+	{
+		const char * word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+
+		for (j = 0; (word[j] != '\0') && (i < length); j++)
+		{
+			data[i++] = word[j];
+		}
+	}
+
+	testPayload("text", data, length);
+
+	for (i = 0; i < length; i++)
+	{
+		data[i] = ((rand() % 4) == 0) ? (rand() & 0xFF) : "\x55\x48\x89\xE5\x8B\x45\xFC\x0F\x1F\x00\xE8\xC3\x90\x00\x00\x00"[rand() % 16];
+	}
+
+	testPayload("code", data, length);
+
+	for (i = 0; i < length; )
+	{
+		u_int32_t period = 1 + (rand() % 7), run = 8 + (rand() % 200);
+
+		for (j = 0; (j < run) && (i < length); j++, i++)
+		{
+			data[i] = (j < period) ? (rand() & 0xFF) : data[i - period];
+		}
+	}
+
+	testPayload("runs", data, length);
+
+	for (i = 0; i < length; i++)
+	{
+		data[i] = rand() & 0xFF;
+	}
+
+	testPayload("random", data, length);
+
+	// Far matches (lrg_d) and short payloads.
+	for (i = 0; i < length; i++)
+	{
+		data[i] = (i < 0x8000) ? (rand() & 0xFF) : data[i - 0x4000 - ((i >> 10) & 0x3FFF)];
+	}
+
+	testPayload("far", data, 0x40000);
+
+	for (i = 1; i < 64; i++)
+	{
+		testPayload("small", data + 0x9000, i);
+	}
+
+	free(data);
+}
+
+
+//==============================================================================
+
+static void testFile(const char * path)
+{
+	FILE * fp = fopen(path, "rb");
+	u_int8_t * data;
+	long length;
+
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error: can't open %s\n", path);
+		failures++;
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	length = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	data = allocate(length + 1);
+
+	if (fread(data, 1, length, fp) != (size_t)length)
+	{
+		fprintf(stderr, "Error: can't read %s\n", path);
+		failures++;
+	}
+	else
+	{
+		testPayload(path, data, length);
+	}
+
+	fclose(fp);
+	free(data);
+}
+
+
+//==============================================================================
+
+int main(int argc, char * argv[])
+{
+	int i;
+
+	srand(1);
+
+	testReferenceVectors();
+	testDistances();
+	testCopyEdges();
+
+	if (argc > 1)
+	{
+		for (i = 1; i < argc; i++)
+		{
+			testFile(argv[i]);
+		}
+	}
+	else
+	{
+		testBuiltInPayloads();
+	}
+
+	printf("%s\n", failures ? "FAILED" : "All tests passed.");
+
+	return failures ? 1 : 0;
+}